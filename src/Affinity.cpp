@@ -0,0 +1,85 @@
+#include "Affinity.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <thread>
+#include <algorithm>
+#include <stdio.h>
+
+namespace affinity {
+	int coreCount() {
+		return std::max<int>(std::thread::hardware_concurrency(), 1);
+	}
+
+#ifdef _WIN32
+	bool setAffinity(DWORD_PTR mask) {
+		if (mask == 0)
+			return false;
+		if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+			fprintf(stderr, "SetThreadAffinityMask failed (%lu)\n", GetLastError());
+			return false;
+		}
+		return true;
+	}
+
+	bool pinCurrentThread(int core) {
+		if (core < 0 || core >= coreCount() || core >= static_cast<int>(sizeof(DWORD_PTR) * 8)) // only the first processor group
+			return false;
+		return setAffinity(DWORD_PTR(1) << core);
+	}
+
+	bool avoidCores(std::initializer_list<int> cores) {
+		DWORD_PTR mask = 0;
+		for (int core = 0; core < coreCount() && core < static_cast<int>(sizeof(DWORD_PTR) * 8); core++)
+			mask |= DWORD_PTR(1) << core;
+		for (int core : cores)
+			if (core >= 0 && core < static_cast<int>(sizeof(DWORD_PTR) * 8))
+				mask &= ~(DWORD_PTR(1) << core);
+		return setAffinity(mask);
+	}
+
+	int currentCore() {
+		return GetCurrentProcessorNumber();
+	}
+#elif __linux__
+	bool setAffinity(const cpu_set_t& set) {
+		if (CPU_COUNT(&set) == 0)
+			return false;
+		int error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+		if (error != 0) {
+			fprintf(stderr, "pthread_setaffinity_np failed (%i)\n", error);
+			return false;
+		}
+		return true;
+	}
+
+	bool pinCurrentThread(int core) {
+		if (core < 0 || core >= coreCount() || core >= CPU_SETSIZE)
+			return false;
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(core, &set);
+		return setAffinity(set);
+	}
+
+	bool avoidCores(std::initializer_list<int> cores) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int core = 0; core < coreCount() && core < CPU_SETSIZE; core++)
+			CPU_SET(core, &set);
+		for (int core : cores)
+			if (core >= 0 && core < CPU_SETSIZE)
+				CPU_CLR(core, &set);
+		return setAffinity(set);
+	}
+
+	int currentCore() {
+		return sched_getcpu();
+	}
+#endif
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <initializer_list>
+
+// pins threads to cores, cores are numbered from 0 to std::thread::hardware_concurrency() - 1
+namespace affinity {
+	// restricts the calling thread to the core
+	// returns false on failure or if the core doesn't exist
+	bool pinCurrentThread(int core);
+
+	// lets the calling thread run on every core except the given ones, negative cores are ignored
+	// returns false on failure or if no core would be left
+	bool avoidCores(std::initializer_list<int> cores);
+
+	// the core the calling thread currently runs on, -1 if unknown
+	int currentCore();
+}
@@ -0,0 +1,284 @@
+#include "Capture.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif __linux__
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+
+namespace capture {
+	const char _magic[8] = { 'V', 'O', 'D', 'C', 'A', 'P', '0', '1' };
+	const size_t _fileHeaderSize = sizeof(_magic) + sizeof(uint64_t); // magic + start time (unix epoch in ns)
+	const size_t _recordHeaderSize = sizeof(uint32_t) + sizeof(uint64_t) + 4 * sizeof(uint8_t) + sizeof(uint16_t); // size, time, direction, channel, side, address size, port
+	const size_t _mapChunkSize = 16 * 1024 * 1024; // the file grows by this size when the mapping is full
+
+	std::mutex _mCapture; // controls access to the mapping and the socket sides
+	std::atomic<bool> _isCapturing = false; // checked without locking so disabled captures cost nothing
+	uint32_t _users = 0;
+	std::unordered_map<int, Side> _socketSides = {};
+
+	std::chrono::time_point<std::chrono::steady_clock> _startTime;
+	char* _map = nullptr;
+	size_t _capacity = 0;
+	size_t _offset = 0; // the end of the written data
+
+#ifdef _WIN32
+	HANDLE _file = INVALID_HANDLE_VALUE;
+	HANDLE _mapping = NULL;
+#elif __linux__
+	int _file = -1;
+#endif
+
+	// maps the file with the given size, the file is resized to capacity
+	bool mapFile(size_t capacity) {
+#ifdef _WIN32
+		_mapping = CreateFileMappingA(_file, NULL, PAGE_READWRITE, static_cast<DWORD>(capacity >> 32), static_cast<DWORD>(capacity), NULL);
+		if (!_mapping) {
+			fprintf(stderr, "capture: CreateFileMapping failed (%lu)\n", GetLastError());
+			return false;
+		}
+		_map = reinterpret_cast<char*>(MapViewOfFile(_mapping, FILE_MAP_WRITE, 0, 0, capacity));
+		if (!_map) {
+			fprintf(stderr, "capture: MapViewOfFile failed (%lu)\n", GetLastError());
+			CloseHandle(_mapping);
+			_mapping = NULL;
+			return false;
+		}
+#elif __linux__
+		if (ftruncate(_file, capacity) < 0) {
+			perror("capture: ftruncate");
+			return false;
+		}
+		void* map = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _file, 0);
+		if (map == MAP_FAILED) {
+			perror("capture: mmap");
+			_map = nullptr;
+			return false;
+		}
+		_map = reinterpret_cast<char*>(map);
+#endif
+		_capacity = capacity;
+		return true;
+	}
+
+	void unmapFile() {
+		if (!_map)
+			return;
+#ifdef _WIN32
+		UnmapViewOfFile(_map);
+		CloseHandle(_mapping);
+		_mapping = NULL;
+#elif __linux__
+		munmap(_map, _capacity);
+#endif
+		_map = nullptr;
+	}
+
+	// unmaps the file and cuts off the unused part of the last chunk
+	void closeFile() {
+		unmapFile();
+#ifdef _WIN32
+		LARGE_INTEGER end;
+		end.QuadPart = _offset;
+		SetFilePointerEx(_file, end, NULL, FILE_BEGIN);
+		SetEndOfFile(_file);
+		CloseHandle(_file);
+		_file = INVALID_HANDLE_VALUE;
+#elif __linux__
+		if (ftruncate(_file, _offset) < 0)
+			perror("capture: ftruncate");
+		close(_file);
+		_file = -1;
+#endif
+	}
+
+	bool start(std::string path) {
+		std::lock_guard<std::mutex> lk(_mCapture);
+		if (_users++ > 0)
+			return true;
+
+#ifdef _WIN32
+		_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (_file == INVALID_HANDLE_VALUE) {
+			fprintf(stderr, "capture: cannot open %s (%lu)\n", path.c_str(), GetLastError());
+			_users = 0;
+			return false;
+		}
+#elif __linux__
+		_file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (_file < 0) {
+			perror("capture: open");
+			_users = 0;
+			return false;
+		}
+#endif
+		if (!mapFile(_mapChunkSize)) {
+			_offset = 0;
+			closeFile();
+			_users = 0;
+			return false;
+		}
+
+		uint64_t epochTime = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		memcpy(_map, _magic, sizeof(_magic));
+		memcpy(_map + sizeof(_magic), &epochTime, sizeof(uint64_t));
+		_offset = _fileHeaderSize;
+
+		_startTime = std::chrono::steady_clock::now();
+		_isCapturing = true;
+		printf("capturing network traffic into %s\n", path.c_str());
+		return true;
+	}
+
+	void stop() {
+		std::lock_guard<std::mutex> lk(_mCapture);
+		if (_users == 0 || --_users > 0)
+			return;
+		_isCapturing = false;
+		closeFile();
+		printf("capture done (%zu bytes)\n", _offset);
+		_offset = 0;
+	}
+
+	bool isCapturing() {
+		return _isCapturing;
+	}
+
+	void registerSocket(int socket, Side side) {
+		std::lock_guard<std::mutex> lk(_mCapture);
+		_socketSides[socket] = side;
+	}
+
+	void unregisterSocket(int socket) {
+		std::lock_guard<std::mutex> lk(_mCapture);
+		_socketSides.erase(socket);
+	}
+
+	Side getSide(int socket) {
+		std::lock_guard<std::mutex> lk(_mCapture);
+		auto it = _socketSides.find(socket);
+		return it == _socketSides.end() ? eCLIENT : it->second;
+	}
+
+	void record(Direction direction, Channel channel, int socket, const sockaddr* peer, const char* data, uint32_t size) {
+		if (!_isCapturing.load(std::memory_order_relaxed))
+			return;
+		uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _startTime).count();
+
+		sockaddr_storage peerAddr = {};
+		if (peer) {
+			memcpy(&peerAddr, peer, peer->sa_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in));
+		}
+		else {
+			socklen_t peerlen = sizeof(sockaddr_storage);
+			if (getpeername(socket, reinterpret_cast<sockaddr*>(&peerAddr), &peerlen) < 0)
+				peerAddr.ss_family = AF_UNSPEC;
+		}
+
+		uint8_t addrSize = 0;
+		uint16_t port = 0;
+		const void* addr = nullptr;
+		if (peerAddr.ss_family == AF_INET) {
+			auto* sa4 = reinterpret_cast<sockaddr_in*>(&peerAddr);
+			addrSize = sizeof(IN_ADDR);
+			port = sa4->sin_port;
+			addr = &sa4->sin_addr;
+		}
+		else if (peerAddr.ss_family == AF_INET6) {
+			auto* sa6 = reinterpret_cast<sockaddr_in6*>(&peerAddr);
+			addrSize = sizeof(IN6_ADDR);
+			port = sa6->sin6_port;
+			addr = &sa6->sin6_addr;
+		}
+
+		std::lock_guard<std::mutex> lk(_mCapture);
+		if (!_isCapturing)
+			return;
+
+		Side side = eCLIENT;
+		auto it = _socketSides.find(socket);
+		if (it != _socketSides.end())
+			side = it->second;
+
+		size_t recordSize = _recordHeaderSize + addrSize + size;
+		if (_offset + recordSize > _capacity) { // grow the file, the mapping has to be recreated
+			size_t capacity = _capacity + std::max<size_t>(_mapChunkSize, recordSize);
+			unmapFile();
+			if (!mapFile(capacity)) {
+				fprintf(stderr, "capture: cannot grow capture file, capture stopped\n");
+				_isCapturing = false;
+				return;
+			}
+		}
+
+		char* buf = _map + _offset;
+		memcpy(buf, &size, sizeof(uint32_t)); buf += sizeof(uint32_t);
+		memcpy(buf, &time, sizeof(uint64_t)); buf += sizeof(uint64_t);
+		*buf++ = direction;
+		*buf++ = channel;
+		*buf++ = side;
+		*buf++ = addrSize;
+		memcpy(buf, &port, sizeof(uint16_t)); buf += sizeof(uint16_t);
+		if (addr)
+			memcpy(buf, addr, addrSize);
+		buf += addrSize;
+		memcpy(buf, data, size);
+		_offset += recordSize;
+	}
+
+	bool Reader::open(std::string path) {
+		m_file.open(path, std::ios::binary);
+		if (!m_file.is_open())
+			return false;
+
+		char header[_fileHeaderSize];
+		if (!m_file.read(header, _fileHeaderSize))
+			return false;
+		return memcmp(header, _magic, sizeof(_magic)) == 0;
+	}
+
+	bool Reader::next(Record& record) {
+		char header[_recordHeaderSize];
+		if (!m_file.read(header, _recordHeaderSize))
+			return false;
+
+		const char* buf = header;
+		memcpy(&record.size, buf, sizeof(uint32_t)); buf += sizeof(uint32_t);
+		memcpy(&record.time, buf, sizeof(uint64_t)); buf += sizeof(uint64_t);
+		record.direction = static_cast<Direction>(*buf++);
+		record.channel = static_cast<Channel>(*buf++);
+		record.side = static_cast<Side>(*buf++);
+		uint8_t addrSize = *buf++;
+		uint16_t port;
+		memcpy(&port, buf, sizeof(uint16_t));
+
+		record.peer = {};
+		if (addrSize == sizeof(IN_ADDR)) {
+			auto* sa4 = reinterpret_cast<sockaddr_in*>(&record.peer);
+			sa4->sin_family = AF_INET;
+			sa4->sin_port = port;
+			m_file.read(reinterpret_cast<char*>(&sa4->sin_addr), addrSize);
+		}
+		else if (addrSize == sizeof(IN6_ADDR)) {
+			auto* sa6 = reinterpret_cast<sockaddr_in6*>(&record.peer);
+			sa6->sin6_family = AF_INET6;
+			sa6->sin6_port = port;
+			m_file.read(reinterpret_cast<char*>(&sa6->sin6_addr), addrSize);
+		}
+		else
+			record.peer.ss_family = AF_UNSPEC;
+
+		m_data.resize(record.size);
+		if (!m_file.read(m_data.data(), record.size))
+			return false;
+		record.data = m_data.data();
+		return true;
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "SockUitls.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+// records every packet sent or received by the network layer into an append-only memory mapped log file
+// the file starts with the magic "VODCAP01" and the start time as uint64 nanoseconds since the unix epoch, records follow until the end of the file
+// a record is uint32 size, uint64 time, uint8 direction, channel, side and address size, uint16 port, then the peer address and size bytes of the raw packet
+// numbers are in host byte order, the port and address are copied from the sockaddr as they are, the address size is 0, 4 or 16
+namespace capture {
+	enum Direction : uint8_t {
+		eSEND = 0,
+		eRECV = 1
+	};
+
+	enum Channel : uint8_t {
+		eSTREAM = 0,
+		eDGRAM = 1
+	};
+
+	// which part of the process handled the packet, a hosting game records both sides into the same file
+	enum Side : uint8_t {
+		eCLIENT = 0,
+		eSERVER = 1
+	};
+
+	struct Record {
+		uint64_t time = 0; // nanoseconds since the capture started
+		Direction direction = eSEND;
+		Channel channel = eSTREAM;
+		Side side = eCLIENT;
+		sockaddr_storage peer = {};
+		const char* data = nullptr; // points into the readers buffer, valid until the next call to Reader::next
+		uint32_t size = 0;
+	};
+
+	// starts capturing into the file at path, an existing file is overwritten
+	// can be called multiple times, the capture stops when stop was called as often as start
+	// returns false on failure
+	bool start(std::string path);
+
+	void stop();
+
+	bool isCapturing();
+
+	// marks the socket as belonging to the given side, unregistered sockets are recorded as eCLIENT
+	void registerSocket(int socket, Side side);
+
+	void unregisterSocket(int socket);
+
+	// the side the socket was registered for, eCLIENT for unregistered sockets
+	Side getSide(int socket);
+
+	// records a packet, does nothing if no capture is running
+	// if peer is nullptr the peer of the connected socket is recorded
+	void record(Direction direction, Channel channel, int socket, const sockaddr* peer, const char* data, uint32_t size);
+
+	// reads capture files sequentially
+	class Reader {
+	public:
+		// returns false if the file can't be opened or is no capture file
+		bool open(std::string path);
+
+		// reads the next record, returns false at the end of the file
+		bool next(Record& record);
+
+	private:
+		std::ifstream m_file;
+		std::vector<char> m_data;
+	};
+}
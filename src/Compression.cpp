@@ -0,0 +1,145 @@
+#include "Compression.h"
+
+#include <cstring>
+
+namespace compression {
+	const uint32_t _minMatch = 4;
+	const uint32_t _maxOffset = 0xFFFF;
+	const size_t _windowSize = 0x10000; // the history kept for matches, at least _maxOffset
+	const uint32_t _hashBits = 12;
+
+	uint32_t read32(const char* buf) {
+		uint32_t value;
+		memcpy(&value, buf, sizeof(uint32_t));
+		return value;
+	}
+
+	uint32_t hash(uint32_t sequence) {
+		return (sequence * 2654435761u) >> (32 - _hashBits);
+	}
+
+	// writes the remainder of a length that didn't fit into its 4 bits of the token
+	void writeLength(std::vector<char>& dst, size_t length) {
+		while (length >= 255) {
+			dst.push_back(static_cast<char>(255));
+			length -= 255;
+		}
+		dst.push_back(static_cast<char>(length));
+	}
+
+	// returns false if the length runs past the end of the block
+	bool readLength(const uint8_t*& ip, const uint8_t* end, size_t& length) {
+		uint8_t byte;
+		do {
+			if (ip >= end)
+				return false;
+			byte = *ip++;
+			length += byte;
+		} while (byte == 255);
+		return true;
+	}
+
+	// matchLength 0 writes a sequence without match, used at the end of a block
+	void writeSequence(std::vector<char>& dst, const char* literals, size_t literalLength, uint32_t offset, size_t matchLength) {
+		size_t matchCode = matchLength ? matchLength - _minMatch : 0;
+		uint8_t token = static_cast<uint8_t>((literalLength < 15 ? literalLength : 15) << 4 | (matchCode < 15 ? matchCode : 15));
+		dst.push_back(static_cast<char>(token));
+		if (literalLength >= 15)
+			writeLength(dst, literalLength - 15);
+		dst.insert(dst.end(), literals, literals + literalLength);
+		if (!matchLength)
+			return;
+		dst.push_back(static_cast<char>(offset & 0xFF)); // little endian like lz4
+		dst.push_back(static_cast<char>(offset >> 8));
+		if (matchCode >= 15)
+			writeLength(dst, matchCode - 15);
+	}
+
+	StreamCompressor::StreamCompressor() {
+		reset();
+	}
+
+	void StreamCompressor::compress(const char* src, uint32_t size, std::vector<char>& dst) {
+		size_t base = m_window.size();
+		m_window.insert(m_window.end(), src, src + size);
+		const char* window = m_window.data();
+		size_t end = m_window.size();
+
+		size_t anchor = base; // start of the literals not yet written
+		size_t ip = base;
+		while (ip + _minMatch <= end) {
+			uint32_t sequence = read32(window + ip);
+			int32_t& entry = m_table[hash(sequence)];
+			int32_t candidate = entry;
+			entry = static_cast<int32_t>(ip);
+			if (candidate < 0 || ip - candidate > _maxOffset || read32(window + candidate) != sequence) {
+				ip++;
+				continue;
+			}
+
+			size_t matchLength = _minMatch;
+			while (ip + matchLength < end && window[candidate + matchLength] == window[ip + matchLength]) // may overlap the current position
+				matchLength++;
+			writeSequence(dst, window + anchor, ip - anchor, static_cast<uint32_t>(ip - candidate), matchLength);
+			ip += matchLength;
+			anchor = ip;
+		}
+		writeSequence(dst, window + anchor, end - anchor, 0, 0);
+
+		if (m_window.size() > 2 * _windowSize) { // drop old history, positions in the table move with it
+			size_t shift = m_window.size() - _windowSize;
+			m_window.erase(m_window.begin(), m_window.begin() + shift);
+			for (auto& position : m_table)
+				position = position >= static_cast<int32_t>(shift) ? position - static_cast<int32_t>(shift) : -1;
+		}
+	}
+
+	void StreamCompressor::reset() {
+		m_window.clear();
+		m_table.assign(size_t(1) << _hashBits, -1);
+	}
+
+	bool StreamDecompressor::decompress(const char* src, uint32_t size, std::vector<char>& dst, uint32_t maxSize) {
+		size_t base = m_window.size();
+		const uint8_t* ip = reinterpret_cast<const uint8_t*>(src);
+		const uint8_t* end = ip + size;
+
+		while (ip < end) {
+			uint8_t token = *ip++;
+			size_t literalLength = token >> 4;
+			if (literalLength == 15 && !readLength(ip, end, literalLength))
+				return false;
+			if (literalLength > static_cast<size_t>(end - ip) || literalLength > maxSize - (m_window.size() - base))
+				return false;
+			m_window.insert(m_window.end(), ip, ip + literalLength);
+			ip += literalLength;
+			if (ip == end) // last sequence
+				break;
+
+			if (end - ip < 2)
+				return false;
+			size_t offset = ip[0] | ip[1] << 8;
+			ip += 2;
+			size_t matchLength = token & 0xF;
+			if (matchLength == 15 && !readLength(ip, end, matchLength))
+				return false;
+			matchLength += _minMatch;
+			if (offset == 0 || offset > m_window.size() || matchLength > maxSize - (m_window.size() - base)) // long matches expand a few bytes to gigabytes
+				return false;
+
+			size_t from = m_window.size() - offset;
+			m_window.reserve(m_window.size() + matchLength);
+			for (size_t i = 0; i < matchLength; i++) // byte by byte, the match may overlap its own output
+				m_window.push_back(m_window[from + i]);
+		}
+		dst.insert(dst.end(), m_window.begin() + base, m_window.end());
+
+		if (m_window.size() > 2 * _windowSize)
+			m_window.erase(m_window.begin(), m_window.end() - _windowSize);
+		return true;
+	}
+
+	void StreamDecompressor::reset() {
+		m_window.clear();
+	}
+}
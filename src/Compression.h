@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// lz4 style streaming compression
+// every block may reference the previous 64KiB of the stream, so blocks have to be decompressed in the order they were compressed
+// a block is a list of sequences: token (4 bit literal length, 4 bit match length - 4), extra literal length bytes, literals, 16 bit offset, extra match length bytes
+// the last sequence of a block only contains literals
+namespace compression {
+	class StreamCompressor {
+	public:
+		StreamCompressor();
+
+		// compresses size bytes and appends the block to dst
+		void compress(const char* src, uint32_t size, std::vector<char>& dst);
+
+		// forgets the history, the decompressor has to be reset as well
+		void reset();
+
+	private:
+		std::vector<char> m_window; // the end of the stream, matches can reference it
+		std::vector<int32_t> m_table; // the last position of each hashed 4 byte sequence in the window, -1 if empty
+	};
+
+	class StreamDecompressor {
+	public:
+		// decompresses a block and appends the result to dst
+		// returns false if the block is corrupt or would decompress to more than maxSize bytes
+		bool decompress(const char* src, uint32_t size, std::vector<char>& dst, uint32_t maxSize);
+
+		void reset();
+
+	private:
+		std::vector<char> m_window; // the end of the decompressed stream
+	};
+}
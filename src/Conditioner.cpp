@@ -0,0 +1,236 @@
+#include "Conditioner.h"
+
+#include "Capture.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <queue>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+
+namespace conditioner {
+	typedef std::chrono::steady_clock Clock;
+
+	struct Delayed {
+		Clock::time_point due;
+		uint64_t sequence; // keeps the order of packets with the same due time
+		int socket;
+		bool isDgram;
+		sockaddr_storage addr;
+		int addrlen;
+		std::vector<char> data;
+
+		bool operator>(const Delayed& other) const {
+			return due != other.due ? due > other.due : sequence > other.sequence;
+		}
+	};
+
+	const int _streamSendTimeout = 1000; // milliseconds the sender waits for a full non-blocking stream before it gives up on the packet
+
+	// set while a path is conditioned or packets are still queued, the sends of an unconditioned process check it without locking
+	std::atomic<bool> _active = false;
+	std::mutex _mConditioner; // controls access to all variables of the conditioner
+	std::condition_variable _cvQueue;
+	std::condition_variable _cvSent; // signaled when the sender is done with a socket
+	int _sendingSocket = -1; // the socket the sender uses while the lock is released
+	Conditions _conditions[2] = {};
+	std::priority_queue<Delayed, std::vector<Delayed>, std::greater<Delayed>> _queue;
+	uint64_t _nextSequence = 0;
+	struct StreamTail {
+		Clock::time_point due; // of the last queued packet
+		uint32_t pending = 0; // queued packets
+	};
+	std::unordered_map<int, StreamTail> _streamTails = {}; // keeps the packets of a stream in order while any are queued
+	bool _isSending = false; // the sender thread runs until the queue is empty
+	std::mt19937 _random(std::random_device{}());
+	Stats _stats = {};
+
+	// sends the whole packet, blocks only the sender thread
+	void sendDelayed(const Delayed& delayed) {
+		if (delayed.isDgram) {
+			if (sendto(delayed.socket, delayed.data.data(), delayed.data.size(), 0, reinterpret_cast<const sockaddr*>(&delayed.addr), delayed.addrlen) == -1)
+				sock::printLastError("conditioner sendto");
+			return;
+		}
+		size_t offset = 0;
+		while (offset < delayed.data.size()) {
+			int bytesSent = send(delayed.socket, delayed.data.data() + offset, delayed.data.size() - offset, 0);
+			if (bytesSent == -1 && sock::wouldBlock()) { // the clients of the server have non-blocking streams
+				pollfd pfd = { delayed.socket, POLLOUT, 0 };
+				if (sock::pollState(&pfd, 1, _streamSendTimeout) > 0)
+					continue;
+				printf("conditioner send: the stream didn't take the packet in time\n");
+				return;
+			}
+			if (bytesSent == -1) {
+				sock::printLastError("conditioner send");
+				return;
+			}
+			offset += bytesSent;
+		}
+	}
+
+	// _mConditioner must be locked
+	bool conditionsActive() {
+		return _conditions[eUPSTREAM].isActive() || _conditions[eDOWNSTREAM].isActive();
+	}
+
+	// sends the due packets, ends when the queue is empty so no thread is left over at exit
+	void senderLoop() {
+		std::unique_lock<std::mutex> lk(_mConditioner);
+		while (!_queue.empty()) {
+			Clock::time_point due = _queue.top().due; // copied, the queue reallocates while the lock is released
+			if (due > Clock::now()) {
+				_cvQueue.wait_until(lk, due); // woken early when a packet with an earlier due time is queued
+				continue;
+			}
+			Delayed delayed = std::move(const_cast<Delayed&>(_queue.top()));
+			_queue.pop();
+			if (!delayed.isDgram) {
+				auto tail = _streamTails.find(delayed.socket);
+				if (tail != _streamTails.end() && --tail->second.pending == 0)
+					_streamTails.erase(tail);
+			}
+
+			// sends without the lock, so the senders of the process never wait on a slow socket
+			// forgetSocket waits until the sender is done with the socket, so it isn't closed while in use
+			_sendingSocket = delayed.socket;
+			lk.unlock();
+			sendDelayed(delayed);
+			lk.lock();
+			_sendingSocket = -1;
+			_cvSent.notify_all();
+		}
+		_isSending = false;
+		_active = conditionsActive();
+	}
+
+	// _mConditioner must be locked
+	Clock::duration randomDelay(const Conditions& conditions) {
+		float delay = conditions.latency + std::uniform_real_distribution<float>(0, conditions.jitter)(_random);
+		return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float, std::milli>(delay));
+	}
+
+	// _mConditioner must be locked
+	bool chance(float probability) {
+		return probability > 0 && std::uniform_real_distribution<float>(0, 1)(_random) < probability;
+	}
+
+	// _mConditioner must be locked
+	void enqueue(Delayed delayed) {
+		delayed.sequence = _nextSequence++;
+		bool isFirst = _queue.empty() || delayed.due < _queue.top().due;
+		_queue.push(std::move(delayed));
+		if (!_isSending) {
+			_isSending = true;
+			std::thread(senderLoop).detach();
+		}
+		else if (isFirst)
+			_cvQueue.notify_one();
+	}
+
+	void setConditions(Path path, Conditions conditions) {
+		std::lock_guard<std::mutex> lk(_mConditioner);
+		_conditions[path] = conditions;
+		_active = conditionsActive() || !_queue.empty(); // queued packets must not be overtaken
+	}
+
+	Conditions getConditions(Path path) {
+		std::lock_guard<std::mutex> lk(_mConditioner);
+		return _conditions[path];
+	}
+
+	bool isActive() {
+		return _active;
+	}
+
+	Path getPath(int socket) {
+		return capture::getSide(socket) == capture::eSERVER ? eDOWNSTREAM : eUPSTREAM;
+	}
+
+	bool sendStream(int socket, const char* buf, uint32_t len) {
+		if (!_active) // nothing conditioned and nothing queued, no lock on the send path
+			return false;
+		Path path = getPath(socket);
+		std::lock_guard<std::mutex> lk(_mConditioner);
+		const Conditions& conditions = _conditions[path];
+		auto tail = _streamTails.find(socket);
+		if (!conditions.isActive() && tail == _streamTails.end()) // packets still queued for the socket would be overtaken
+			return false;
+
+		Delayed delayed;
+		delayed.due = Clock::now() + randomDelay(conditions);
+		if (tail != _streamTails.end())
+			delayed.due = std::max(delayed.due, tail->second.due); // jitter never reorders a stream
+		delayed.socket = socket;
+		delayed.isDgram = false;
+		delayed.addrlen = 0;
+		delayed.data.assign(buf, buf + len);
+		StreamTail& newTail = _streamTails[socket];
+		newTail.due = delayed.due;
+		newTail.pending++;
+		_stats.delayed++;
+		enqueue(std::move(delayed));
+		return true;
+	}
+
+	bool sendDgram(int socket, const sockaddr* addr, int addrlen, const char* buf, uint32_t len) {
+		if (!_active)
+			return false;
+		Path path = getPath(socket);
+		std::lock_guard<std::mutex> lk(_mConditioner);
+		const Conditions& conditions = _conditions[path];
+		if (!conditions.isActive())
+			return false;
+		if (chance(conditions.loss)) {
+			_stats.dropped++;
+			return true;
+		}
+
+		uint32_t copies = chance(conditions.duplicate) ? 2 : 1;
+		_stats.duplicated += copies - 1;
+		for (uint32_t i = 0; i < copies; i++) {
+			Delayed delayed;
+			delayed.due = Clock::now() + randomDelay(conditions);
+			if (chance(conditions.reorder)) {
+				delayed.due += randomDelay(conditions);
+				_stats.reordered++;
+			}
+			delayed.socket = socket;
+			delayed.isDgram = true;
+			memcpy(&delayed.addr, addr, addrlen);
+			delayed.addrlen = addrlen;
+			delayed.data.assign(buf, buf + len);
+			_stats.delayed++;
+			enqueue(std::move(delayed));
+		}
+		return true;
+	}
+
+	void forgetSocket(int socket) {
+		if (!_active)
+			return;
+		std::unique_lock<std::mutex> lk(_mConditioner);
+		_cvSent.wait(lk, [socket]() { return _sendingSocket != socket; });
+		_streamTails.erase(socket);
+		std::vector<Delayed> kept;
+		while (!_queue.empty()) {
+			if (_queue.top().socket != socket)
+				kept.push_back(std::move(const_cast<Delayed&>(_queue.top())));
+			_queue.pop();
+		}
+		for (auto& delayed : kept)
+			_queue.push(std::move(delayed));
+	}
+
+	Stats getStats() {
+		std::lock_guard<std::mutex> lk(_mConditioner);
+		return _stats;
+	}
+}
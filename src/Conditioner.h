@@ -0,0 +1,57 @@
+#pragma once
+
+#include "SockUitls.h"
+
+#include <cstdint>
+
+// simulates a bad network on the sending side, so bad conditions can be tested over loopback
+// packets are held back, dropped, duplicated and reordered before a thread sends them
+// server sockets use the downstream conditions, all other sockets the upstream conditions, see capture::registerSocket
+// streams are only delayed and keep their order, dgrams get all effects
+namespace conditioner {
+	enum Path {
+		eUPSTREAM = 0, // sent by the client
+		eDOWNSTREAM = 1 // sent by the server
+	};
+
+	struct Conditions {
+		float latency = 0; // milliseconds every packet is held back
+		float jitter = 0; // up to this many milliseconds are added randomly
+		float loss = 0; // probability a dgram is dropped
+		float duplicate = 0; // probability a dgram is sent twice
+		float reorder = 0; // probability a dgram is held back for another latency + jitter, so later dgrams overtake it
+
+		bool isActive() const {
+			return latency > 0 || jitter > 0 || loss > 0 || duplicate > 0 || reorder > 0;
+		}
+	};
+
+	// can be called from any thread at any time, queued packets keep their send time
+	void setConditions(Path path, Conditions conditions);
+
+	Conditions getConditions(Path path);
+
+	// true if any path is conditioned or packets are still queued, doesn't lock
+	bool isActive();
+
+	// takes the packet if it has to be conditioned, the caller must not send it then
+	// returns false if the packet should be sent directly
+	bool sendStream(int socket, const char* buf, uint32_t len);
+
+	// takes the packet if it has to be conditioned, the caller must not send it then
+	// returns false if the packet should be sent directly
+	bool sendDgram(int socket, const sockaddr* addr, int addrlen, const char* buf, uint32_t len);
+
+	// drops the queued packets of the socket, has to be called before the socket is closed
+	void forgetSocket(int socket);
+
+	// counters since the start of the process
+	struct Stats {
+		uint64_t delayed = 0;
+		uint64_t dropped = 0;
+		uint64_t duplicated = 0;
+		uint64_t reordered = 0;
+	};
+
+	Stats getStats();
+}
@@ -0,0 +1,234 @@
+#include "Directory.h"
+
+#include "SockUitls.h"
+#include "Conditioner.h"
+#include "Affinity.h"
+#include "Objects/Packets.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <stdio.h>
+
+namespace directory {
+	const std::chrono::milliseconds _registerInterval = std::chrono::milliseconds(1000); // how often changes are sent, also keeps the registration alive
+	const std::chrono::milliseconds _reconnectInterval = std::chrono::milliseconds(5000);
+	const int _connectTimeout = 2000; // milliseconds
+	const int _queryTimeout = 500; // milliseconds until a query is sent again
+	const int _queryAttempts = 3;
+
+	std::mutex _mRegistration; // guards starting and stopping the registration
+	std::condition_variable _cvRegistration;
+	bool _stopRegistration = false;
+	std::thread _registrationThread;
+
+	std::atomic<uint32_t> _latestQuery = 0;
+
+	// returns the socket or -1 on failure
+	int openSocket(std::string ip, std::string port, int type, sockaddr_storage& addr) {
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = type;
+		addrinfo* info;
+		int status;
+		if ((status = getaddrinfo(ip.c_str(), port.c_str(), &hints, &info)) != 0) {
+			fprintf(stderr, "directory getaddrinfo: %s\n", gai_strerror(status));
+			return -1;
+		}
+		int socketFd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+		if (socketFd < 0)
+			sock::printLastError("directory socket");
+		else
+			memcpy(&addr, info->ai_addr, info->ai_addrlen);
+		freeaddrinfo(info);
+		return socketFd;
+	}
+
+	void closeSocket(int socket) {
+		conditioner::forgetSocket(socket);
+		sock::closeSocket(socket);
+	}
+
+	// connects without blocking longer than _connectTimeout
+	// returns the socket or -1 on failure
+	int connectStream(std::string ip, std::string port) {
+		sockaddr_storage addr;
+		int socketFd = openSocket(ip, port, SOCK_STREAM, addr);
+		if (socketFd < 0)
+			return -1;
+		socklen_t addrlen = addr.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+		sock::setBlocking(socketFd, false);
+		if (connect(socketFd, reinterpret_cast<sockaddr*>(&addr), addrlen) < 0 && !sock::isConnectPending()) {
+			closeSocket(socketFd);
+			return -1;
+		}
+		pollfd pfd = { socketFd, POLLOUT, 0 };
+		if (sock::pollState(&pfd, 1, _connectTimeout) <= 0 || sock::socketError(socketFd) != 0) {
+			closeSocket(socketFd);
+			return -1;
+		}
+		sock::setBlocking(socketFd, true);
+		return socketFd;
+	}
+
+	// fills the packet with the rooms that changed since the last packet, sent holds the rooms the directory knows
+	void collectChanges(NetworkData& network, std::unordered_map<uint32_t, RoomInfo>& sent, DirectoryRegisterPacket& packet) {
+		auto spRoomStats = std::atomic_load(&network.spRoomStats);
+		std::unordered_map<uint32_t, RoomInfo> current;
+		if (spRoomStats)
+			for (auto& stats : *spRoomStats)
+				current[stats.info.id] = stats.info;
+
+		for (auto& roomPair : current) {
+			auto it = sent.find(roomPair.first);
+			const RoomInfo& info = roomPair.second;
+			if (it == sent.end() || it->second.players != info.players || it->second.maxPlayers != info.maxPlayers || it->second.name != info.name)
+				packet.rooms.push_back(info);
+		}
+		for (auto& roomPair : sent)
+			if (!current.count(roomPair.first))
+				packet.removedRooms.push_back(roomPair.first);
+		sent.swap(current);
+	}
+
+	void registrationLoop(NetworkData* network, std::string ip, std::string port, DirectoryRegisterPacket identity) {
+		std::unordered_map<uint32_t, RoomInfo> sent; // the rooms the directory knows
+		int socketFd = -1;
+		bool reportedFailure = false;
+
+		std::unique_lock<std::mutex> lk(_mRegistration);
+		while (!_stopRegistration) {
+			lk.unlock();
+			if (socketFd < 0) {
+				socketFd = connectStream(ip, port);
+				sent.clear(); // a new connection starts without rooms
+				if (socketFd >= 0) {
+					printf("registered at the directory %s:%s\n", ip.c_str(), port.c_str());
+					reportedFailure = false;
+				}
+				else if (!reportedFailure) {
+					printf("could not reach the directory %s:%s, retrying\n", ip.c_str(), port.c_str());
+					reportedFailure = true;
+				}
+			}
+			if (socketFd >= 0) {
+				DirectoryRegisterPacket packet = identity;
+				collectChanges(*network, sent, packet);
+				if (packet.sendTo(socketFd) == 0) {
+					printf("lost the directory, reconnecting\n");
+					closeSocket(socketFd);
+					socketFd = -1;
+				}
+			}
+			lk.lock();
+			_cvRegistration.wait_for(lk, socketFd < 0 ? _reconnectInterval : _registerInterval, [] { return _stopRegistration; });
+		}
+		if (socketFd >= 0)
+			closeSocket(socketFd); // the directory drops the rooms with the connection
+	}
+
+	void startRegistration(NetworkData& network) {
+		DirectoryRegisterPacket identity;
+		std::string ip;
+		std::string port;
+		{
+			std::lock_guard<std::mutex> lk(network.mNetwork);
+			if (network.directoryIp.empty())
+				return;
+			ip = network.directoryIp;
+			port = network.directoryPort;
+			identity.username = network.username;
+			identity.address = network.publicAddress;
+			identity.port = network.port;
+			identity.region = network.region;
+		}
+		std::lock_guard<std::mutex> lk(_mRegistration);
+		if (_registrationThread.joinable())
+			return;
+		_stopRegistration = false;
+		_registrationThread = std::thread(registrationLoop, &network, ip, port, identity);
+	}
+
+	void stopRegistration() {
+		{
+			std::lock_guard<std::mutex> lk(_mRegistration);
+			if (!_registrationThread.joinable())
+				return;
+			_stopRegistration = true;
+		}
+		_cvRegistration.notify_all();
+		_registrationThread.join();
+	}
+
+	void publishAnswer(NetworkData& network, uint32_t queryId, std::shared_ptr<const std::vector<DirectoryRoom>> spRooms, std::string status) {
+		std::lock_guard<std::mutex> lk(network.mClient);
+		if (queryId != _latestQuery) // a newer query was started, its answer counts
+			return;
+		network.directoryStatus = status;
+		if (spRooms)
+			std::atomic_store(&network.spDirectoryRooms, spRooms);
+	}
+
+	void queryLoop(NetworkData* network, std::string ip, std::string port, DirectoryQueryPacket query) {
+		if (network->hostGameCore >= 0) // started by the game thread, which is pinned to that core while it hosts
+			affinity::avoidCores({ network->hostGameCore });
+		sockaddr_storage addr;
+		int socketFd = openSocket(ip, port, SOCK_DGRAM, addr);
+		if (socketFd < 0) {
+			publishAnswer(*network, query.queryId, nullptr, "could not resolve the directory");
+			return;
+		}
+
+		for (int attempt = 0; attempt < _queryAttempts; attempt++) { // the query or its answer can get lost
+			query.sendToDgram(socketFd, reinterpret_cast<sockaddr*>(&addr));
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_queryTimeout);
+			while (true) {
+				int timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+				pollfd pfd = { socketFd, POLLIN, 0 };
+				if (timeout <= 0 || sock::pollState(&pfd, 1, timeout) <= 0)
+					break;
+				sockaddr_storage from;
+				int fromlen = sizeof from;
+				int type;
+				auto spPacket = Packet::receiveFromDgram(type, socketFd, reinterpret_cast<sockaddr*>(&from), &fromlen);
+				if (!spPacket || type != eDIRECTORY_ROOMS)
+					continue;
+				DirectoryRoomsPacket& answer = *reinterpret_cast<DirectoryRoomsPacket*>(spPacket.get());
+				if (answer.queryId != query.queryId) // a late answer to an earlier attempt of another query
+					continue;
+				closeSocket(socketFd);
+				publishAnswer(*network, query.queryId, std::make_shared<const std::vector<DirectoryRoom>>(std::move(answer.rooms)),
+					answer.more ? "more rooms match, narrow the search" : "");
+				return;
+			}
+		}
+		closeSocket(socketFd);
+		publishAnswer(*network, query.queryId, nullptr, "the directory didn't answer");
+	}
+
+	void query(NetworkData& network, Filter filter) {
+		DirectoryQueryPacket query;
+		std::string ip;
+		std::string port;
+		{
+			std::lock_guard<std::mutex> lk(network.mNetwork);
+			ip = network.directoryIp;
+			port = network.directoryPort;
+			query.username = network.username;
+		}
+		query.queryId = ++_latestQuery;
+		query.region = filter.region;
+		query.namePrefix = filter.namePrefix;
+		query.minFreeSlots = filter.minFreeSlots;
+		{
+			std::lock_guard<std::mutex> lk(network.mClient);
+			network.directoryStatus = ip.empty() ? "no directory set in the settings" : "searching";
+		}
+		if (ip.empty())
+			return;
+		std::thread(queryLoop, &network, ip, port, query).detach(); // the network data lives as long as the game
+	}
+}
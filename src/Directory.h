@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Shares/NetworkData.h"
+
+#include <string>
+#include <cstdint>
+
+// the game side of the matchmaking directory, see Tools/Directory.cpp
+// the directory is set with network.directoryIp and network.directoryPort
+namespace directory {
+	// registers the rooms of the running server at the directory on a thread of its own and keeps them up to date
+	// reads the room stats the server publishes, so it never waits for the server threads
+	// reconnects when the directory goes away
+	void startRegistration(NetworkData& network);
+
+	void stopRegistration();
+
+	struct Filter {
+		std::string region = ""; // empty matches every region
+		std::string namePrefix = "";
+		uint32_t minFreeSlots = 0;
+	};
+
+	// asks the directory for rooms on a background thread
+	// the answer is published in network.spDirectoryRooms, failures in network.directoryStatus
+	// only the answer of the newest query is published
+	void query(NetworkData& network, Filter filter);
+}
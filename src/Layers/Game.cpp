@@ -1,6 +1,10 @@
 #include "Game.h"
 
 #include "Log.h"
+#include "Affinity.h"
+#include "Conditioner.h"
+#include "PlayerStats.h"
+#include "Directory.h"
 #include "Layers/Network.h"
 #include "Shares/NetworkData.h"
 #include "Shares/Render.h"
@@ -216,6 +220,20 @@ void drawHud(GuiData& gui, Player& player, float dt) {
 
 }
 
+void drawLatencyHistogram(const char* name, std::shared_ptr<const LatencyHistogram> spHistogram) {
+	if (!spHistogram || spHistogram->count == 0)
+		return;
+	ImGui::SeparatorText(name);
+	ImGui::Text("p50: %lluus, p99: %lluus, max: %lluus", static_cast<unsigned long long>(spHistogram->percentile(0.5f)),
+		static_cast<unsigned long long>(spHistogram->percentile(0.99f)), static_cast<unsigned long long>(spHistogram->max));
+	float buckets[LatencyHistogram::bucketCount];
+	for (uint32_t i = 0; i < LatencyHistogram::bucketCount; i++)
+		buckets[i] = static_cast<float>(spHistogram->buckets[i]);
+	ImGui::PushID(name);
+	ImGui::PlotHistogram("##histogram", buckets, LatencyHistogram::bucketCount, 0, "log2(us)", 0, FLT_MAX, { 0, 60 });
+	ImGui::PopID();
+}
+
 void drawNetworkInterface(NetworkData& network, WorldData& world) {
 	bool serverRunning = server::isRunning();
 	bool clientRunning = client::isRunning();
@@ -236,16 +254,111 @@ void drawNetworkInterface(NetworkData& network, WorldData& world) {
 	memcpy(portBuf, network.port.data(), std::min<int>(6, network.port.size()));
 	ImGui::InputText("port", portBuf, 6);
 	network.port = portBuf;
+
+	static char captureBuf[260] = "";
+	memcpy(captureBuf, network.capturePath.data(), std::min<int>(260, network.capturePath.size()));
+	ImGui::InputText("capture file", captureBuf, 260);
+	network.capturePath = captureBuf;
+
+	static char directoryIpBuf[50] = "";
+	memcpy(directoryIpBuf, network.directoryIp.data(), std::min<int>(50, network.directoryIp.size()));
+	ImGui::InputText("directory ip", directoryIpBuf, 50); // empty doesn't use matchmaking
+	network.directoryIp = directoryIpBuf;
+
+	static char directoryPortBuf[6] = "";
+	memcpy(directoryPortBuf, network.directoryPort.data(), std::min<int>(6, network.directoryPort.size()));
+	ImGui::InputText("directory port", directoryPortBuf, 6);
+	network.directoryPort = directoryPortBuf;
+
+	static char publicAddressBuf[50] = "";
+	memcpy(publicAddressBuf, network.publicAddress.data(), std::min<int>(50, network.publicAddress.size()));
+	ImGui::InputText("public address", publicAddressBuf, 50); // empty lets the directory use the address it sees
+	network.publicAddress = publicAddressBuf;
+
+	ImGui::Checkbox("compress stream", &network.streamCompression);
+	ImGui::Checkbox("spectate", &network.spectate); // join watches the room through the relay at ip and port
+	ImGui::Checkbox("kernel timestamps", &network.kernelTimestamps);
+
+	ImGui::Checkbox("server busy poll", &network.serverBusyPoll);
+	ImGui::InputInt("server core", &network.serverCore); // -1 doesn't pin
+	ImGui::InputInt("game core when hosting", &network.hostGameCore);
+
+	static char relayIpBuf[50] = "";
+	memcpy(relayIpBuf, network.relayIp.data(), std::min<int>(50, network.relayIp.size()));
+	ImGui::InputText("spectator relay ip", relayIpBuf, 50); // empty doesn't stream to spectators
+	network.relayIp = relayIpBuf;
+
+	static char relayPortBuf[6] = "";
+	memcpy(relayPortBuf, network.relayPort.data(), std::min<int>(6, network.relayPort.size()));
+	ImGui::InputText("spectator relay port", relayPortBuf, 6);
+	network.relayPort = relayPortBuf;
+
+	ImGui::InputInt("spectator delay", &network.spectatorDelay); // milliseconds
+
+	static char metricsPortBuf[6] = "";
+	memcpy(metricsPortBuf, network.metricsPort.data(), std::min<int>(6, network.metricsPort.size()));
+	ImGui::InputText("metrics port", metricsPortBuf, 6); // empty doesn't serve metrics
+	network.metricsPort = metricsPortBuf;
 	if (serverRunning || clientRunning)
 		ImGui::EndDisabled();
+
+	drawLatencyHistogram("Client socket buffer delay", std::atomic_load(&network.spClientRxDelay));
+
+	ImGui::SeparatorText("Conditioner"); // changes apply immediately, also while connected
+	const char* pathNames[] = { "upstream", "downstream" };
+	for (int path = conditioner::eUPSTREAM; path <= conditioner::eDOWNSTREAM; path++) {
+		conditioner::Conditions conditions = conditioner::getConditions(static_cast<conditioner::Path>(path));
+		ImGui::PushID(path);
+		ImGui::Text(pathNames[path]);
+		bool changed = false;
+		changed |= ImGui::SliderFloat("latency (ms)", &conditions.latency, 0, 500);
+		changed |= ImGui::SliderFloat("jitter (ms)", &conditions.jitter, 0, 200);
+		changed |= ImGui::SliderFloat("loss", &conditions.loss, 0, 1);
+		changed |= ImGui::SliderFloat("duplicate", &conditions.duplicate, 0, 1);
+		changed |= ImGui::SliderFloat("reorder", &conditions.reorder, 0, 1);
+		if (changed)
+			conditioner::setConditions(static_cast<conditioner::Path>(path), conditions);
+		ImGui::PopID();
+	}
+	conditioner::Stats conditionerStats = conditioner::getStats();
+	ImGui::Text("delayed: %llu, dropped: %llu, duplicated: %llu, reordered: %llu", static_cast<unsigned long long>(conditionerStats.delayed),
+		static_cast<unsigned long long>(conditionerStats.dropped), static_cast<unsigned long long>(conditionerStats.duplicated), static_cast<unsigned long long>(conditionerStats.reordered));
 }
 
 void drawServerInterface(NetworkData& network) {
 	ImGui::Begin("Server");
 	if (server::isRunning()) {
-		std::lock_guard<std::mutex> lk(network.mServer);
-		for (auto& name : network.playerList)
-			ImGui::Text(name.c_str());
+		auto spRoster = std::atomic_load(&network.spRoster); // snapshots published by the server, no locking needed
+		auto spRoomStats = std::atomic_load(&network.spRoomStats);
+		ImGui::SeparatorText("Players");
+		if (spRoster)
+			for (auto& name : spRoster->players)
+				ImGui::Text(name.c_str());
+		ImGui::SeparatorText("Rooms");
+		if (spRoomStats) {
+			for (auto& stats : *spRoomStats) {
+				ImGui::Text("%s (%u/%u)", stats.info.name.c_str(), stats.info.players, stats.info.maxPlayers);
+				ImGui::Text("  ticks: %llu, tick: %.3fms", static_cast<unsigned long long>(stats.ticks), stats.tickDuration * 1000.f);
+				ImGui::Text("  packets in/out: %llu/%llu, sent: %llukB", static_cast<unsigned long long>(stats.packetsReceived), static_cast<unsigned long long>(stats.packetsSent), static_cast<unsigned long long>(stats.bytesSent / 1024));
+				ImGui::Text("  deferred updates: %llu, coalesced moves: %llu", static_cast<unsigned long long>(stats.updatesDeferred), static_cast<unsigned long long>(stats.movesCoalesced));
+				if (stats.streamBytesRaw > 0)
+					ImGui::Text("  stream ratio: %.2f, compress: %.2fus/kB", static_cast<float>(stats.streamBytesSent) / stats.streamBytesRaw, stats.compressTime * 1e6f / (stats.streamBytesRaw / 1024.f));
+			}
+		}
+		if (auto spIngress = std::atomic_load(&network.spIngressStats)) {
+			ImGui::SeparatorText("Throttled packets");
+			ImGui::Text("moves: %llu, rays: %llu, events: %llu, control: %llu", static_cast<unsigned long long>(spIngress->movesThrottled), static_cast<unsigned long long>(spIngress->raysThrottled),
+				static_cast<unsigned long long>(spIngress->eventsThrottled), static_cast<unsigned long long>(spIngress->controlThrottled));
+			ImGui::Text("clients over budget: %llu", static_cast<unsigned long long>(spIngress->clientsThrottled));
+		}
+		if (playerstats::isOpen()) {
+			ImGui::SeparatorText("Leaderboard");
+			auto leaders = playerstats::top(10);
+			for (size_t i = 0; i < leaders.size(); i++)
+				ImGui::Text("%zu. %s: %u kills, %u deaths, %.0f damage", i + 1, leaders[i].username.c_str(), leaders[i].kills, leaders[i].deaths, leaders[i].damage);
+		}
+		drawLatencyHistogram("Wake-up latency", std::atomic_load(&network.spWakeLatency));
+		drawLatencyHistogram("Socket buffer delay", std::atomic_load(&network.spServerRxDelay));
 	}
 	else
 		ImGui::Text("You're not the host, only the host can see this window");
@@ -268,18 +381,58 @@ void drawSettings(WorldData& world, NetworkData& network, GuiData& gui) {
 	ImGui::End();
 }
 
-void drawHostInterface(GuiData& gui) {
+// starts the server and connects the player to it, switches to the game when connected
+void hostGame(NetworkData& network, WorldData& world) {
+	network.roomId = 0; // the default room of the own server, not the last room joined in the matchmaking
+	runServer(network);
+	waitServerStartup();
+	runLocalClient(network, world);
+	// pinned only after the network threads are started, new threads inherit the cores of the thread that starts them
+	if (network.hostGameCore >= 0 && !affinity::pinCurrentThread(network.hostGameCore)) // the server threads avoid this core
+		printf("could not pin the game to core %i\n", network.hostGameCore);
+}
+
+// stops the own server, the game may use every core again
+// the mask is reset even if no core is set now, the core can be changed while hosting
+void stopHosting() {
+	terminateServer();
+	affinity::avoidCores({});
+}
+
+void drawHostInterface(GuiData& gui, NetworkData& network, WorldData& world) {
 	ImGui::Begin("Host");
 
 	glm::vec2 region = ImGui::GetContentRegionAvail();
 	ImGui::BeginChild("Inner Menu", region - glm::vec2(0, 25));
 
+	bool serverRunning = server::isRunning();
+	if (serverRunning)
+		ImGui::BeginDisabled();
 	static const uint32_t bufSize = 50;
-	static char buf[bufSize] = "Room";
+	static char buf[bufSize] = "";
+	memcpy(buf, network.roomName.data(), std::min<int>(bufSize, network.roomName.size()));
 	ImGui::InputText("Name", buf, bufSize);
+	network.roomName = buf;
 
-	if (ImGui::Button("Host")) {
+	static char regionBuf[bufSize] = "";
+	memcpy(regionBuf, network.region.data(), std::min<int>(bufSize, network.region.size()));
+	ImGui::InputText("Region", regionBuf, bufSize);
+	network.region = regionBuf;
 
+	int maxPlayers = network.maxRoomPlayers;
+	if (ImGui::InputInt("Max players", &maxPlayers))
+		network.maxRoomPlayers = std::max(maxPlayers, 1);
+	if (serverRunning)
+		ImGui::EndDisabled();
+
+	if (network.directoryIp.empty())
+		ImGui::Text("Set a directory in the settings to list the room in the matchmaking");
+
+	if (serverRunning)
+		ImGui::Text("Hosting %s", network.roomName.c_str());
+	else if (ImGui::Button("Host")) {
+		hostGame(network, world);
+		gui.state = GuiData::ePAUSE;
 	}
 
 	ImGui::EndChild();
@@ -290,12 +443,38 @@ void drawHostInterface(GuiData& gui) {
 	ImGui::End();
 }
 
-void drawMatchmakingInterface(GuiData& gui) {
+void drawMatchmakingInterface(GuiData& gui, NetworkData& network, WorldData& world) {
 	ImGui::Begin("Matchmaking");
 
 	glm::vec2 region = ImGui::GetContentRegionAvail();
 	ImGui::BeginChild("Inner Menu", region - glm::vec2(0, 25));
 
+	static const uint32_t bufSize = 50;
+	static char regionBuf[bufSize] = "";
+	static char nameBuf[bufSize] = "";
+	static int minFreeSlots = 1;
+	ImGui::InputText("Region", regionBuf, bufSize); // empty searches every region
+	ImGui::InputText("Name", nameBuf, bufSize);
+	ImGui::InputInt("Free slots", &minFreeSlots);
+	if (ImGui::Button("Search")) {
+		directory::query(network, { regionBuf, nameBuf, static_cast<uint32_t>(std::max(minFreeSlots, 0)) });
+		gui.matchmakingSelectedRoomIndex = -1;
+	}
+	std::string directoryStatus;
+	{
+		std::lock_guard<std::mutex> lk(network.mClient);
+		directoryStatus = network.directoryStatus;
+	}
+	if (!directoryStatus.empty()) {
+		ImGui::SameLine();
+		ImGui::Text(directoryStatus.c_str());
+	}
+
+	auto spRooms = std::atomic_load(&network.spDirectoryRooms); // published by the query thread
+	size_t roomCount = spRooms ? spRooms->size() : 0;
+	if (gui.matchmakingSelectedRoomIndex >= static_cast<int>(roomCount))
+		gui.matchmakingSelectedRoomIndex = -1;
+
 	int oldIndex = gui.matchmakingSelectedRoomIndex;
 	region = ImGui::GetContentRegionAvail();
 	float width = region.x;
@@ -309,9 +488,11 @@ void drawMatchmakingInterface(GuiData& gui) {
 	ImGui::BeginChild("RoomSelection", {width, height}, flags);
 	ImGui::SeparatorText("Rooms");
 
-	for (uint32_t i = 0; i < 4; i++) {
+	for (int i = 0; i < static_cast<int>(roomCount); i++) {
+		const DirectoryRoom& room = (*spRooms)[i];
 		bool selected = gui.matchmakingSelectedRoomIndex == i;
-		if (ImGui::Selectable(("Room" + std::to_string(i)).c_str(), selected)) {
+		std::string label = room.info.name + " (" + std::to_string(room.info.players) + "/" + std::to_string(room.info.maxPlayers) + ")##" + std::to_string(i);
+		if (ImGui::Selectable(label.c_str(), selected)) {
 			if (selected)
 				gui.matchmakingSelectedRoomIndex = -1;
 			else
@@ -321,18 +502,28 @@ void drawMatchmakingInterface(GuiData& gui) {
 	ImGui::EndChild();
 
 	if (oldIndex >= 0) {
+		const DirectoryRoom& room = (*spRooms)[oldIndex];
 		ImGui::SameLine();
 		region = ImGui::GetContentRegionAvail();
 		ImGui::BeginChild("RoomInfo", region);
 
-		ImGui::SeparatorText("Players");
-		for (uint32_t i = 0; i < 4; i++) {
-			ImGui::Text("Player%i", i);
-		}
+		ImGui::SeparatorText(room.info.name.c_str());
+		ImGui::Text("Players: %u/%u", room.info.players, room.info.maxPlayers);
+		ImGui::Text("Region: %s", room.region.c_str());
+		ImGui::Text("Server: %s:%s", room.address.c_str(), room.port.c_str());
 
+		bool canJoin = !client::isRunning() && !server::isRunning();
+		if (!canJoin)
+			ImGui::BeginDisabled();
 		if (ImGui::Button("Join")) {
-
+			network.ip = room.address;
+			network.port = room.port;
+			network.roomId = room.info.id;
+			runClient(network, world); // switches to the game when connected
+			gui.state = GuiData::ePAUSE; // shows the connect progress
 		}
+		if (!canJoin)
+			ImGui::EndDisabled();
 
 		ImGui::EndChild();
 	}
@@ -388,24 +579,30 @@ void drawPauseMainMenu(WorldData& world, RenderData& render, NetworkData& networ
 	}
 
 	if (server::isRunning()) {
-		if (ImGui::Button("Cancel", gui.pauseButtonSize)) {
-			terminateServer();
-		}
+		if (ImGui::Button("Cancel", gui.pauseButtonSize))
+			stopHosting();
 	}
 	else {
-		if (ImGui::Button("Host", gui.pauseButtonSize)) {
-			runServer(network);
-			waitServerStartup();
-			runClient(network, world);
-			if (client::isRunning())
-				switchToGame(world, render);
-		}
+		if (ImGui::Button("Host", gui.pauseButtonSize))
+			hostGame(network, world);
 	}
 
-	if (ImGui::Button("Join", gui.pauseButtonSize)) {
-		runClient(network, world);
-		if (client::isRunning())
-			switchToGame(world, render);
+	ConnectState connectState;
+	std::string connectStatus;
+	{
+		std::lock_guard<std::mutex> lk(network.mClient);
+		connectState = network.connectState;
+		connectStatus = network.connectStatus;
+	}
+	if (client::isRunning() && (connectState == eCONNECT_RESOLVING || connectState == eCONNECT_CONNECTING)) { // connecting in the background
+		ImGui::PushFont(gui.textFont);
+		ImGui::Text("%s...", connectStatus.c_str());
+		ImGui::PopFont();
+		if (ImGui::Button("Cancel##Join", gui.pauseButtonSize))
+			terminateClient(network, world);
+	}
+	else if (ImGui::Button("Join", gui.pauseButtonSize)) {
+		runClient(network, world); // switches to the game when connected
 	}
 
 	if (ImGui::Button("Settings", gui.pauseButtonSize)) {
@@ -482,7 +679,7 @@ void drawPauseMenuClient(WorldData& world, RenderData& render, NetworkData& netw
 		if (client::isRunning())
 			terminateClient(network, world);
 		if (server::isRunning())
-			terminateServer();
+			stopHosting();
 		switchToMainMenu(world, render);
 	}
 	ImGui::PopFont();
@@ -541,13 +738,13 @@ void updateMainMenu(WorldData& world, RenderData& render, NetworkData& network,
 	if (ImGui::IsKeyPressed(ImGuiKey_H))
 		gui.state = GuiData::eHOST;
 	if (oldState & GuiData::eHOST) {
-		drawHostInterface(gui);
+		drawHostInterface(gui, network, world);
 	}
 
 	if (ImGui::IsKeyPressed(ImGuiKey_M))
 		gui.state = GuiData::eMATCHMAKING;
 	if (oldState & GuiData::eMATCHMAKING) {
-		drawMatchmakingInterface(gui);
+		drawMatchmakingInterface(gui, network, world);
 	}
 
 	drawErrorMessages(gui);
@@ -651,6 +848,13 @@ void gameLoop(RenderData& render, WorldData& world, NetworkData& network, GuiDat
 			network.clientErrorStack.clear();
 		}
 
+		logger::beginRegion("network");
+		client::processPackets(network, world); // apply packets from the receiver thread before the world is updated
+		logger::endRegion();
+
+		if (world.status == eMAIN_MENU && client::isConnected()) // the client connected in the background
+			switchToGame(world, render);
+
 		switch (world.status)
 		{
 		case eGAME:
@@ -835,7 +1039,7 @@ void runGame() {
 	gameLoop(render, world, network, gui, controls);
 
 	terminateClient(network, world); // terminate networking if still running
-	terminateServer();
+	stopHosting();
 
 	world.game.players.clear();
 	world.game.rayBeams.clear();
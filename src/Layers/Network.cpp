@@ -1,6 +1,13 @@
 #include "Network.h"
 
 #include "SockUitls.h"
+#include "Capture.h"
+#include "SPSCQueue.h"
+#include "Resolver.h"
+#include "Compression.h"
+#include "LocalTransport.h"
+#include "Conditioner.h"
+#include "Affinity.h"
 #include "Shares/NetworkData.h"
 #include "Layers/Game.h"
 #include "Objects/Packets.h"
@@ -10,28 +17,14 @@
 
 #include <thread>
 #include <mutex>
+#include <chrono>
+#include <vector>
+#include <unordered_map>
 #include <iostream>
 #include <string>
 #include <cstring>
 #include <stdio.h>
 
-struct SocketData { // combine the socket and its address into one type, cause they're always needed when using both tcp and udp.
-	int stream;
-	int dgram;
-	sockaddr_storage addr; // the udp address
-
-	sockaddr* getAddr() {
-		return reinterpret_cast<sockaddr*>(&addr);
-	}
-
-	// returns 0 if equal
-	int compAddr(const SocketData& socket) {
-		auto* saa = reinterpret_cast<const sockaddr*>(&addr);
-		auto* sab = reinterpret_cast<const sockaddr*>(&socket.addr);
-		return sock::cmpAddr(saa, sab);
-	}
-};
-
 namespace client {
 	std::mutex _mTerminate; // controls access to variables for terminating the client
 
@@ -43,98 +36,358 @@ namespace client {
 	std::thread _receiver;
 
 	SocketData _serverSocket;
+	std::shared_ptr<local::Connection> _spLocal = nullptr; // set instead of the sockets when connected to the server of this process
+	bool _isCapturing = false;
 	const size_t _pollfdCount = 2;
 	pollfd _pollfds[_pollfdCount] = {};
 
+	struct ReceivedPacket {
+		std::shared_ptr<Packet> spPacket;
+		int type = 0;
+	};
+	// packets are handed from the receiver thread to the game thread, so the receiver never waits for world mutexes
+	SPSCQueue<ReceivedPacket, 1024> _receivedPackets;
+	compression::StreamDecompressor _decompressor; // only used by the receiver thread
+
+	// the snapshots the client resolved, the server sends deltas against the one acknowledged last, see SnapshotPacket
+	// only used by the thread receiving packets, the receiver thread or the game thread for the local client
+	struct ResolvedSnapshot {
+		uint32_t sequence = 0;
+		std::unordered_map<std::string, SnapshotEntity> entities = {}; // by username, the masks have the fields known of the entities
+	};
+	const uint32_t _snapshotHistory = 32; // as many as the server keeps
+	ResolvedSnapshot _snapshots[_snapshotHistory] = {};
+	uint32_t _latestSnapshot = 0; // the sequence applied last, older snapshots are stale
+
 	bool isRunning() {
 		std::lock_guard<std::mutex> lk(_mTerminate);
 		return _isRunning;
 	}
 
-	// initializes resources for client networking
+	typedef std::chrono::steady_clock Clock;
+	const int _connectAttemptDelay = 250; // milliseconds until the next address is tried while earlier attempts are still pending
+
+	// the player state is sent when it changed, every field again in this interval in case a dgram was lost
+	const Clock::duration _fullStateInterval = std::chrono::milliseconds(1000);
+	Clock::time_point _nextFullState = {}; // guarded by _mTerminate, reset on connect
+
+	// only used by the receiver thread
+	Clock::duration _serverTimeout = std::chrono::milliseconds(10000); // copied from the network data when connecting
+	Clock::time_point _lastReceived = {}; // the server sends heartbeats, so silence means it's gone
+	LatencyHistogram _rxDelay = {}; // time dgrams waited in the socket buffer, only filled with kernel timestamps
+	Clock::time_point _nextStatsPublish = {};
+	const Clock::duration _statsPublishInterval = std::chrono::milliseconds(250);
+
+	// the server the receiver connects to, taken from the settings or from a router that redirected the client
+	struct ServerTarget {
+		std::string ip = "";
+		std::string port = "";
+		uint32_t roomId = 0;
+	};
+	const int _maxRedirects = 3; // routers pointing at each other must not keep the client busy
+	// only used by the receiver thread
+	bool _redirected = false;
+	ServerTarget _redirectTarget = {};
+
+	bool shouldStop() {
+		std::lock_guard<std::mutex> lk(_mTerminate);
+		return _shouldStop;
+	}
+
+	bool isConnected() {
+		std::lock_guard<std::mutex> lk(_mTerminate);
+		return _isConnected;
+	}
+
+	void setConnectState(NetworkData& network, ConnectState state, std::string status) {
+		printf("%s\n", status.c_str());
+		std::lock_guard<std::mutex> lk(network.mClient);
+		network.connectState = state;
+		network.connectStatus = status;
+	}
+
+	// initializes resources for client networking, the connection is made by the receiver thread
 	// returns false on failure
 	bool start(NetworkData& network) {
 		if (client::_isRunning)
 			return true;
 		client::_isRunning = true;
+		_isConnected = false;
+		_serverSocket.stream = -1;
+		_serverSocket.dgram = -1;
 
 		std::lock_guard<std::mutex> lk(network.mNetwork);
-		network.clientErrorStack.clear();
+		{
+			std::lock_guard<std::mutex> lkClient(network.mClient);
+			network.clientErrorStack.clear();
+			network.connectState = eCONNECT_RESOLVING;
+			network.connectStatus = "resolving " + network.ip;
+		}
 
-		addrinfo hints;
-		addrinfo* serverInfo;
+		if (!network.capturePath.empty())
+			_isCapturing = capture::start(network.capturePath);
 
-		memset(&hints, 0, sizeof(hints));
-		hints.ai_family = AF_UNSPEC;
+		return true;
+	}
 
-		int status;
-		if ((status = getaddrinfo(network.ip.c_str(), network.port.c_str(), &hints, &serverInfo)) != 0) { // get adress from ip and port
-			fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(status));
-			return false;
-		}
+	// opens a stream connection to one of the addresses, attempts are started with a short delay and run in parallel (happy eyeballs)
+	// the first attempt that succeeds wins, all others are closed
+	// returns the connected socket or -1 on failure
+	int connectStream(const std::vector<resolver::Address>& addresses, int timeout, resolver::Address& connected, std::string& error) {
+		struct ConnectAttempt {
+			int socket;
+			resolver::Address address;
+		};
+		std::vector<ConnectAttempt> attempts;
+		std::vector<pollfd> pollfds;
+
+		int stream = -1;
+		size_t nextAddress = 0;
+		auto begin = Clock::now();
+		auto nextAttempt = begin;
+		error = "could not reach the server";
+
+		while (stream < 0) {
+			if (shouldStop()) {
+				error = "connect cancelled";
+				break;
+			}
+			auto now = Clock::now();
+			if (now - begin > std::chrono::milliseconds(timeout)) {
+				error = "connect timed out";
+				break;
+			}
+
+			if (nextAddress < addresses.size() && (now >= nextAttempt || attempts.empty())) { // start the next attempt
+				resolver::Address address = addresses[nextAddress++];
+				nextAttempt = now + std::chrono::milliseconds(_connectAttemptDelay);
+				printf("connecting to %s\n", sock::addrToPresentation(address.getAddr()).c_str());
 
-		for (addrinfo* p = serverInfo; p != nullptr; p = p->ai_next) { // print the ip that the client is connecting to
-			if (p->ai_family == AF_INET) {
-				printf("connecting to IPv4 Address: %s\n", sock::addrToPresentationIPv4(reinterpret_cast<sockaddr_in*>(p->ai_addr)->sin_addr).c_str());
+				int socket = ::socket(address.family, SOCK_STREAM, address.protocol);
+				if (socket < 0) {
+					sock::printLastError("socket(stream)");
+					continue;
+				}
+				if (sock::setBlocking(socket, false) < 0) {
+					sock::printLastError("setBlocking(stream)");
+					sock::closeSocket(socket);
+					continue;
+				}
+				if (::connect(socket, address.getAddr(), address.addrlen) == 0) { // connected immediately, e.g. on localhost
+					stream = socket;
+					connected = address;
+					break;
+				}
+				if (!sock::isConnectPending()) {
+					sock::printLastError("connect(stream)");
+					sock::closeSocket(socket);
+					continue;
+				}
+				attempts.push_back({ socket, address });
+				pollfds.push_back({ socket, POLLOUT, 0 });
+				continue;
+			}
+			if (attempts.empty()) // all addresses failed
+				break;
+
+			int pollCount = sock::pollState(pollfds.data(), pollfds.size(), 50); // short timeout to check for cancellation and the next attempt
+			if (pollCount < 0) {
+				sock::printLastError("poll(connect)");
+				break;
+			}
+			for (size_t i = 0; i < attempts.size() && pollCount > 0; i++) {
+				if (!(pollfds[i].revents & (POLLOUT | POLLERR | POLLHUP)))
+					continue;
+				int socketError = sock::socketError(attempts[i].socket);
+				if (socketError == 0 && (pollfds[i].revents & POLLOUT)) {
+					stream = attempts[i].socket;
+					connected = attempts[i].address;
+					attempts.erase(attempts.begin() + i);
+					break;
+				}
+				printf("connect to %s failed (%i)\n", sock::addrToPresentation(attempts[i].address.getAddr()).c_str(), socketError);
+				sock::closeSocket(attempts[i].socket);
+				attempts.erase(attempts.begin() + i);
+				pollfds.erase(pollfds.begin() + i);
+				nextAttempt = Clock::now(); // don't wait for the delay when an attempt failed
+				i--;
 			}
-			if (p->ai_family == AF_INET6) {
-				printf("connecting to IPv6 Address: %s\n", sock::addrToPresentationIPv6(reinterpret_cast<sockaddr_in6*>(p->ai_addr)->sin6_addr).c_str());
+		}
+
+		for (auto& attempt : attempts) // close the losing attempts
+			sock::closeSocket(attempt.socket);
+		return stream;
+	}
+
+	// forgets the snapshots of the last connection, the server starts with a full snapshot
+	void resetSnapshots() {
+		for (auto& snapshot : _snapshots)
+			snapshot = {};
+		_latestSnapshot = 0;
+	}
+
+	// resolves the server address and connects, runs on the receiver thread so the game never blocks
+	// returns false on failure, error describes the failure
+	bool connectToServer(NetworkData& network, const ServerTarget& target, std::string& error) {
+		std::string ip = target.ip;
+		std::string port = target.port;
+		uint32_t roomId = target.roomId;
+		std::string username;
+		bool spectate;
+		bool streamCompression;
+		int connectTimeout;
+		int resolveCacheTime;
+		int peerTimeout;
+		bool kernelTimestamps;
+		{
+			std::lock_guard<std::mutex> lk(network.mNetwork);
+			username = network.username;
+			spectate = network.spectate;
+			streamCompression = network.streamCompression;
+			connectTimeout = network.connectTimeout;
+			resolveCacheTime = network.resolveCacheTime;
+			peerTimeout = network.peerTimeout;
+			kernelTimestamps = network.kernelTimestamps;
+		}
+
+		auto spRequest = resolver::resolve(ip, port, resolveCacheTime);
+		while (!spRequest->wait(50)) {
+			if (shouldStop()) {
+				error = "connect cancelled";
+				return false;
 			}
 		}
+		if (!spRequest->succeeded()) {
+			error = "could not resolve " + ip + ": " + spRequest->getError();
+			return false;
+		}
 
-		_serverSocket.stream = socket(serverInfo->ai_family, SOCK_STREAM, serverInfo->ai_protocol);
-		if (_serverSocket.stream < 0) {
-			sock::printLastError("socket(stream)");
+		setConnectState(network, eCONNECT_CONNECTING, "connecting to " + ip);
+		resolver::Address serverAddress;
+		int stream = connectStream(resolver::interleaveFamilies(spRequest->getAddresses()), connectTimeout, serverAddress, error);
+		if (stream < 0) {
+			resolver::invalidate(ip, port); // the server may have moved, resolve again next time
 			return false;
 		}
-		_serverSocket.dgram = socket(serverInfo->ai_family, SOCK_DGRAM, serverInfo->ai_protocol);
-		if (_serverSocket.dgram < 0) {
-			sock::printLastError("socket(dgram)");
+		if (sock::setBlocking(stream, true) < 0) { // the client uses blocking sends and receives
+			sock::printLastError("setBlocking(stream)");
+			sock::closeSocket(stream);
+			error = "could not configure the connection";
 			return false;
 		}
-		_serverSocket.addr = *reinterpret_cast<sockaddr_storage*>(serverInfo->ai_addr);
 
-		if (connect(_serverSocket.stream, serverInfo->ai_addr, serverInfo->ai_addrlen) < 0) { // connect to the server specified by the ip in network
-			sock::printLastError("connect(stream)");
+		int dgram = socket(serverAddress.family, SOCK_DGRAM, serverAddress.protocol);
+		if (dgram < 0) {
+			sock::printLastError("socket(dgram)");
+			sock::closeSocket(stream);
+			error = "could not create the udp socket";
 			return false;
 		}
 
 		int socklen = sizeof(sockaddr_storage);
 		sockaddr_storage clientAddr;
-		if (getsockname(_serverSocket.stream, reinterpret_cast<sockaddr*>(&clientAddr), &socklen) < 0) {
-			sock::printLastError("getsockname(dgram)");
-			return false;
-		}
-		printf("client address: %s\n", sock::addrToPresentation(reinterpret_cast<sockaddr*>(&clientAddr)).c_str());
-
-		if (bind(_serverSocket.dgram, reinterpret_cast<sockaddr*>(&clientAddr), socklen) < 0) { // bind the udp socket to the same address as the stream socket
+		if (getsockname(stream, reinterpret_cast<sockaddr*>(&clientAddr), &socklen) < 0 ||
+			bind(dgram, reinterpret_cast<sockaddr*>(&clientAddr), socklen) < 0) { // bind the udp socket to the same address as the stream socket
 			sock::printLastError("bind(dgram)");
+			sock::closeSocket(stream);
+			sock::closeSocket(dgram);
+			error = "could not bind the udp socket";
 			return false;
 		}
+		if (kernelTimestamps && sock::enableRxTimestamps(dgram) < 0)
+			sock::printLastError("enableRxTimestamps(dgram)");
+		printf("client address: %s\n", sock::addrToPresentation(reinterpret_cast<sockaddr*>(&clientAddr)).c_str());
 
-		_isConnected = true;
+		capture::registerSocket(stream, capture::eCLIENT);
+		capture::registerSocket(dgram, capture::eCLIENT);
 
-		_pollfds[0].fd = _serverSocket.stream; // init poll stream
+		_pollfds[0].fd = stream; // init poll stream
 		_pollfds[0].events = POLLIN;
 		_pollfds[0].revents = 0;
-		_pollfds[1].fd = _serverSocket.dgram; // init poll dgram
+		_pollfds[1].fd = dgram; // init poll dgram
 		_pollfds[1].events = POLLIN;
 		_pollfds[1].revents = 0;
 
-		freeaddrinfo(serverInfo);
+		{
+			std::lock_guard<std::mutex> lk(_mTerminate);
+			_serverSocket.stream = stream;
+			_serverSocket.dgram = dgram;
+			_serverSocket.addr = serverAddress.addr;
+
+			_decompressor.reset();
+			resetSnapshots();
+			_nextFullState = {};
+			if (spectate) { // a relay streams the room without a player of this client
+				SpectatePacket spectatePacket;
+				spectatePacket.username = username;
+				spectatePacket.roomId = roomId;
+				spectatePacket.sendTo(_serverSocket.stream);
+			}
+			else {
+				ConnectPacket connectPacket;
+				connectPacket.username = username;
+				connectPacket.flags = streamCompression ? eCONNECT_FLAG_COMPRESSION : 0;
+				connectPacket.sendTo(_serverSocket.stream);
+
+				RoomJoinPacket joinPacket;
+				joinPacket.username = username;
+				joinPacket.roomId = roomId;
+				joinPacket.sendTo(_serverSocket.stream);
+			}
 
-		ConnectPacket connectPacket;
-		connectPacket.username = network.username;
-		connectPacket.sendTo(_serverSocket.stream);
+			_isConnected = true;
+		}
+		_serverTimeout = std::chrono::milliseconds(peerTimeout);
+		_lastReceived = Clock::now();
+		_rxDelay = {};
 
+		setConnectState(network, eCONNECT_CONNECTED, "connected to " + ip);
 		return true;
 	}
 
+	// sends the packet over the stream socket or hands it to the server of this process
+	// _mTerminate must be locked
+	template<class T>
+	void sendStream(T& packet) {
+		if (_spLocal)
+			local::sendToServer(*_spLocal, packet, true);
+		else
+			packet.sendTo(_serverSocket.stream);
+	}
+
+	// _mTerminate must be locked
+	template<class T>
+	void sendDgram(T& packet) {
+		if (_spLocal)
+			local::sendToServer(*_spLocal, packet, false);
+		else
+			packet.sendToDgram(_serverSocket.dgram, reinterpret_cast<const sockaddr*>(&_serverSocket.addr));
+	}
+
+	// _mTerminate must be locked
+	void closeSockets() {
+		if (_serverSocket.stream < 0) // the sockets are only created when the connection succeeded
+			return;
+		conditioner::forgetSocket(_serverSocket.stream);
+		conditioner::forgetSocket(_serverSocket.dgram);
+		sock::closeSocket(_serverSocket.stream);
+		sock::closeSocket(_serverSocket.dgram);
+		capture::unregisterSocket(_serverSocket.stream);
+		capture::unregisterSocket(_serverSocket.dgram);
+		_serverSocket.stream = -1;
+		_serverSocket.dgram = -1;
+	}
+
 	void stop(NetworkData& network) {
 		if (!client::_isRunning)
 			return;
 		client::_isRunning = false;
 
+		if (_spLocal) { // the server notices the closed connection with its next poll
+			_spLocal->closed = true;
+			_spLocal = nullptr;
+			_isConnected = false;
+		}
 		if (_isConnected) {
 			std::lock_guard<std::mutex> lk(network.mNetwork);
 			DisconnectPacket disconnectPacket;
@@ -142,8 +395,11 @@ namespace client {
 			disconnectPacket.sendTo(_serverSocket.stream);
 			_isConnected = false;
 		}
-		sock::closeSocket(_serverSocket.stream);
-		sock::closeSocket(_serverSocket.dgram);
+		closeSockets();
+		if (_isCapturing) {
+			capture::stop();
+			_isCapturing = false;
+		}
 
 		printf("client done\n");
 	}
@@ -152,7 +408,8 @@ namespace client {
 	void terminateInternal(NetworkData& network) {
 		std::lock_guard<std::mutex> lk(_mTerminate);
 		_shouldStop = true;
-		_receiver.detach();
+		if (_receiver.joinable()) // a local client has no receiver thread
+			_receiver.detach();
 		stop(network);
 	}
 
@@ -165,6 +422,51 @@ namespace client {
 			terminateInternal(network);
 	}
 
+	// adds the deltas to the baseline and acknowledges the snapshot
+	// afterwards the entities of the packet are the changes against the snapshot applied last, the sent fields are always applied
+	// returns false if the snapshot is stale or its baseline was already overwritten, it's dropped then
+	bool resolveSnapshot(NetworkData& network, SnapshotPacket& packet) {
+		if (packet.sequence <= _latestSnapshot)
+			return false;
+		ResolvedSnapshot resolved;
+		resolved.sequence = packet.sequence;
+		if (packet.baseline != 0) {
+			const ResolvedSnapshot& baseline = _snapshots[packet.baseline % _snapshotHistory];
+			if (baseline.sequence != packet.baseline)
+				return false;
+			resolved.entities = baseline.entities;
+		}
+		std::unordered_map<std::string, uint32_t> sentMasks;
+		for (const auto& delta : packet.entities) {
+			SnapshotEntity& entity = resolved.entities[delta.username];
+			entity.username = delta.username;
+			entity.state.merge(delta.state);
+			sentMasks[delta.username] = delta.state.mask;
+		}
+
+		const ResolvedSnapshot& latest = _snapshots[_latestSnapshot % _snapshotHistory];
+		packet.entities.clear();
+		for (const auto& entityPair : resolved.entities) {
+			SnapshotEntity change = entityPair.second;
+			auto it = latest.entities.find(change.username);
+			if (it != latest.entities.end())
+				change.state.mask = change.state.changedFields(it->second.state);
+			if (sentMasks.count(change.username))
+				change.state.mask |= sentMasks.at(change.username);
+			if (change.state.mask)
+				packet.entities.push_back(change);
+		}
+		_snapshots[packet.sequence % _snapshotHistory] = std::move(resolved);
+		_latestSnapshot = packet.sequence;
+
+		SnapshotAckPacket ackPacket;
+		ackPacket.username = network.username;
+		ackPacket.sequence = packet.sequence;
+		std::lock_guard<std::mutex> lk(_mTerminate);
+		sendDgram(ackPacket);
+		return true;
+	}
+
 	void handlePacket(NetworkData& network, WorldData& world, std::shared_ptr<Packet> spPacket, int type) {
 		if (spPacket) { // check for receive failure
 			switch (type)
@@ -186,11 +488,21 @@ namespace client {
 				}
 				break;
 			}
-			case eUDP_CONNECT: {
-				UDPConnectPacket udpConnectPacket;
-				udpConnectPacket.username = network.username;
-				udpConnectPacket.sendToDgram(_serverSocket.dgram, reinterpret_cast<const sockaddr*>(&_serverSocket.addr));
-				printf("send udp address\n");
+			case eJOIN_SNAPSHOT: {
+				JoinSnapshotPacket& packet = *reinterpret_cast<JoinSnapshotPacket*>(spPacket.get());
+				std::lock_guard<std::mutex> lk(world.mPlayer);
+				for (const auto& snapshot : packet.players) {
+					if (snapshot.username == network.username) { // set this clients player
+						setupLocalPlayer(world, snapshot.username);
+						continue;
+					}
+					setupExternalPlayer(world, snapshot.username);
+					auto spPlayer = world.game.players.at(snapshot.username);
+					if (snapshot.alive)
+						spPlayer->syncSpawn();
+					spPlayer->syncStats(snapshot.health, snapshot.kills, snapshot.deaths, snapshot.damage);
+				}
+				printf("joined with %zu players\n", packet.players.size());
 				break;
 			}
 			case eDISCONNECT: {
@@ -199,14 +511,24 @@ namespace client {
 				world.game.players.erase(packet.username); // delete the disconnected player
 				break;
 			}
-			case eMOVE: {
-				MovePacket& packet = *reinterpret_cast<MovePacket*>(spPacket.get());
+			case eSTATE: { // only in spectator frames, players get snapshots
+				StatePacket& packet = *reinterpret_cast<StatePacket*>(spPacket.get());
 				std::lock_guard<std::mutex> lk(world.mPlayer);
 				if (world.game.players.count(packet.username)) {
-					world.game.players.at(packet.username)->syncMove(packet.transform);
+					world.game.players.at(packet.username)->getReplica().apply(packet.state);
 				}
 				else {
-					printf("%s cannot be moved because that client isn't connected\n", packet.username.c_str());
+					printf("%s cannot be updated because that client isn't connected\n", packet.username.c_str());
+				}
+				break;
+			}
+			case eSNAPSHOT: { // already resolved by handleControlPacket, only has the changes
+				SnapshotPacket& packet = *reinterpret_cast<SnapshotPacket*>(spPacket.get());
+				std::lock_guard<std::mutex> lk(world.mPlayer);
+				for (const auto& entity : packet.entities) {
+					if (!world.game.players.count(entity.username)) // the connect packet comes over the stream and can be later
+						continue;
+					world.game.players.at(entity.username)->getReplica().apply(entity.state);
 				}
 				break;
 			}
@@ -258,30 +580,176 @@ namespace client {
 		}
 	}
 
+	// handles the packets that don't touch the world
+	// returns false if the packet has to be handled by the game thread
+	bool handleControlPacket(NetworkData& network, std::shared_ptr<Packet> spPacket, int type) {
+		if (type == eSNAPSHOT) // resolved here, so the ack doesn't wait for the game thread
+			return !resolveSnapshot(network, *reinterpret_cast<SnapshotPacket*>(spPacket.get()));
+		if (type == eUDP_CONNECT) {
+			UDPConnectPacket udpConnectPacket;
+			udpConnectPacket.username = network.username;
+			udpConnectPacket.sendToDgram(_serverSocket.dgram, reinterpret_cast<const sockaddr*>(&_serverSocket.addr));
+			printf("send udp address\n");
+			return true;
+		}
+		if (type == eHEARTBEAT) {
+			std::lock_guard<std::mutex> lk(_mTerminate);
+			HeartbeatPacket heartbeatPacket;
+			heartbeatPacket.username = network.username;
+			heartbeatPacket.sendTo(_serverSocket.stream);
+			return true;
+		}
+		if (type == eROOM_JOIN) {
+			RoomJoinPacket& packet = *reinterpret_cast<RoomJoinPacket*>(spPacket.get());
+			if (packet.roomId == 0) {
+				pushError(network, eTERMINATE_CLIENT | eSWITCH_MAIN_MENU, "could not join room");
+				return true;
+			}
+			printf("joined room %u\n", packet.roomId);
+			return true;
+		}
+		if (type == eREDIRECT) { // only routers send these, the receiver connects to the server they name
+			RedirectPacket& packet = *reinterpret_cast<RedirectPacket*>(spPacket.get());
+			_redirected = true;
+			_redirectTarget = { packet.address, packet.port, packet.roomId };
+			return true;
+		}
+		if (type == eROOM_LIST) {
+			RoomListPacket& packet = *reinterpret_cast<RoomListPacket*>(spPacket.get());
+			std::lock_guard<std::mutex> lk(network.mClient);
+			network.roomList = packet.rooms;
+			return true;
+		}
+		if (type == eROOM_CREATE) { // the server answers with the id of the created room
+			RoomCreatePacket& packet = *reinterpret_cast<RoomCreatePacket*>(spPacket.get());
+			if (packet.roomId == 0)
+				printf("server could not create room %s\n", packet.name.c_str());
+			else
+				printf("room %s created (%u)\n", packet.name.c_str(), packet.roomId);
+			return true;
+		}
+		return false;
+	}
+
+	// called by the receiver thread
+	// packets that don't touch the world are handled directly, all others are queued for the game thread
+	void enqueuePacket(NetworkData& network, std::shared_ptr<Packet> spPacket, int type) {
+		if (!spPacket || handleControlPacket(network, spPacket, type))
+			return;
+		while (!_receivedPackets.push({ spPacket, type })) { // the game thread empties the queue every frame
+			if (shouldStop()) // the game thread stopped draining to terminate the client, which joins this thread
+				return;
+			std::this_thread::yield();
+		}
+	}
+
+	// decompresses the batch and queues the packets it contains
+	// returns false if the batch is corrupt
+	bool enqueueBatch(NetworkData& network, BatchPacket& batchPacket) {
+		if (batchPacket.rawSize > _maxStreamPacketSize) // comes from the wire, checked before anything is reserved
+			return false;
+		std::vector<char> raw;
+		raw.reserve(batchPacket.rawSize);
+		if (!_decompressor.decompress(batchPacket.data.data(), batchPacket.data.size(), raw, batchPacket.rawSize) || raw.size() != batchPacket.rawSize)
+			return false;
+
+		const char* buf = raw.data();
+		const char* end = buf + raw.size();
+		while (buf < end) {
+			int type;
+			auto spPacket = Packet::unpackFrom(type, buf, end);
+			if (!spPacket)
+				return false;
+			enqueuePacket(network, spPacket, type);
+		}
+		return true;
+	}
+
+	// queues the packets of a spectator frame
+	// returns false if the frame is corrupt
+	bool enqueueFrame(NetworkData& network, SpectatorFramePacket& framePacket) {
+		const char* buf = framePacket.data.data();
+		const char* end = buf + framePacket.data.size();
+		while (buf < end) {
+			int type;
+			auto spPacket = Packet::unpackFrom(type, buf, end);
+			if (!spPacket)
+				return false;
+			enqueuePacket(network, spPacket, type);
+		}
+		if (framePacket.closed)
+			pushError(network, eTERMINATE_CLIENT | eSWITCH_MAIN_MENU, "the match ended");
+		return true;
+	}
+
+	void processPackets(NetworkData& network, WorldData& world) {
+		ReceivedPacket received;
+		while (_receivedPackets.pop(received))
+			handlePacket(network, world, received.spPacket, received.type);
+
+		std::shared_ptr<local::Connection> spLocal;
+		{
+			std::lock_guard<std::mutex> lk(_mTerminate);
+			spLocal = _spLocal;
+			if (spLocal)
+				local::flushBacklog(*spLocal); // the backlog is written under _mTerminate too
+		}
+		if (!spLocal)
+			return;
+		local::LocalPacket packet;
+		while (spLocal->toClient.pop(packet)) // the server of this process hands its packets over without packing them
+			if (!handleControlPacket(network, packet.spPacket, packet.type))
+				handlePacket(network, world, packet.spPacket, packet.type);
+		if (spLocal->closed && isConnected())
+			pushError(network, eTERMINATE_CLIENT | eSWITCH_MAIN_MENU, "server closed connection");
+	}
+
 	// return false if failed
 	bool handlePoll(NetworkData& network, WorldData& world) {
 		if (_pollfds[0].revents & POLLHUP) {
 			pushError(network, eTERMINATE_CLIENT | eSWITCH_MAIN_MENU, "server closed connection");
 			return false;
 		}
+		if (_pollfds[0].revents & POLLIN || _pollfds[1].revents & POLLIN)
+			_lastReceived = Clock::now();
+
 		if (_pollfds[0].revents & POLLIN) {
 			int type;
 			auto spPacket = Packet::receiveFrom(type, _serverSocket.stream);
-			handlePacket(network, world, spPacket, type);
+			if (spPacket && type == eBATCH) {
+				if (!enqueueBatch(network, *reinterpret_cast<BatchPacket*>(spPacket.get()))) {
+					pushError(network, eTERMINATE_CLIENT | eSWITCH_MAIN_MENU, "received a corrupt batch from the server");
+					return false;
+				}
+			}
+			else if (spPacket && type == eSPECTATOR_FRAME) {
+				if (!enqueueFrame(network, *reinterpret_cast<SpectatorFramePacket*>(spPacket.get()))) {
+					pushError(network, eTERMINATE_CLIENT | eSWITCH_MAIN_MENU, "received a corrupt frame from the relay");
+					return false;
+				}
+			}
+			else
+				enqueuePacket(network, spPacket, type);
 		}
 
 		if (_pollfds[1].revents & POLLIN) {
 			sockaddr_storage addr;
-			socklen_t addrlen = sizeof(sockaddr_storage);
+			int addrlen = sizeof(sockaddr_storage);
 			int type;
-			auto spPacket = Packet::receiveFromDgram(type, _serverSocket.dgram, reinterpret_cast<sockaddr*>(&addr), &addrlen);
-			handlePacket(network, world, spPacket, type);
+			int64_t receiveTime;
+			auto spPacket = Packet::receiveFromDgram(type, _serverSocket.dgram, reinterpret_cast<sockaddr*>(&addr), &addrlen, 0, &receiveTime);
+			if (receiveTime != 0) {
+				int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+				_rxDelay.add(std::max<int64_t>(now - receiveTime, 0) / 1000);
+			}
+			enqueuePacket(network, spPacket, type);
 		}
 		return true;
 	}
 
-	void receiverLoop(NetworkData* network, WorldData* world) {
-		while (true) {
+	// receives from the connected server until the client stops, the connection fails or a router redirects the client
+	void receiveLoop(NetworkData* network, WorldData* world) {
+		while (!_redirected) {
 			{ // stop
 				std::lock_guard<std::mutex> lk(_mTerminate);
 				if (_shouldStop)
@@ -298,6 +766,51 @@ namespace client {
 					break;
 				}
 			}
+			if (Clock::now() - _lastReceived > _serverTimeout) {
+				pushError(*network, eTERMINATE_CLIENT | eSWITCH_MAIN_MENU, "server timed out");
+				break;
+			}
+			if (_rxDelay.count > 0 && Clock::now() >= _nextStatsPublish) {
+				std::atomic_store(&network->spClientRxDelay, std::shared_ptr<const LatencyHistogram>(std::make_shared<LatencyHistogram>(_rxDelay)));
+				_nextStatsPublish = Clock::now() + _statsPublishInterval;
+			}
+		}
+	}
+
+	void receiverLoop(NetworkData* network, WorldData* world) {
+		ServerTarget target;
+		int hostGameCore;
+		{
+			std::lock_guard<std::mutex> lk(network->mNetwork);
+			target = { network->ip, network->port, network->roomId };
+			hostGameCore = network->hostGameCore;
+		}
+		if (hostGameCore >= 0) // started by the game thread, which is pinned to that core while it hosts
+			affinity::avoidCores({ hostGameCore });
+		for (int redirects = 0; ; redirects++) {
+			std::string error;
+			_redirected = false;
+			if (!connectToServer(*network, target, error)) {
+				if (!shouldStop()) { // a cancelled connect is terminated by the caller
+					setConnectState(*network, eCONNECT_FAILED, error);
+					pushError(*network, eTERMINATE_CLIENT, error);
+				}
+				return;
+			}
+			receiveLoop(network, world);
+			if (!_redirected)
+				return;
+			if (redirects == _maxRedirects) {
+				pushError(*network, eTERMINATE_CLIENT | eSWITCH_MAIN_MENU, "redirected too often");
+				return;
+			}
+			{ // the router keeps nothing of the client, the settings stay pointed at it for the next connect
+				std::lock_guard<std::mutex> lk(_mTerminate);
+				_isConnected = false;
+				closeSockets();
+			}
+			target = _redirectTarget;
+			setConnectState(*network, eCONNECT_RESOLVING, "redirected to " + target.ip + ":" + target.port);
 		}
 	}
 
@@ -325,22 +838,28 @@ namespace client {
 	//	}
 	//}
 
-	void sendPlayerMove(Player& player) {
+	void sendPlayerState(Player& player) {
 		std::lock_guard<std::mutex> lk(_mTerminate);
 		if(_isConnected) {
-			MovePacket packet;
+			bool full = Clock::now() >= _nextFullState;
+			if (full)
+				_nextFullState = Clock::now() + _fullStateInterval;
+			StatePacket packet;
 			packet.username = player.getUsername();
-			packet.transform = player.getTransform();
-			packet.sendToDgram(_serverSocket.dgram, reinterpret_cast<const sockaddr*>(&_serverSocket.addr));
+			packet.state = player.getReplica().collect(full);
+			packet.state.keepClientOwned(); // the server fills in the others, health and alive come from the damage, spawn and death packets
+			if (packet.state.mask != 0)
+				sendDgram(packet);
 		}
 	}
 
-	void sendPlayerSpawn(std::string username) {
+	void sendPlayerSpawn(std::string username, float health) {
 		std::lock_guard<std::mutex> lk(_mTerminate);
 		if(_isConnected) {
 			SpawnPacket packet;
 			packet.username = username;
-			packet.sendTo(_serverSocket.stream);
+			packet.health = health;
+			sendStream(packet);
 		}
 	}
 
@@ -350,7 +869,7 @@ namespace client {
 			DeathPacket packet;
 			packet.username = username;
 			packet.usernameKiller = usernameKiller;
-			packet.sendTo(_serverSocket.stream);
+			sendStream(packet);
 		}
 	}
 
@@ -362,7 +881,27 @@ namespace client {
 			packet.usernameDamager = usernameDamager;
 			packet.damage = damage;
 			packet.health = health;
-			packet.sendTo(_serverSocket.stream);
+			sendStream(packet);
+		}
+	}
+
+	void requestRoomList(std::string username) {
+		std::lock_guard<std::mutex> lk(_mTerminate);
+		if (_isConnected) {
+			RoomListPacket packet;
+			packet.username = username;
+			sendStream(packet);
+		}
+	}
+
+	void createRoom(std::string username, std::string name, uint32_t maxPlayers) {
+		std::lock_guard<std::mutex> lk(_mTerminate);
+		if (_isConnected) {
+			RoomCreatePacket packet;
+			packet.username = username;
+			packet.name = name;
+			packet.maxPlayers = maxPlayers;
+			sendStream(packet);
 		}
 	}
 
@@ -373,444 +912,82 @@ namespace client {
 			packet.username = username;
 			packet.origin = origin;
 			packet.direction = direction;
-			packet.sendTo(_serverSocket.stream);
+			sendStream(packet);
 		}
 	}
 }
 
 bool runClient(NetworkData& network, WorldData& world) {
+	if (client::isRunning())
+		return true;
 	if (!client::start(network)) {
 		client::stop(network);
 		return false;
 	}
 	client::_shouldStop = false;
+	client::ReceivedPacket stale;
+	while (client::_receivedPackets.pop(stale)) {} // drop packets left over from the last connection
+	client::resetSnapshots();
 	//client::sender = std::thread(client::senderLoop, network, &world);
+	std::lock_guard<std::mutex> lk(client::_mTerminate); // the receiver may terminate itself, it has to wait until the thread is stored
 	client::_receiver = std::thread(client::receiverLoop, &network, &world);
 	return true;
 }
 
-void terminateClient(NetworkData& network, WorldData& world) {
-	{
-		std::lock_guard<std::mutex> lk(client::_mTerminate);
-		client::_shouldStop = true;
+bool runLocalClient(NetworkData& network, WorldData& world) {
+	if (client::isRunning())
+		return true;
+	auto spLocal = connectLocalClient();
+	if (!spLocal)
+		return false;
+	if (!client::start(network)) {
+		client::stop(network);
+		return false;
 	}
-	//client::sender.join();
-	if(client::_receiver.joinable())
-		client::_receiver.join();
-	client::stop(network);
 	client::_shouldStop = false;
-}
-
-namespace server {
-	std::mutex _mRunning;
-	std::condition_variable _cvRunning;
-	bool _isRunning = false;
-	std::mutex _mTerminate; // controls access to variables for terminating the server
-	volatile bool _shouldStop = false;
-	std::thread _thread;
-
-	SocketData _serverSocket;
-	struct ClientData {
-		SocketData socket;
-		std::string username;
-		bool active = false;
-	};
-	// this stores all current users
-	std::vector<ClientData> _clients = {};
-	int _eraseOffset = 0; // used in disconnect socket
-
-	// the file descriptors used in the poll command
-	// (#0:tcp server)
-	// (#1:udp server)
-	// index can be converted to corresponding clientSocket index by -2
-	std::vector<pollfd> _pollfds = {};
-
-	bool isRunning() {
-		std::lock_guard<std::mutex> lk(_mRunning);
-		return _isRunning;
-	}
-
-	void acceptClient() {
-		sockaddr_storage clientAddr;
-		socklen_t addrSize = sizeof clientAddr;
-
-		SocketData socketData;
-		if ((socketData.stream = accept(_serverSocket.stream, reinterpret_cast<sockaddr*>(&clientAddr), &addrSize)) == -1) {
-			sock::printLastError("accept");
-			exit(sock::lastError());
-		}
-		socketData.addr = clientAddr;
-		_clients.push_back({ socketData });
-
-		pollfd clientPollfd; // only for stream clients
-		clientPollfd.fd = socketData.stream;
-		clientPollfd.events = POLLIN;
-		clientPollfd.revents = 0;
-		_pollfds.push_back(clientPollfd); // add pollfd, client will be inserted into the map when receiving the connect packet
-
-		printf("client connected: %s\n", sock::addrToPresentation(reinterpret_cast<sockaddr*>(&clientAddr)).c_str());
-	}
-
-	void disconnectClient(int index) {
-		SocketData socket = _clients[index].socket;
-		printf("client disconnected: %s\n", sock::addrToPresentation(reinterpret_cast<sockaddr*>(&socket.addr)).c_str());
-
-		if (sock::closeSocket(socket.stream) < 0) {
-			sock::printLastError("close(stream)");
-			exit(sock::lastError());
-		}
-
-		_clients.erase(_clients.begin() + index); // delete the clients socket data
-		_pollfds.erase(_pollfds.begin() + index + 1); // delete the clients pollfd, +1 for the server pollfd
-		_eraseOffset++;
-	}
-
-	void handlePacket(ClientData& client, std::shared_ptr<Packet> spPacket, int type, int clientIndex) {
-		if (!spPacket.get()) {
-			disconnectClient(clientIndex);
-			return;
-		}
-		switch (type)
-		{
-		//case eMESSAGE: {
-		//	MessagePacket& packet = *reinterpret_cast<MessagePacket*>(spPacket.get());
-		//	printf("server msg: %s (%s)\n", packet.msg.c_str(), packet.id.c_str());
-		//	for (int clientSocket : clientStorage.sockets)
-		//		packet.sendTo(clientSocket);
-		//	break;
-		//}
-		case eCONNECT: { // uses stream sockets
-			ConnectPacket& packet = *reinterpret_cast<ConnectPacket*>(spPacket.get());
-			{
-				bool nameTaken = false;
-				for (const auto& itClient : _clients)
-					if (itClient.username == packet.username) {
-						nameTaken = true;
-						break;
-					}
-				if (nameTaken) {
-					printf("%s already present, wont be accepted\n", packet.username.c_str());
-					int i = 0;
-					for (const auto& comp : _clients) {
-						if (comp.socket.stream == client.socket.stream) {
-							disconnectClient(i);
-						}
-						i++;
-					}
-					break;
-				}
-			} // prevent multiple usernames
-
-			client.username = packet.username;
-			printf("%s joined the server\n", packet.username.c_str());
-
-			UDPConnectPacket udpConnectPacket;
-			udpConnectPacket.username = client.username;
-			udpConnectPacket.sendTo(client.socket.stream); // send the udpConnect packet over tcp, because the udp address is not yet valid
-			for (auto& otherClient : _clients) {
-				packet.sendTo(otherClient.socket.stream); // tell all clients(including the new one) that a new player joined
-				if (otherClient.socket.stream != client.socket.stream) {
-					ConnectPacket connectPacket;
-					connectPacket.username = otherClient.username;
-					connectPacket.sendTo(client.socket.stream); // send the new client all clients that where already present
-					if (otherClient.active) {
-						SpawnPacket spawnPacket;
-						spawnPacket.username = otherClient.username;
-						spawnPacket.sendTo(client.socket.stream); // send the new client all active players to spawn in
-					}
-				}
-			}
-
-			break;
-		}
-		case eUDP_CONNECT: {
-			printf("received UDP address\n");
-			break;
-		}
-		case eDISCONNECT: { // uses stream sockets
-			DisconnectPacket& packet = *reinterpret_cast<DisconnectPacket*>(spPacket.get());
-
-			{
-				bool nameTaken = false;
-				for (const auto& itClient : _clients)
-					if (itClient.username == packet.username) {
-						nameTaken = true;
-						break;
-					}
-				if (!nameTaken) {
-					printf("%s not present, already disconnected\n", packet.username.c_str());
-					break;
-				}
-			} // prevent multiple disconnects
-
-			printf("%s left the server\n", packet.username.c_str());
-			for (auto& otherClient : _clients) {
-				if (otherClient.socket.stream != client.socket.stream)
-					packet.sendTo(otherClient.socket.stream);
-			}
-			break;
-		}
-		case eMOVE: { // uses dgram sockets
-			MovePacket& packet = *reinterpret_cast<MovePacket*>(spPacket.get());
-			for (auto& otherClient : _clients) {
-				if (packet.username != otherClient.username)
-					packet.sendToDgram(_serverSocket.dgram, reinterpret_cast<const sockaddr*>(&otherClient.socket.addr));
-			}
-			break;
-		}
-		case eDamage: { // uses stream sockets
-			DamagePacket& packet = *reinterpret_cast<DamagePacket*>(spPacket.get());
-			for (auto& otherClient : _clients) {
-				if (packet.username != otherClient.username)
-					packet.sendTo(otherClient.socket.stream);
-			}
-			break;
-		}
-		case eSpawn: { // uses stream sockets
-			SpawnPacket& packet = *reinterpret_cast<SpawnPacket*>(spPacket.get());
-			for (auto& otherClient : _clients) {
-				if (packet.username != otherClient.username)
-					packet.sendTo(otherClient.socket.stream);
-				else
-					otherClient.active = true; // if its the spawned player, mark as activated for future connects
-			}
-			break;
-		}
-		case eDeath: { // uses stream sockets
-			DeathPacket& packet = *reinterpret_cast<DeathPacket*>(spPacket.get());
-			for (auto& otherClient : _clients) {
-				if (packet.username != otherClient.username)
-					packet.sendTo(otherClient.socket.stream);
-				else
-					otherClient.active = true; // if its the killed player, mark as inactive for future connects
-			}
-			break;
-		}
-		case eRay: { // uses strem sockets
-			RayPacket& packet = *reinterpret_cast<RayPacket*>(spPacket.get());
-			for (auto& otherClient : _clients) {
-				if (packet.username != otherClient.username)
-					packet.sendTo(otherClient.socket.stream);
-			}
-			break;
-		}
-		default: {
-			break;
-		}
-		}
-	}
-
-	void recvClientDgram(int clientIndex) {
-		sockaddr_storage addr;
-		int addrlen = sizeof(sockaddr_storage);
-
-		int type;
-		auto spPacket = Packet::receiveFromDgram(type, _serverSocket.dgram, reinterpret_cast<sockaddr*>(&addr), &addrlen);
-		
-		// update saved address
-		for (auto& client : _clients)
-			if (client.username == spPacket->username)
-				client.socket.addr = addr;
-
-		ClientData addrOnly;
-		addrOnly.socket.addr = addr;
-		handlePacket(addrOnly, spPacket, type, clientIndex); // for dgram packets only their origin address is known while the sockets are unknown
-	}
-
-	void recvClient(ClientData& client, int clientIndex) {
-		int type;
-		auto spPacket = Packet::receiveFrom(type, client.socket.stream);
-		handlePacket(client, spPacket, type, clientIndex);
-	}
-
-	void handlePoll(int pollCount) {
-		if (pollCount == 0) // return if there are no polls
-			return;
-
-		int checkedPollCount = 0;
-
-		pollfd serverStreamPollfd = _pollfds[0];
-		if (serverStreamPollfd.revents & POLLIN) { // accept client
-			acceptClient();
-			checkedPollCount++;
-		}
-		pollfd serverDgramPollfd = _pollfds[1];
-		if (serverDgramPollfd.revents & POLLIN) { // recvClientDgram
-			recvClientDgram(-1);
-			checkedPollCount++;
-		}
-
-		// go through all clients
-		// i is the index of the client in clientSockets
-		int eraseOffset = 0; // offset the index by the times erase was used as erase shifts all remaining indices by -1
-		for (size_t i = 0; i < _pollfds.size()-2; i++) { // go through all client sockets
-			pollfd poll = _pollfds[i+2]; // +2 for the 2 server sockets
-			if (poll.revents & POLLHUP) {
-				disconnectClient(i - eraseOffset);
-			}
-			if (poll.revents & POLLIN) {
-				recvClient(_clients[i - eraseOffset], i - eraseOffset);
-			}
-		
-			if (poll.revents & (POLLIN | POLLHUP)) // add checked if poll had events
-				checkedPollCount++;
-			if (checkedPollCount >= pollCount) // return when all polls are checked
-				return;
-		}
-	}
+	client::ReceivedPacket stale;
+	while (client::_receivedPackets.pop(stale)) {} // drop packets left over from the last connection
+	client::resetSnapshots(); // the local server counts its snapshots from the start again
 
-	// free all resources
-	void freeResources(NetworkData& network) {
-		if (sock::closeSocket(_serverSocket.stream) == -1)
-			sock::printLastError("Server close(serverSocket.stream)");
-		if (sock::closeSocket(_serverSocket.dgram) == -1)
-			sock::printLastError("Server close(serverSocket.dgram)");
-		for (const auto& client : _clients)
-			if (sock::closeSocket(client.socket.stream) == -1)
-				sock::printLastError("Server close(clientSocket)");
-
-		_pollfds.clear();
-		_clients.clear();
-		std::lock_guard<std::mutex> lk(network.mServer);
-		network.playerList.clear();
-	}
-
-	SocketData getServerSocket(NetworkData& network) {
+	std::string username;
+	uint32_t roomId;
+	{
 		std::lock_guard<std::mutex> lk(network.mNetwork);
-		SocketData socketData;
-
-		addrinfo hints;
-		addrinfo* serverInfo;
-
-		memset(&hints, 0, sizeof(hints));
-		hints.ai_family = AF_INET;
-		hints.ai_flags = AI_PASSIVE;
-
-		int status;
-		if ((status = getaddrinfo(NULL, network.port.c_str(), &hints, &serverInfo)) != 0) { // turn the port into a full address, ip is null because its a server
-			fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
-			exit(sock::lastError());
-		}
-
-		// creating the socket
-		if ((socketData.stream = socket(serverInfo->ai_family, SOCK_STREAM, serverInfo->ai_protocol)) < 0) {
-			sock::printLastError("socket");
-			exit(sock::lastError());
-		}
-		if ((socketData.dgram = socket(serverInfo->ai_family, SOCK_DGRAM, serverInfo->ai_protocol)) < 0) {
-			sock::printLastError("socket");
-			exit(sock::lastError());
-		}
-
-		// enable port reuse
-		const char yes = 1;
-		if (setsockopt(socketData.stream, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes) == -1) {
-			sock::printLastError("setsockopt");
-		}
-		if (setsockopt(socketData.dgram, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes) == -1) {
-			sock::printLastError("setsockopt");
-		}
-
-		// bind to port
-		if (bind(socketData.stream, serverInfo->ai_addr, serverInfo->ai_addrlen) < 0) {
-			sock::printLastError("bind");
-			exit(sock::lastError());
-		}
-		if (bind(socketData.dgram, serverInfo->ai_addr, serverInfo->ai_addrlen) < 0) {
-			sock::printLastError("bind");
-			exit(sock::lastError());
-		}
-
-		if (listen(socketData.stream, network.backlog) < 0) {
-			sock::printLastError("listen");
-			exit(sock::lastError());
-		}
-
-		socketData.addr = *reinterpret_cast<sockaddr_storage*>(serverInfo->ai_addr);
-
-		pollfd serverStreamPollfd; // make a poll fd for the server socket, gets an event when a new client connects
-		serverStreamPollfd.fd = socketData.stream;
-		serverStreamPollfd.events = POLLIN;
-		serverStreamPollfd.revents = 0;
-		_pollfds.push_back(serverStreamPollfd);
-		pollfd serverDgramPollfd; // make a poll fd for the server socket, gets an event when a clientSocketDgram sends data
-		serverDgramPollfd.fd = socketData.dgram;
-		serverDgramPollfd.events = POLLIN;
-		serverDgramPollfd.revents = 0;
-		_pollfds.push_back(serverDgramPollfd);
-
-		freeaddrinfo(serverInfo);
-
-		return socketData;
+		username = network.username;
+		roomId = network.roomId;
 	}
+	{
+		std::lock_guard<std::mutex> lk(client::_mTerminate);
+		client::_spLocal = spLocal;
+		client::_nextFullState = {};
 
-	void loop(NetworkData* network) {
-		_serverSocket = getServerSocket(*network);
-		{
-			std::lock_guard<std::mutex> lk(_mRunning);
-			_isRunning = true;
-		}
-		_cvRunning.notify_all();
-		printf("server running\n");
-
-		while (true) {
-			{
-				std::lock_guard<std::mutex> lk(_mTerminate);
-				if (_shouldStop) { 
-					break;
-				}
-			}
-
-			int pollCount = sock::pollState(_pollfds.data(), _pollfds.size(), 100);// fetch events of the given pollfds
-			if (pollCount == 0)
-				continue;
-
-			if (pollCount == -1) {
-				sock::printLastError("poll");
-				exit(sock::lastError());
-			}
-
-			handlePoll(pollCount);
-
-			{
-				std::lock_guard<std::mutex> lk(network->mServer);
-				network->playerList.resize(_clients.size());
-				for (size_t i = 0; i < _clients.size(); i++)
-					network->playerList[i] = _clients[i].username;
-			}
-		}
+		ConnectPacket connectPacket;
+		connectPacket.username = username;
+		client::sendStream(connectPacket);
 
-		freeResources(*network);
+		RoomJoinPacket joinPacket;
+		joinPacket.username = username;
+		joinPacket.roomId = roomId;
+		client::sendStream(joinPacket);
 
-		printf("server done\n");
-		{
-			std::lock_guard<std::mutex> lk(_mRunning);
-			_isRunning = false;
-		}
-		_cvRunning.notify_all();
+		client::_isConnected = true;
 	}
+	client::setConnectState(network, eCONNECT_CONNECTED, "connected to the local server");
+	return true;
 }
 
-void runServer(NetworkData& network) {
-	if (server::isRunning())
-		return;
-
-	server::_shouldStop = false;
-	server::_thread = std::thread(server::loop, &network);
-}
-
-void waitServerStartup() {
-	std::unique_lock lk(server::_mRunning);
-	server::_cvRunning.wait(lk, [] {return server::_isRunning; });
-}
-
-void terminateServer() {
-	if (!server::isRunning())
-		return;
+void terminateClient(NetworkData& network, WorldData& world) {
 	{
-		std::lock_guard<std::mutex> lk(server::_mTerminate);
-		server::_shouldStop = true;
+		std::lock_guard<std::mutex> lk(client::_mTerminate);
+		client::_shouldStop = true;
 	}
-	server::_thread.join();
-	server::_shouldStop = false;
-}
\ No newline at end of file
+	//client::sender.join();
+	if(client::_receiver.joinable())
+		client::_receiver.join();
+	client::stop(network);
+	client::_shouldStop = false;
+
+	std::lock_guard<std::mutex> lk(network.mClient);
+	network.connectState = eCONNECT_IDLE;
+	network.connectStatus = "";
+}
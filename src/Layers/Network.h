@@ -4,15 +4,24 @@
 #include "Shares/Render.h"
 #include "Shares/World.h"
 #include "Shares/GuiData.h"
+#include "Layers/Server.h"
 
 namespace client {
 	bool isRunning();
 
+	// true once the connection to the server is established, connecting happens in the background after runClient
+	bool isConnected();
+
+	// applies all packets received since the last call to the world
+	// has to be called from the game thread while no world mutex is locked
+	void processPackets(NetworkData& network, WorldData& world);
+
+	// sends the replicated fields of the player that changed, see Replica
 	// the world.mPlayers mutex must be locked
-	void sendPlayerMove(Player& player);
+	void sendPlayerState(Player& player);
 
 	// the world.mPlayers mutex must be locked
-	void sendPlayerSpawn(std::string username);
+	void sendPlayerSpawn(std::string username, float health);
 
 	// the world.mPlayers mutex must be locked
 	void sendPlayerDeath(std::string username, std::string usernameKiller);
@@ -20,25 +29,27 @@ namespace client {
 	// the world.mPlayers mutex must be locked
 	void sendPlayerDamage(float damage, float health, std::string username, std::string usernameDamager);
 
+	// asks the server for its rooms, the answer is stored in network.roomList
+	void requestRoomList(std::string username);
+
+	// asks the server to create a room, maxPlayers 0 uses the limit of the server
+	// clients choose the room with network.roomId before connecting
+	void createRoom(std::string username, std::string name, uint32_t maxPlayers);
+
 	// the world.mPlayers mutex must be locked
 	void sendRay(glm::vec3 origin, glm::vec3 direction, std::string username);
 }
 
-// runs the client networking
+// runs the client networking, resolving and connecting happens on the receiver thread
+// network.ip may be a router, see Tools/Router.cpp, the client follows its redirect to the server hosting the room
+// the progress is reported in network.connectState, failures are pushed to network.clientErrorStack
 // returns false on failure
 // terminates the client on failure
 bool runClient(NetworkData& network, WorldData& world);
 
-void terminateClient(NetworkData& network, WorldData& world);
+// connects to the server running in this process through queues instead of sockets, used by the hosting player
+// there is no receiver thread, packets are taken from the server in processPackets
+// returns false if the server isn't running
+bool runLocalClient(NetworkData& network, WorldData& world);
 
-namespace server {
-	bool isRunning();
-}
-
-// starts the server thread
-// takes a copy of the network data, this cannot be changed while the server is running, needs a restart
-void runServer(NetworkData& network);
-
-void waitServerStartup();
-
-void terminateServer();
\ No newline at end of file
+void terminateClient(NetworkData& network, WorldData& world);
@@ -0,0 +1,1799 @@
+#include "Server.h"
+
+#include "SockUitls.h"
+#include "Capture.h"
+#include "Shares/NetworkData.h"
+#include "Compression.h"
+#include "TimerWheel.h"
+#include "Affinity.h"
+#include "LocalTransport.h"
+#include "Conditioner.h"
+#include "Metrics.h"
+#include "PlayerStats.h"
+#include "Directory.h"
+#include "Spectate.h"
+#include "Objects/Packets.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <stdio.h>
+
+namespace server {
+	typedef std::chrono::steady_clock Clock;
+
+	std::mutex _mRunning;
+	std::condition_variable _cvRunning;
+	bool _isRunning = false;
+	std::mutex _mTerminate; // controls access to variables for terminating the server
+	volatile bool _shouldStop = false;
+	std::thread _thread;
+
+	SocketData _serverSocket;
+	bool _isCapturing = false;
+
+	// copied from the network data when the server starts
+	Clock::duration _tickInterval = std::chrono::milliseconds(16);
+	uint32_t _maxRooms = 0;
+	uint32_t _maxRoomPlayers = 0;
+	float _clientBandwidth = 0; // bytes per second
+	bool _allowStreamCompression = false;
+	Clock::duration _clientTimeout = {};
+	Clock::duration _heartbeatInterval = {};
+	Clock::duration _udpConnectRetransmit = {};
+	bool _busyPoll = false;
+	int _busyPollTime = 0; // microseconds
+	int _serverCore = -1;
+	int _hostGameCore = -1;
+	Clock::duration _spectatorFrameInterval = {};
+	Clock::duration _keyframeInterval = {};
+
+	// priority of entity updates, see Room::sendUpdates
+	const float _priorityDistance = 20; // the priority halves at this distance
+	const float _priorityShooting = 4; // factor for players that shot recently
+	const Clock::duration _shootingTime = std::chrono::milliseconds(500); // how long a shot raises the priority
+	const float _maxBandwidthCredit = 2; // unused budget carries over for at most this many ticks
+	const uint32_t _snapshotHistory = 32; // snapshots kept per client as baselines, a client acknowledging an older one gets a full snapshot
+	const float _maxDamage = 100; // a hit can't take more than the full health of a player, damage packets claiming more are clamped
+
+	// every client has a token bucket per kind of packet, packets without tokens are dropped before they reach the room
+	enum IngressClass {
+		eINGRESS_MOVE,
+		eINGRESS_RAY,
+		eINGRESS_EVENT, // damage, spawn and death
+		eINGRESS_CONTROL, // connect and room packets
+		eINGRESS_CLASS_COUNT,
+		eINGRESS_UNLIMITED = eINGRESS_CLASS_COUNT // heartbeats and disconnects are always accepted
+	};
+	float _ingressRates[eINGRESS_CLASS_COUNT] = {}; // packets per second, copied from the network data when the server starts
+	const float _ingressBurstTime = 1; // seconds of the budget a client may send at once
+
+	IngressClass ingressClass(int type) {
+		switch (type)
+		{
+		case eSTATE:
+			return eINGRESS_MOVE;
+		case eRay:
+			return eINGRESS_RAY;
+		case eCONNECT:
+		case eUDP_CONNECT:
+		case eROOM_CREATE:
+		case eROOM_LIST:
+		case eROOM_JOIN:
+			return eINGRESS_CONTROL;
+		case eHEARTBEAT:
+		case eDISCONNECT:
+		case eSNAPSHOT_ACK: // only stored by the network thread, never reaches the room
+			return eINGRESS_UNLIMITED;
+		default:
+			return eINGRESS_EVENT;
+		}
+	}
+
+	struct TokenBucket {
+		float tokens = 0;
+		Clock::time_point lastRefill = {}; // the bucket starts full on first use
+
+		// refills the tokens for the time since the last call and takes one
+		// returns false if the bucket is empty
+		bool take(float rate, Clock::time_point now) {
+			float burst = std::max(rate * _ingressBurstTime, 1.f);
+			if (lastRefill == Clock::time_point())
+				tokens = burst;
+			else
+				tokens = std::min(tokens + rate * std::chrono::duration_cast<std::chrono::duration<float>>(now - lastRefill).count(), burst);
+			lastRefill = now;
+			if (tokens < 1)
+				return false;
+			tokens--;
+			return true;
+		}
+	};
+
+	// timers of the network thread, see TimerWheel
+	const Clock::duration _timerResolution = std::chrono::milliseconds(50); // one tick of the wheel, also the longest poll
+	const uint32_t _udpConnectAttempts = 6; // repeats of the udp connect packet until the server gives up
+	const size_t _maxStreamBacklog = 1024 * 1024; // unsent stream bytes of a client before it's disconnected
+
+	// the replication state of one entity for one receiving client
+	struct ReplicationState {
+		float priority = 0; // accumulates every tick the update waits, so nothing starves
+	};
+
+	// what a client knows of the other players once it received a snapshot, see Room::sendUpdates
+	struct SentSnapshot {
+		uint32_t sequence = 0;
+		std::unordered_map<std::string, SnapshotEntity> entities = {}; // by username, the mask has the fields the client knows
+	};
+
+	struct ClientData {
+		SocketData socket;
+		std::shared_ptr<local::Connection> spLocal = nullptr; // set for the client of the hosting player, which has no sockets and gets packets as objects
+		std::string username = ""; // set once by the network thread when the connect packet arrives
+		// the state of the player, only used by the room of the client
+		bool active = false; // alive
+		float health = 0;
+		uint32_t kills = 0;
+		uint32_t deaths = 0;
+		float damage = 0;
+		// only used by the network thread
+		bool disconnected = false;
+		Clock::time_point lastReceived = {};
+		bool dgramReceived = false; // the udp address of the client is known
+		TimerWheel::TimerId idleTimer = 0;
+		TimerWheel::TimerId heartbeatTimer = 0;
+		uint64_t heartbeatStreamSent = 0; // streamSent when the last heartbeat was queued
+		TimerWheel::TimerId udpConnectTimer = 0;
+		TokenBucket ingress[eINGRESS_CLASS_COUNT];
+		bool throttled = false; // exceeded a budget at least once
+		StreamReader reader; // the stream socket is non-blocking, partial packets wait here
+
+		std::atomic<uint32_t> roomId = 0; // set by the network thread on join, reset to 0 by the room when the client leaves
+		std::atomic<uint32_t> receivedAck = 0; // the last snapshot ack, set by the network thread, checked by the room when it sends the next snapshot
+		std::mutex mSend; // stream sends can come from the network thread and the room worker
+		std::atomic<bool> streamPending = false; // streamBacklog isn't empty, the network thread flushes it when the socket is writable
+		std::atomic<bool> streamBroken = false; // the send failed or the client stopped reading, the network thread disconnects it
+		std::atomic<uint64_t> streamSent = 0; // bytes the socket took, the heartbeat checks that the backlog moves
+
+		// guarded by mSend
+		std::vector<PackedPacket> streamQueue = {}; // stream packets waiting to be sent together, broadcasts share their buffer
+		std::vector<char> streamBatch = {}; // the queue copied into one buffer when flushing, kept to reuse its memory
+		std::vector<char> streamBacklog = {}; // flushed bytes the socket didn't take yet, they go out before anything else
+		bool compressStream = false; // negotiated with the connect packet
+		compression::StreamCompressor compressor;
+
+		// only used by the room of the client
+		sockaddr_storage dgramAddr = {}; // taken from the dgrams of the client, the network thread keeps socket.addr for itself
+		std::unordered_map<std::string, ReplicationState> replication = {}; // by username of the entity
+		float bandwidthCredit = 0; // bytes the client may still receive, negative if the last update overshot
+		std::vector<SentSnapshot> snapshots = std::vector<SentSnapshot>(_snapshotHistory); // by sequence modulo the history
+		uint32_t snapshotSequence = 0; // of the last snapshot sent
+		uint32_t ackedSnapshot = 0; // the newest ack of a snapshot that was sent and is still in the history
+	};
+
+	struct StreamFlush {
+		uint32_t bytesSent = 0;
+		uint32_t rawBytes = 0; // size of the batch before compression
+		float compressTime = 0; // seconds
+		bool broken = false;
+	};
+
+	// hands the bytes to the capture and the conditioner like Packet::sendBuffer, what the conditioner doesn't take goes to the backlog
+	// client.mSend must be locked
+	void queueBacklog(ClientData& client, const char* buf, uint32_t len) {
+		capture::record(capture::eSEND, capture::eSTREAM, client.socket.stream, nullptr, buf, len);
+		if (client.streamBacklog.empty() && conditioner::sendStream(client.socket.stream, buf, len))
+			return;
+		client.streamBacklog.insert(client.streamBacklog.end(), buf, buf + len);
+	}
+
+	// sends as much of the backlog as the socket takes without blocking, so a slow client never stalls a room or the network thread
+	// client.mSend must be locked
+	void sendBacklog(ClientData& client, StreamFlush& flush) {
+		size_t offset = 0;
+		while (offset < client.streamBacklog.size()) {
+			int bytesSent = send(client.socket.stream, client.streamBacklog.data() + offset, static_cast<int>(client.streamBacklog.size() - offset), 0);
+			if (bytesSent < 0) {
+				if (!sock::wouldBlock()) {
+					sock::printLastError("send(stream)");
+					flush.broken = true;
+				}
+				break;
+			}
+			offset += bytesSent;
+		}
+		client.streamBacklog.erase(client.streamBacklog.begin(), client.streamBacklog.begin() + offset);
+		client.streamSent += offset;
+		flush.bytesSent += offset;
+		if (client.streamBacklog.size() > _maxStreamBacklog) {
+			printf("%s doesn't read its stream, %zu bytes are waiting\n", client.username.c_str(), client.streamBacklog.size());
+			flush.broken = true;
+		}
+		if (flush.broken) {
+			client.streamBroken = true;
+			client.streamBacklog.clear();
+		}
+		client.streamPending = !client.streamBacklog.empty();
+	}
+
+	// sends all queued stream packets of the client at once, compressed if the client asked for it
+	// they go behind the backlog of earlier flushes, what the socket doesn't take is sent by a later flush
+	// client.mSend must be locked
+	StreamFlush flushStreamLocked(ClientData& client) {
+		StreamFlush flush;
+		if (client.streamBroken) { // the network thread disconnects the client
+			client.streamQueue.clear();
+			flush.broken = true;
+			return flush;
+		}
+		if (!client.streamQueue.empty()) {
+			metrics::observeQueueDepth(client.streamQueue.size());
+			client.streamBatch.clear();
+			for (const auto& spPacked : client.streamQueue)
+				client.streamBatch.insert(client.streamBatch.end(), spPacked->begin(), spPacked->end());
+			client.streamQueue.clear();
+			flush.rawBytes = client.streamBatch.size();
+
+			if (client.compressStream) {
+				auto beginCompress = Clock::now();
+				BatchPacket batchPacket;
+				batchPacket.rawSize = client.streamBatch.size();
+				client.compressor.compress(client.streamBatch.data(), batchPacket.rawSize, batchPacket.data);
+				flush.compressTime = std::chrono::duration_cast<std::chrono::duration<float>>(Clock::now() - beginCompress).count();
+				PackedPacket spPacked = batchPacket.packShared();
+				queueBacklog(client, spPacked->data(), spPacked->size());
+			}
+			else
+				queueBacklog(client, client.streamBatch.data(), client.streamBatch.size());
+		}
+		if (!client.streamBacklog.empty())
+			sendBacklog(client, flush);
+		return flush;
+	}
+
+	// queues the packet until the next flushStream, can be called from any server thread
+	void queueStream(ClientData& client, const PackedPacket& spPacked) {
+		std::lock_guard<std::mutex> lk(client.mSend);
+		client.streamQueue.push_back(spPacked);
+	}
+
+	StreamFlush flushStream(ClientData& client) {
+		std::lock_guard<std::mutex> lk(client.mSend);
+		return flushStreamLocked(client);
+	}
+
+	// hands the packet to the local client without packing it, can be called from any server thread
+	void sendLocal(ClientData& client, local::LocalPacket packet) {
+		std::lock_guard<std::mutex> lk(client.mSend); // the queue takes one producer at a time
+		local::push(*client.spLocal, client.spLocal->toClient, packet);
+	}
+
+	// sends the packet and everything queued before it over the clients stream socket, can be called from any server thread
+	// returns false if the connection broke or the client stopped reading
+	template<class T>
+	bool sendStream(ClientData& client, T& packet) {
+		if (client.spLocal) {
+			sendLocal(client, local::share(packet));
+			return true;
+		}
+		PackedPacket spPacked = packet.packShared();
+		metrics::countSent(T::packetType, spPacked->size());
+		std::lock_guard<std::mutex> lk(client.mSend);
+		client.streamQueue.push_back(spPacked);
+		return !flushStreamLocked(client).broken;
+	}
+
+	void closeClient(ClientData& client) {
+		if (client.spLocal) {
+			client.spLocal->closed = true;
+			return;
+		}
+		std::lock_guard<std::mutex> lk(client.mSend); // the network thread may be flushing the backlog
+		client.streamBroken = true; // nothing is sent on the closed socket anymore
+		conditioner::forgetSocket(client.socket.stream);
+		if (sock::closeSocket(client.socket.stream) < 0)
+			sock::printLastError("close(stream)");
+		capture::unregisterSocket(client.socket.stream);
+	}
+
+	enum RoomEventType {
+		eROOM_EVENT_PACKET,
+		eROOM_EVENT_JOIN,
+		eROOM_EVENT_DISCONNECT // the room closes the socket of the client when handling this
+	};
+
+	struct RoomEvent {
+		RoomEventType eventType = eROOM_EVENT_PACKET;
+		std::shared_ptr<ClientData> spClient;
+		std::shared_ptr<Packet> spPacket;
+		int type = 0;
+		bool isDgram = false;
+		sockaddr_storage addr = {}; // the origin of dgram packets
+	};
+
+	// a match with its own players
+	// events are queued by the network thread and handled when a worker ticks the room
+	class Room {
+	public:
+		Room(uint32_t id, std::string name, uint32_t maxPlayers, bool isDefault)
+			: m_id(id), m_name(name), m_maxPlayers(maxPlayers), m_isDefault(isDefault), m_emptySince(Clock::now()), m_lastTick(Clock::now())
+		{}
+
+		// queues an event for the next tick, can be called from any thread
+		// a state packet is merged into the queued one of the same client, only the newest values matter
+		// returns false if the room is already closed
+		bool push(RoomEvent event) {
+			std::lock_guard<std::mutex> lk(m_mInbox);
+			if (m_closed)
+				return false;
+			if (event.eventType == eROOM_EVENT_PACKET && event.type == eSTATE) {
+				auto it = m_inboxMoves.find(event.spClient.get());
+				if (it != m_inboxMoves.end()) {
+					RoomEvent& queued = m_inbox[it->second];
+					reinterpret_cast<StatePacket*>(queued.spPacket.get())->state.merge(reinterpret_cast<StatePacket*>(event.spPacket.get())->state);
+					queued.addr = event.addr;
+					m_movesCoalesced++;
+					metrics::countCoalesced();
+					return true;
+				}
+				m_inboxMoves[event.spClient.get()] = m_inbox.size();
+			}
+			m_inbox.push_back(event);
+			return true;
+		}
+
+		// handles all queued events, only one worker ticks a room at a time
+		// returns false if the room closed and can be removed
+		bool tick();
+
+		// closes the sockets of disconnected clients that weren't handled yet
+		void shutdown();
+
+		uint32_t getId() {
+			return m_id;
+		}
+
+		RoomInfo getInfo() {
+			return { m_id, m_name, m_playerCount, m_maxPlayers };
+		}
+
+		RoomStats getStats() {
+			RoomStats stats;
+			stats.info = getInfo();
+			stats.ticks = m_ticks;
+			stats.packetsReceived = m_packetsReceived;
+			stats.packetsSent = m_packetsSent;
+			stats.bytesSent = m_bytesSent;
+			stats.updatesDeferred = m_updatesDeferred;
+			stats.streamBytesRaw = m_streamBytesRaw;
+			stats.streamBytesSent = m_streamBytesSent;
+			stats.compressTime = m_compressTime;
+			stats.tickDuration = m_tickDuration;
+			stats.movesCoalesced = m_movesCoalesced;
+			return stats;
+		}
+
+	private:
+		const uint32_t m_id;
+		const std::string m_name;
+		const uint32_t m_maxPlayers;
+		const bool m_isDefault; // the default room stays open when empty
+		const Clock::duration m_closeTimeout = std::chrono::seconds(30); // rooms close when empty for this long
+
+		std::mutex m_mInbox;
+		std::vector<RoomEvent> m_inbox = {};
+		std::unordered_map<ClientData*, size_t> m_inboxMoves = {}; // index of the queued state packet of each client in the inbox
+		bool m_closed = false;
+
+		// only used while ticking
+		std::vector<RoomEvent> m_events = {}; // swapped with the inbox every tick
+		std::vector<std::shared_ptr<ClientData>> m_players = {};
+		Clock::time_point m_emptySince;
+		Clock::time_point m_lastTick;
+
+		// the replicated fields every player sent, sent to the other players with the snapshots of sendUpdates
+		struct EntityState {
+			ReplicatedState state = {}; // quantized, so changes below the precision of the packets aren't sent
+			uint64_t version = 0; // increases with every state packet
+			std::shared_ptr<StatePacket> spState; // the whole state of the current version for the spectator frames, created once
+			PackedPacket spPackedState; // spState packed once
+			Clock::time_point lastShot = {};
+			uint64_t spectatorVersion = 0; // the version in the last spectator frame
+		};
+		std::unordered_map<std::string, EntityState> m_entities = {};
+		std::vector<SnapshotEntity> m_snapshotEntities = {}; // the state of every player, rebuilt every tick
+		std::vector<PackedPacket> m_dgramBatch = {}; // the updates for one client, kept to reuse its memory
+
+		// the spectator stream, see Spectate.h
+		std::vector<PackedPacket> m_spectatorEvents = {}; // the broadcasts since the last frame
+		Clock::time_point m_nextSpectatorFrame = {};
+		Clock::time_point m_nextKeyframe = {}; // the first frame is a keyframe
+		uint32_t m_spectatorSequence = 0;
+
+		// stats, read by the network thread
+		std::atomic<uint32_t> m_playerCount = 0;
+		std::atomic<uint64_t> m_ticks = 0;
+		std::atomic<uint64_t> m_packetsReceived = 0;
+		std::atomic<uint64_t> m_packetsSent = 0;
+		std::atomic<uint64_t> m_bytesSent = 0;
+		std::atomic<uint64_t> m_updatesDeferred = 0;
+		std::atomic<uint64_t> m_streamBytesRaw = 0;
+		std::atomic<uint64_t> m_streamBytesSent = 0;
+		std::atomic<float> m_compressTime = 0;
+		std::atomic<float> m_tickDuration = 0;
+		std::atomic<uint64_t> m_movesCoalesced = 0;
+
+		// stream packets are batched per client and sent at the end of the tick
+		template<class T>
+		void sendTo(ClientData& client, T& packet) {
+			if (client.spLocal)
+				sendLocal(client, local::share(packet));
+			else {
+				PackedPacket spPacked = packet.packShared();
+				metrics::countSent(T::packetType, spPacked->size());
+				queueStream(client, spPacked);
+			}
+			m_packetsSent++;
+		}
+
+		// packs the packet once and queues it for all players except the one with the given username
+		// spectators see every broadcast
+		template<class T>
+		void broadcast(T& packet, const std::string& exceptUsername) {
+			PackedPacket spPacked = nullptr;
+			if (spectate::isEnabled()) {
+				spPacked = packet.packShared();
+				m_spectatorEvents.push_back(spPacked);
+			}
+			for (auto& spPlayer : m_players) {
+				if (spPlayer->username == exceptUsername)
+					continue;
+				if (spPlayer->spLocal)
+					sendLocal(*spPlayer, local::share(packet));
+				else {
+					if (!spPacked)
+						spPacked = packet.packShared();
+					metrics::countSent(T::packetType, spPacked->size());
+					queueStream(*spPlayer, spPacked);
+				}
+				m_packetsSent++;
+			}
+		}
+
+		void flush(ClientData& client) {
+			StreamFlush flush = flushStream(client);
+			m_bytesSent += flush.bytesSent;
+			m_streamBytesRaw += flush.rawBytes;
+			m_streamBytesSent += flush.bytesSent;
+			m_compressTime = m_compressTime + flush.compressTime;
+		}
+
+		// sends the packets as separate dgrams, equal sized ones are sent together with segmentation offload
+		// reorders the packets by size
+		void sendToDgram(ClientData& client, std::vector<PackedPacket>& packets) {
+			std::stable_sort(packets.begin(), packets.end(), [](const PackedPacket& a, const PackedPacket& b) { return a->size() > b->size(); });
+			m_bytesSent += Packet::sendBuffersDgram(_serverSocket.dgram, reinterpret_cast<const sockaddr*>(&client.dgramAddr), packets);
+			m_packetsSent += packets.size();
+		}
+
+		ClientData* findPlayer(const std::string& username) {
+			for (auto& spPlayer : m_players)
+				if (spPlayer->username == username)
+					return spPlayer.get();
+			return nullptr;
+		}
+
+		void handleJoin(std::shared_ptr<ClientData> spClient);
+
+		// removes the client from the room and tells all other players
+		void handleLeave(ClientData& client);
+
+		void handlePacket(RoomEvent& event);
+
+		// writes the fields the server owns, alive and health, from the client data into the entity of the player
+		// called whenever they change, the entity itself is created by the first state packet of the player
+		void updateServerFields(ClientData& player);
+
+		// takes the ack of a client only if it names a snapshot that was sent in this session and is still in the history
+		// stale acks of an earlier session or forged ones would leave the client without a baseline
+		void acceptAck(ClientData& client, uint32_t sequence);
+
+		// sends every player a snapshot of the entities that changed against the snapshot it acknowledged last
+		// the entities with the highest priority that fit into its bandwidth budget are sent, the others wait
+		void sendUpdates(float deltaTime);
+
+		// the packed state of the current version of the entity
+		PackedPacket packedState(const std::string& username, EntityState& entity);
+
+		// hands the broadcasts and states since the last frame to the spectator stream at the spectator rate, a keyframe in the keyframe interval
+		// closed ends the stream of the room
+		void sendSpectatorFrame(bool closed);
+	};
+
+	void Room::handleJoin(std::shared_ptr<ClientData> spClient) {
+		RoomJoinPacket joinPacket;
+		joinPacket.username = spClient->username;
+		if (m_players.size() >= m_maxPlayers) {
+			printf("%s can't join room %s, the room is full\n", spClient->username.c_str(), m_name.c_str());
+			joinPacket.roomId = 0;
+			sendTo(*spClient, joinPacket);
+			flush(*spClient); // not a player, it's not flushed with the others
+			spClient->roomId = 0;
+			return;
+		}
+		m_players.push_back(spClient);
+		spClient->ackedSnapshot = 0; // acks of an earlier session name snapshots this one never sent
+		spClient->receivedAck = 0;
+		printf("%s joined room %s\n", spClient->username.c_str(), m_name.c_str());
+
+		joinPacket.roomId = m_id;
+		sendTo(*spClient, joinPacket);
+
+		if (!spClient->spLocal) { // the local client has no udp socket
+			UDPConnectPacket udpConnectPacket;
+			udpConnectPacket.username = spClient->username;
+			sendTo(*spClient, udpConnectPacket); // send the udpConnect packet over tcp, because the udp address is not yet valid
+		}
+
+		JoinSnapshotPacket snapshotPacket; // the new client gets the whole room at once
+		snapshotPacket.username = spClient->username;
+		snapshotPacket.players.reserve(m_players.size());
+		for (auto& spPlayer : m_players)
+			snapshotPacket.players.push_back({ spPlayer->username, spPlayer->active, spPlayer->health, spPlayer->kills, spPlayer->deaths, spPlayer->damage });
+		sendTo(*spClient, snapshotPacket);
+
+		ConnectPacket packet;
+		packet.username = spClient->username;
+		broadcast(packet, spClient->username); // tell all other players that a new player joined
+	}
+
+	void Room::handleLeave(ClientData& client) {
+		auto it = std::find_if(m_players.begin(), m_players.end(), [&](const std::shared_ptr<ClientData>& spPlayer) { return spPlayer.get() == &client; });
+		if (it == m_players.end())
+			return;
+		m_players.erase(it);
+		m_entities.erase(client.username);
+		for (auto& spOther : m_players) {
+			spOther->replication.erase(client.username);
+			for (auto& snapshot : spOther->snapshots) // a player joining with the same name gets every field again
+				snapshot.entities.erase(client.username);
+		}
+		client.replication.clear();
+		for (auto& snapshot : client.snapshots)
+			snapshot = {};
+		client.snapshotSequence = 0;
+		client.ackedSnapshot = 0;
+		client.receivedAck = 0;
+		client.roomId = 0;
+		client.active = false;
+		client.health = 0;
+		client.kills = 0;
+		client.deaths = 0;
+		client.damage = 0;
+		printf("%s left room %s\n", client.username.c_str(), m_name.c_str());
+
+		DisconnectPacket packet;
+		packet.username = client.username;
+		broadcast(packet, client.username);
+	}
+
+	void Room::handlePacket(RoomEvent& event) {
+		ClientData& client = *event.spClient;
+		if (event.isDgram) // the udp address of the client is only known from the dgrams it sends
+			client.dgramAddr = event.addr;
+
+		switch (event.type)
+		{
+		case eUDP_CONNECT: {
+			printf("received UDP address\n");
+			break;
+		}
+		case eDISCONNECT: { // uses stream sockets
+			handleLeave(client);
+			break;
+		}
+		case eSTATE: { // uses dgram sockets, sent to the others in the snapshots of sendUpdates
+			StatePacket& packet = *reinterpret_cast<StatePacket*>(event.spPacket.get());
+			ClientData* pPlayer = findPlayer(packet.username);
+			if (!pPlayer)
+				break;
+			EntityState& entity = m_entities[packet.username];
+			packet.state.keepClientOwned(); // health and alive only change with the damage, spawn and death packets
+			packet.state.quantize(); // the local client hands its packets over without packing them
+			entity.state.merge(packet.state);
+			entity.version++;
+			entity.spState = nullptr;
+			entity.spPackedState = nullptr;
+			updateServerFields(*pPlayer);
+			break;
+		}
+		case eSNAPSHOT_ACK: { // only the local client, the network thread stores the acks of the others
+			SnapshotAckPacket& packet = *reinterpret_cast<SnapshotAckPacket*>(event.spPacket.get());
+			acceptAck(client, packet.sequence);
+			break;
+		}
+		case eDamage: { // uses stream sockets
+			DamagePacket& packet = *reinterpret_cast<DamagePacket*>(event.spPacket.get());
+			if (!std::isfinite(packet.damage) || packet.damage < 0) { // a client can't have its stats grow without bound or turn them into nan
+				printf("%s sent invalid damage, dropped\n", client.username.c_str());
+				break;
+			}
+			packet.damage = std::min(packet.damage, _maxDamage);
+			if (ClientData* pPlayer = findPlayer(packet.username)) {
+				pPlayer->health = packet.health;
+				updateServerFields(*pPlayer);
+			}
+			if (ClientData* pDamager = findPlayer(packet.usernameDamager)) {
+				pDamager->damage += packet.damage;
+				playerstats::add(pDamager->username, 0, 0, packet.damage);
+			}
+			broadcast(packet, packet.username);
+			break;
+		}
+		case eSpawn: { // uses stream sockets
+			SpawnPacket& packet = *reinterpret_cast<SpawnPacket*>(event.spPacket.get());
+			if (ClientData* pPlayer = findPlayer(packet.username)) { // mark as activated for future connects
+				pPlayer->active = true;
+				pPlayer->health = packet.health;
+				updateServerFields(*pPlayer);
+			}
+			broadcast(packet, packet.username);
+			break;
+		}
+		case eDeath: { // uses stream sockets
+			DeathPacket& packet = *reinterpret_cast<DeathPacket*>(event.spPacket.get());
+			if (ClientData* pKiller = findPlayer(packet.usernameKiller)) {
+				pKiller->kills++;
+				playerstats::add(pKiller->username, 1, 0, 0);
+			}
+			if (ClientData* pPlayer = findPlayer(packet.username)) { // mark as inactive for future connects
+				pPlayer->active = false;
+				pPlayer->health = 0;
+				pPlayer->deaths++;
+				playerstats::add(pPlayer->username, 0, 1, 0);
+				updateServerFields(*pPlayer);
+			}
+			broadcast(packet, packet.username);
+			break;
+		}
+		case eRay: { // uses strem sockets
+			RayPacket& packet = *reinterpret_cast<RayPacket*>(event.spPacket.get());
+			if (m_entities.count(packet.username))
+				m_entities.at(packet.username).lastShot = Clock::now();
+			broadcast(packet, packet.username);
+			break;
+		}
+		default: {
+			break;
+		}
+		}
+	}
+
+	void Room::updateServerFields(ClientData& player) {
+		auto it = m_entities.find(player.username);
+		if (it == m_entities.end())
+			return;
+		EntityState& entity = it->second;
+		ReplicatedState serverState;
+		ReplicatedValue alive;
+		alive.integer = player.active ? 1 : 0;
+		serverState.set(eFIELD_ALIVE, alive);
+		ReplicatedValue health;
+		health.number = player.health;
+		serverState.set(eFIELD_HEALTH, health);
+		serverState.quantize();
+		if (serverState.changedFields(entity.state) == 0)
+			return;
+		entity.state.merge(serverState);
+		entity.version++;
+		entity.spState = nullptr;
+		entity.spPackedState = nullptr;
+	}
+
+	void Room::acceptAck(ClientData& client, uint32_t sequence) {
+		if (sequence <= client.ackedSnapshot || sequence > client.snapshotSequence)
+			return;
+		if (client.snapshots[sequence % _snapshotHistory].sequence != sequence)
+			return;
+		client.ackedSnapshot = sequence;
+	}
+
+	void Room::sendUpdates(float deltaTime) {
+		struct Candidate {
+			const SnapshotEntity* entity;
+			uint32_t changed; // the fields that differ from the baseline
+			ReplicationState* state;
+		};
+		std::vector<Candidate> candidates;
+		auto now = Clock::now();
+		float budget = _clientBandwidth * deltaTime;
+
+		m_snapshotEntities.clear();
+		for (auto& entityPair : m_entities)
+			m_snapshotEntities.push_back({ entityPair.first, entityPair.second.state });
+
+		for (auto& spPlayer : m_players) {
+			ClientData& player = *spPlayer;
+			player.bandwidthCredit = std::min(player.bandwidthCredit + budget, budget * _maxBandwidthCredit);
+
+			glm::vec3 position = glm::vec3(0);
+			if (m_entities.count(player.username))
+				position = glm::vec3(m_entities.at(player.username).state.values[eFIELD_TRANSFORM].transform[3]);
+
+			acceptAck(player, player.receivedAck.exchange(0));
+			uint32_t acked = player.ackedSnapshot;
+			const SentSnapshot* pBaseline = nullptr; // without one every known field is sent
+			if (acked != 0 && player.snapshots[acked % _snapshotHistory].sequence == acked)
+				pBaseline = &player.snapshots[acked % _snapshotHistory];
+
+			candidates.clear();
+			for (auto& entity : m_snapshotEntities) {
+				if (entity.username == player.username)
+					continue;
+				uint32_t changed = entity.state.mask;
+				if (pBaseline && pBaseline->entities.count(entity.username))
+					changed = entity.state.changedFields(pBaseline->entities.at(entity.username).state);
+				if (!changed) // the client already has this state
+					continue;
+
+				ReplicationState& state = player.replication[entity.username];
+				float weight = 1 / (1 + glm::distance(position, glm::vec3(entity.state.values[eFIELD_TRANSFORM].transform[3])) / _priorityDistance);
+				if (now - m_entities.at(entity.username).lastShot < _shootingTime)
+					weight *= _priorityShooting;
+				state.priority += weight * deltaTime;
+				candidates.push_back({ &entity, changed, &state });
+			}
+			if (candidates.empty())
+				continue;
+			std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) { return a.state->priority > b.state->priority; });
+
+			SnapshotPacket snapshot;
+			snapshot.username = player.username;
+			snapshot.sequence = player.snapshotSequence + 1;
+			snapshot.baseline = pBaseline ? acked : 0;
+			uint32_t headerSize = snapshot.fullSize();
+			uint32_t bits = 0; // of the entities in the snapshot
+			size_t sent = 0;
+			for (; sent < candidates.size(); sent++) {
+				SnapshotEntity delta = *candidates[sent].entity;
+				delta.state.mask = candidates[sent].changed;
+				uint32_t deltaBits = SnapshotPacket::entityBits(delta);
+				// no bandwidth limit in the same process, otherwise the last entity may overshoot and the debt is paid next tick
+				// a snapshot has to fit into one dgram
+				if (!player.spLocal && (player.bandwidthCredit - headerSize - bits / 8 <= 0 || headerSize + (bits + deltaBits + 7) / 8 > UDP_PACKET_BUFFER_SIZE))
+					break;
+				snapshot.entities.push_back(delta);
+				bits += deltaBits;
+				candidates[sent].state->priority = 0;
+			}
+			m_updatesDeferred += candidates.size() - sent;
+			metrics::countDeferred(candidates.size() - sent);
+			if (snapshot.entities.empty())
+				continue;
+
+			SentSnapshot record; // what the client knows once it received the snapshot, built aside as it may replace the baseline
+			record.sequence = snapshot.sequence;
+			if (pBaseline)
+				record.entities = pBaseline->entities;
+			for (auto& delta : snapshot.entities) {
+				SnapshotEntity& known = record.entities[delta.username];
+				known.username = delta.username;
+				known.state.merge(delta.state);
+			}
+			player.snapshots[record.sequence % _snapshotHistory] = std::move(record);
+			player.snapshotSequence = snapshot.sequence;
+
+			if (player.spLocal) {
+				sendLocal(player, local::share(snapshot));
+				m_packetsSent++;
+			}
+			else {
+				m_dgramBatch.clear();
+				m_dgramBatch.push_back(snapshot.packShared());
+				metrics::countSent(eSNAPSHOT, m_dgramBatch.back()->size());
+				player.bandwidthCredit -= m_dgramBatch.back()->size();
+				sendToDgram(player, m_dgramBatch);
+			}
+		}
+	}
+
+	PackedPacket Room::packedState(const std::string& username, EntityState& entity) {
+		if (!entity.spState) {
+			entity.spState = std::make_shared<StatePacket>();
+			entity.spState->username = username;
+			entity.spState->state = entity.state;
+		}
+		if (!entity.spPackedState)
+			entity.spPackedState = entity.spState->packShared();
+		return entity.spPackedState;
+	}
+
+	void Room::sendSpectatorFrame(bool closed) {
+		auto now = Clock::now();
+		if (!spectate::isEnabled() || (now < m_nextSpectatorFrame && !closed))
+			return;
+		m_nextSpectatorFrame = now + _spectatorFrameInterval;
+
+		SpectatorFramePacket frame;
+		frame.roomId = m_id;
+		frame.closed = closed;
+		for (auto& spPacked : m_spectatorEvents)
+			frame.append(spPacked);
+		m_spectatorEvents.clear();
+		for (auto& entityPair : m_entities) { // only the newest state of every player, spectators don't need each tick
+			EntityState& entity = entityPair.second;
+			if (entity.spectatorVersion == entity.version)
+				continue;
+			frame.append(packedState(entityPair.first, entity));
+			entity.spectatorVersion = entity.version;
+		}
+		if (!frame.data.empty() || closed) {
+			frame.sequence = m_spectatorSequence++;
+			spectate::push(frame);
+		}
+		if (closed || now < m_nextKeyframe)
+			return;
+		m_nextKeyframe = now + _keyframeInterval;
+
+		SpectatorFramePacket keyframe; // the state after the frame above, spectators joining later start here
+		keyframe.roomId = m_id;
+		keyframe.keyframe = true;
+		JoinSnapshotPacket snapshotPacket;
+		snapshotPacket.players.reserve(m_players.size());
+		for (auto& spPlayer : m_players)
+			snapshotPacket.players.push_back({ spPlayer->username, spPlayer->active, spPlayer->health, spPlayer->kills, spPlayer->deaths, spPlayer->damage });
+		keyframe.append(snapshotPacket.packShared());
+		for (auto& entityPair : m_entities)
+			keyframe.append(packedState(entityPair.first, entityPair.second));
+		keyframe.sequence = m_spectatorSequence++;
+		spectate::push(keyframe);
+	}
+
+	bool Room::tick() {
+		auto beginTick = Clock::now();
+		float deltaTime = std::chrono::duration_cast<std::chrono::duration<float>>(beginTick - m_lastTick).count();
+		m_lastTick = beginTick;
+		{
+			std::lock_guard<std::mutex> lk(m_mInbox);
+			m_events.swap(m_inbox);
+			m_inboxMoves.clear();
+		}
+		for (auto& spPlayer : m_players) { // the local client queues its packets without going through the network thread
+			if (!spPlayer->spLocal)
+				continue;
+			local::LocalPacket packet;
+			while (spPlayer->spLocal->toServerRoom.pop(packet)) {
+				RoomEvent event;
+				event.spClient = spPlayer;
+				event.spPacket = packet.spPacket;
+				event.type = packet.type;
+				m_events.push_back(event);
+			}
+		}
+
+		for (auto& event : m_events) {
+			switch (event.eventType)
+			{
+			case eROOM_EVENT_JOIN:
+				handleJoin(event.spClient);
+				break;
+			case eROOM_EVENT_DISCONNECT:
+				handleLeave(*event.spClient);
+				closeClient(*event.spClient);
+				break;
+			case eROOM_EVENT_PACKET:
+				m_packetsReceived++;
+				handlePacket(event);
+				break;
+			default:
+				break;
+			}
+		}
+		m_events.clear();
+
+		sendUpdates(deltaTime);
+		for (auto& spPlayer : m_players)
+			flush(*spPlayer);
+		sendSpectatorFrame(false);
+
+		m_playerCount = m_players.size();
+		m_ticks++;
+		float duration = std::chrono::duration_cast<std::chrono::duration<float>>(Clock::now() - beginTick).count();
+		m_tickDuration = m_tickDuration * 0.9f + duration * 0.1f; // running average
+		metrics::observeTick(duration);
+
+		if (!m_players.empty() || m_isDefault) {
+			m_emptySince = Clock::now();
+			return true;
+		}
+		if (Clock::now() - m_emptySince < m_closeTimeout)
+			return true;
+
+		{
+			std::lock_guard<std::mutex> lk(m_mInbox);
+			if (!m_inbox.empty()) // someone is about to join
+				return true;
+			m_closed = true;
+		}
+		sendSpectatorFrame(true);
+		return false;
+	}
+
+	void Room::shutdown() {
+		std::lock_guard<std::mutex> lk(m_mInbox);
+		for (auto& event : m_inbox)
+			if (event.eventType == eROOM_EVENT_DISCONNECT)
+				closeClient(*event.spClient);
+		m_inbox.clear();
+		m_inboxMoves.clear();
+		m_players.clear();
+		m_closed = true;
+	}
+
+	// all rooms, used by the network thread and the workers
+	std::mutex _mRooms;
+	std::unordered_map<uint32_t, std::shared_ptr<Room>> _rooms = {};
+	uint32_t _nextRoomId = 1;
+	uint32_t _defaultRoomId = 0;
+
+	struct ScheduledRoom {
+		Clock::time_point due;
+		std::shared_ptr<Room> spRoom;
+
+		bool operator>(const ScheduledRoom& other) const {
+			return due > other.due;
+		}
+	};
+
+	// the rooms ordered by their next tick, workers take the earliest due room
+	// a room is not in the schedule while it is ticked, so only one worker ticks it at a time
+	std::mutex _mSchedule;
+	std::condition_variable _cvSchedule;
+	std::priority_queue<ScheduledRoom, std::vector<ScheduledRoom>, std::greater<ScheduledRoom>> _schedule;
+	bool _stopWorkers = false;
+	std::vector<std::thread> _workers = {};
+
+	void workerLoop() {
+		if (_serverCore >= 0 || _hostGameCore >= 0) // leave the cores of the network thread and the game thread alone
+			affinity::avoidCores({ _serverCore, _hostGameCore });
+
+		std::unique_lock<std::mutex> lk(_mSchedule);
+		while (!_stopWorkers) {
+			if (_schedule.empty()) {
+				_cvSchedule.wait(lk);
+				continue;
+			}
+			ScheduledRoom next = _schedule.top();
+			if (next.due > Clock::now()) {
+				_cvSchedule.wait_until(lk, next.due);
+				continue;
+			}
+			_schedule.pop();
+			lk.unlock();
+
+			bool isOpen = next.spRoom->tick();
+			Clock::time_point due = next.due + _tickInterval;
+			if (due < Clock::now()) // the room fell behind, skip the missed ticks
+				due = Clock::now();
+			if (!isOpen) {
+				std::lock_guard<std::mutex> roomsLk(_mRooms);
+				_rooms.erase(next.spRoom->getId());
+				printf("room %s closed\n", next.spRoom->getInfo().name.c_str());
+			}
+
+			lk.lock();
+			if (isOpen) {
+				_schedule.push({ due, next.spRoom });
+				_cvSchedule.notify_one();
+			}
+		}
+	}
+
+	void startWorkers(uint32_t workerCount) {
+		if (workerCount == 0)
+			workerCount = std::max<uint32_t>(std::thread::hardware_concurrency(), 1);
+		_stopWorkers = false;
+		for (uint32_t i = 0; i < workerCount; i++)
+			_workers.push_back(std::thread(workerLoop));
+		printf("server ticking rooms on %u workers\n", workerCount);
+	}
+
+	void stopWorkers() {
+		{
+			std::lock_guard<std::mutex> lk(_mSchedule);
+			_stopWorkers = true;
+		}
+		_cvSchedule.notify_all();
+		for (auto& worker : _workers)
+			worker.join();
+		_workers.clear();
+		_schedule = {};
+	}
+
+	// returns nullptr if no more rooms can be created
+	std::shared_ptr<Room> createRoom(std::string name, uint32_t maxPlayers, bool isDefault = false) {
+		std::shared_ptr<Room> spRoom;
+		{
+			std::lock_guard<std::mutex> lk(_mRooms);
+			if (_rooms.size() >= _maxRooms)
+				return nullptr;
+			uint32_t id = _nextRoomId++;
+			spRoom = std::make_shared<Room>(id, name, maxPlayers, isDefault);
+			_rooms[id] = spRoom;
+			if (isDefault)
+				_defaultRoomId = id;
+		}
+		{
+			std::lock_guard<std::mutex> lk(_mSchedule);
+			_schedule.push({ Clock::now(), spRoom });
+		}
+		_cvSchedule.notify_one();
+		printf("room %s created\n", name.c_str());
+		return spRoom;
+	}
+
+	std::shared_ptr<Room> findRoom(uint32_t id) {
+		std::lock_guard<std::mutex> lk(_mRooms);
+		auto it = _rooms.find(id);
+		if (it == _rooms.end())
+			return nullptr;
+		return it->second;
+	}
+
+	// queues the event in the room of the client
+	// returns false if the client is in no room or the room is closed
+	bool pushToRoom(RoomEvent event) {
+		uint32_t roomId = event.spClient->roomId;
+		if (roomId == 0)
+			return false;
+		if (auto spRoom = findRoom(roomId))
+			return spRoom->push(event);
+		return false;
+	}
+
+	// this stores all current connections, only used by the network thread
+	std::vector<std::shared_ptr<ClientData>> _clients = {};
+
+	// published state, only used by the network thread
+	bool _rosterChanged = true;
+	uint64_t _rosterVersion = 0;
+	Clock::time_point _nextStatsPublish = {};
+	const Clock::duration _statsPublishInterval = std::chrono::milliseconds(250);
+
+	// the file descriptors used in the poll command
+	// (#0:tcp server)
+	// (#1:udp server)
+	// index can be converted to corresponding clientSocket index by -2
+	std::vector<pollfd> _pollfds = {};
+
+	// client timers, only used by the network thread
+	// the idle timer isn't moved for every packet, it checks lastReceived when it fires and waits for the rest of the timeout
+	TimerWheel _timers;
+	Clock::time_point _timerStart = {};
+
+	// how much longer than their timeout polls without events took, only used by the network thread
+	// sleeping polls show the scheduler wake-up latency, busy polls the cost of checking the sockets
+	LatencyHistogram _wakeLatency = {};
+	LatencyHistogram _rxDelay = {}; // time dgrams waited in the socket buffer, only filled with kernel timestamps
+	IngressStats _ingressStats = {};
+
+	// local connections waiting for the network thread, see connectLocalClient
+	std::mutex _mLocal;
+	std::vector<std::shared_ptr<local::Connection>> _pendingLocal = {};
+	bool _acceptLocal = false; // guarded by _mLocal, only true while the network thread runs
+
+	bool isRunning() {
+		std::lock_guard<std::mutex> lk(_mRunning);
+		return _isRunning;
+	}
+
+	void disconnectClient(std::shared_ptr<ClientData> spClient);
+
+	uint64_t timerTicks(Clock::duration duration) {
+		return std::max<int64_t>(duration / _timerResolution, 1);
+	}
+
+	void scheduleIdleTimeout(std::shared_ptr<ClientData> spClient, Clock::duration delay) {
+		spClient->idleTimer = _timers.schedule(timerTicks(delay), [spClient]() {
+			spClient->idleTimer = 0;
+			auto idle = Clock::now() - spClient->lastReceived;
+			if (idle < _clientTimeout) { // received something since the timer was scheduled
+				scheduleIdleTimeout(spClient, _clientTimeout - idle);
+				return;
+			}
+			printf("%s timed out\n", spClient->username.empty() ? sock::addrToPresentation(spClient->socket.getAddr()).c_str() : spClient->username.c_str());
+			disconnectClient(spClient);
+		});
+	}
+
+	void scheduleHeartbeat(std::shared_ptr<ClientData> spClient) {
+		spClient->heartbeatTimer = _timers.schedule(timerTicks(_heartbeatInterval), [spClient]() {
+			spClient->heartbeatTimer = 0;
+			uint64_t sent = spClient->streamSent;
+			if (spClient->streamPending && sent == spClient->heartbeatStreamSent) { // the socket took nothing for a whole interval
+				printf("%s stopped reading its stream\n", spClient->username.empty() ? sock::addrToPresentation(spClient->socket.getAddr()).c_str() : spClient->username.c_str());
+				disconnectClient(spClient);
+				return;
+			}
+			spClient->heartbeatStreamSent = sent;
+			HeartbeatPacket packet;
+			packet.username = spClient->username;
+			if (!sendStream(*spClient, packet)) { // never blocks, the connection broke or the backlog overflowed
+				disconnectClient(spClient);
+				return;
+			}
+			scheduleHeartbeat(spClient);
+		});
+	}
+
+	// the udp connect packet is sent over the stream, but the dgram the client answers with can get lost
+	// repeats it with a doubling delay until a dgram of the client arrives
+	void scheduleUdpConnect(std::shared_ptr<ClientData> spClient, uint32_t attempt) {
+		spClient->udpConnectTimer = _timers.schedule(timerTicks(_udpConnectRetransmit * (1 << attempt)), [spClient, attempt]() {
+			spClient->udpConnectTimer = 0;
+			if (spClient->dgramReceived || spClient->roomId == 0)
+				return;
+			if (attempt >= _udpConnectAttempts) {
+				printf("%s didn't send its udp address\n", spClient->username.c_str());
+				return;
+			}
+			UDPConnectPacket packet;
+			packet.username = spClient->username;
+			sendStream(*spClient, packet);
+			scheduleUdpConnect(spClient, attempt + 1);
+		});
+	}
+
+	// fires the timers that are due
+	void advanceTimers() {
+		_timers.advance((Clock::now() - _timerStart) / _timerResolution);
+	}
+
+	void acceptClient() {
+		sockaddr_storage clientAddr;
+		socklen_t addrSize = sizeof clientAddr;
+
+		auto spClient = std::make_shared<ClientData>();
+		if ((spClient->socket.stream = accept(_serverSocket.stream, reinterpret_cast<sockaddr*>(&clientAddr), &addrSize)) == -1) {
+			sock::printLastError("accept");
+			exit(sock::lastError());
+		}
+		sock::setBlocking(spClient->socket.stream, false); // sends and receives never wait for a slow client
+		spClient->socket.dgram = _serverSocket.dgram;
+		spClient->socket.addr = clientAddr;
+		spClient->dgramAddr = clientAddr; // the client binds its udp socket to the address of its stream, see Network.cpp
+		capture::registerSocket(spClient->socket.stream, capture::eSERVER);
+		if (_busyPoll && sock::setBusyPoll(spClient->socket.stream, _busyPollTime) < 0)
+			sock::printLastError("setBusyPoll(stream)");
+		spClient->lastReceived = Clock::now();
+		_clients.push_back(spClient);
+		scheduleIdleTimeout(spClient, _clientTimeout);
+		scheduleHeartbeat(spClient);
+
+		pollfd clientPollfd; // only for stream clients
+		clientPollfd.fd = spClient->socket.stream;
+		clientPollfd.events = POLLIN;
+		clientPollfd.revents = 0;
+		_pollfds.push_back(clientPollfd); // add pollfd, client will get a username when receiving the connect packet
+
+		printf("client connected: %s\n", sock::addrToPresentation(reinterpret_cast<sockaddr*>(&clientAddr)).c_str());
+	}
+
+	// the local client gets no timers, it can't vanish without closing its connection
+	void acceptLocalClients() {
+		std::vector<std::shared_ptr<local::Connection>> pending;
+		{
+			std::lock_guard<std::mutex> lk(_mLocal);
+			pending.swap(_pendingLocal);
+		}
+		for (auto& spLocal : pending) {
+			auto spClient = std::make_shared<ClientData>();
+			spClient->spLocal = spLocal;
+			spClient->socket.stream = -1;
+			spClient->socket.dgram = -1;
+			_clients.push_back(spClient);
+
+			pollfd clientPollfd; // keeps the pollfds in line with the clients, poll ignores negative fds
+			clientPollfd.fd = -1;
+			clientPollfd.events = 0;
+			clientPollfd.revents = 0;
+			_pollfds.push_back(clientPollfd);
+			printf("local client connected\n");
+		}
+	}
+
+	// marks the client as disconnected, it's removed from the poll list after the current poll is handled
+	void disconnectClient(std::shared_ptr<ClientData> spClient) {
+		if (spClient->disconnected)
+			return;
+		spClient->disconnected = true;
+		_timers.cancel(spClient->idleTimer);
+		_timers.cancel(spClient->heartbeatTimer);
+		_timers.cancel(spClient->udpConnectTimer);
+		printf("client disconnected: %s\n", spClient->spLocal ? "local" : sock::addrToPresentation(spClient->socket.getAddr()).c_str());
+
+		RoomEvent event;
+		event.eventType = eROOM_EVENT_DISCONNECT;
+		event.spClient = spClient;
+		if (!pushToRoom(event)) // the room closes the socket if the client is in one
+			closeClient(*spClient);
+	}
+
+	void removeDisconnectedClients() {
+		for (size_t i = 0; i < _clients.size(); i++) {
+			if (_clients[i]->disconnected) {
+				if (!_clients[i]->username.empty())
+					_rosterChanged = true;
+				_clients.erase(_clients.begin() + i);
+				_pollfds.erase(_pollfds.begin() + i + 2); // +2 for the server pollfds
+				i--;
+			}
+		}
+	}
+
+	// takes a token from the budget of the client for this kind of packet
+	// returns false if the packet has to be dropped
+	bool admitPacket(ClientData& client, int type) {
+		IngressClass ingress = ingressClass(type);
+		if (ingress == eINGRESS_UNLIMITED || client.spLocal) // the host doesn't need protection from itself
+			return true;
+		if (client.ingress[ingress].take(_ingressRates[ingress], Clock::now()))
+			return true;
+		metrics::countThrottled(type);
+
+		switch (ingress)
+		{
+		case eINGRESS_MOVE:
+			_ingressStats.movesThrottled++;
+			break;
+		case eINGRESS_RAY:
+			_ingressStats.raysThrottled++;
+			break;
+		case eINGRESS_EVENT:
+			_ingressStats.eventsThrottled++;
+			break;
+		default:
+			_ingressStats.controlThrottled++;
+			break;
+		}
+		if (!client.throttled) {
+			client.throttled = true;
+			_ingressStats.clientsThrottled++;
+			printf("%s exceeds its packet budget, dropping packets\n", client.username.empty() ? sock::addrToPresentation(client.socket.getAddr()).c_str() : client.username.c_str());
+		}
+		return false;
+	}
+
+	std::shared_ptr<ClientData> findClient(const std::string& username) {
+		for (auto& spClient : _clients)
+			if (!spClient->disconnected && spClient->username == username)
+				return spClient;
+		return nullptr;
+	}
+
+	// handles the packets that don't belong to a room and forwards the others to the room of the client
+	void handlePacket(std::shared_ptr<ClientData> spClient, std::shared_ptr<Packet> spPacket, int type) {
+		if (!admitPacket(*spClient, type))
+			return;
+		switch (type)
+		{
+		case eCONNECT: { // uses stream sockets
+			ConnectPacket& packet = *reinterpret_cast<ConnectPacket*>(spPacket.get());
+			if (findClient(packet.username)) { // prevent multiple usernames
+				printf("%s already present, wont be accepted\n", packet.username.c_str());
+				disconnectClient(spClient);
+				break;
+			}
+			spClient->username = packet.username;
+			_rosterChanged = true;
+			if (_allowStreamCompression && (packet.flags & eCONNECT_FLAG_COMPRESSION)) {
+				std::lock_guard<std::mutex> lk(spClient->mSend);
+				spClient->compressStream = true;
+			}
+			printf("%s joined the server%s\n", packet.username.c_str(), spClient->compressStream ? " (compressed)" : "");
+			break;
+		}
+		case eROOM_LIST: { // uses stream sockets
+			RoomListPacket listPacket;
+			listPacket.username = spClient->username;
+			{
+				std::lock_guard<std::mutex> lk(_mRooms);
+				for (auto& roomPair : _rooms)
+					listPacket.rooms.push_back(roomPair.second->getInfo());
+			}
+			sendStream(*spClient, listPacket);
+			break;
+		}
+		case eROOM_CREATE: { // uses stream sockets
+			RoomCreatePacket& packet = *reinterpret_cast<RoomCreatePacket*>(spPacket.get());
+			uint32_t maxPlayers = packet.maxPlayers == 0 ? _maxRoomPlayers : std::min<uint32_t>(packet.maxPlayers, _maxRoomPlayers);
+			auto spRoom = createRoom(packet.name, maxPlayers);
+
+			RoomCreatePacket answerPacket;
+			answerPacket.username = spClient->username;
+			answerPacket.name = packet.name;
+			answerPacket.maxPlayers = maxPlayers;
+			answerPacket.roomId = spRoom ? spRoom->getId() : 0;
+			sendStream(*spClient, answerPacket);
+			break;
+		}
+		case eROOM_JOIN: { // uses stream sockets
+			RoomJoinPacket& packet = *reinterpret_cast<RoomJoinPacket*>(spPacket.get());
+			if (spClient->username.empty()) {
+				printf("client has to connect before joining a room\n");
+				break;
+			}
+
+			bool joined = false;
+			if (spClient->roomId == 0) { // clients have to reconnect to change the room
+				uint32_t roomId = packet.roomId;
+				if (roomId == 0) {
+					std::lock_guard<std::mutex> lk(_mRooms);
+					roomId = _defaultRoomId;
+				}
+				RoomEvent event;
+				event.eventType = eROOM_EVENT_JOIN;
+				event.spClient = spClient;
+				spClient->roomId = roomId;
+				joined = pushToRoom(event);
+				if (joined && !spClient->spLocal)
+					scheduleUdpConnect(spClient, 0);
+			}
+			if (!joined) {
+				spClient->roomId = 0;
+				RoomJoinPacket rejectPacket;
+				rejectPacket.username = spClient->username;
+				rejectPacket.roomId = 0;
+				sendStream(*spClient, rejectPacket);
+			}
+			break;
+		}
+		case eHEARTBEAT: // uses stream sockets, the answer of the client only refreshes lastReceived
+			break;
+		default: {
+			RoomEvent event;
+			event.spClient = spClient;
+			event.spPacket = spPacket;
+			event.type = type;
+			pushToRoom(event);
+			break;
+		}
+		}
+	}
+
+	void recvClientDgram() {
+		sockaddr_storage addr;
+		int addrlen = sizeof(sockaddr_storage);
+
+		int type;
+		int64_t receiveTime;
+		auto spPacket = Packet::receiveFromDgram(type, _serverSocket.dgram, reinterpret_cast<sockaddr*>(&addr), &addrlen, 0, &receiveTime);
+		if (receiveTime != 0) {
+			int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+			_rxDelay.add(std::max<int64_t>(now - receiveTime, 0) / 1000);
+		}
+		if (!spPacket)
+			return;
+		metrics::countReceived(type, spPacket->fullSize());
+
+		// for dgram packets only their origin address is known, the client is found by its username
+		auto spClient = findClient(spPacket->username);
+		if (!spClient)
+			return;
+		spClient->lastReceived = Clock::now();
+		spClient->dgramReceived = true;
+		if (!admitPacket(*spClient, type))
+			return;
+		if (type == eSNAPSHOT_ACK) { // the room only reads the newest ack when it sends the next snapshot
+			SnapshotAckPacket& packet = *reinterpret_cast<SnapshotAckPacket*>(spPacket.get());
+			spClient->receivedAck = packet.sequence;
+			return;
+		}
+
+		RoomEvent event;
+		event.spClient = spClient;
+		event.spPacket = spPacket;
+		event.type = type;
+		event.isDgram = true;
+		event.addr = addr;
+		pushToRoom(event);
+	}
+
+	// handles the control packets of the local client, its room packets go to the room directly
+	void handleLocalClients() {
+		for (size_t i = 0; i < _clients.size(); i++) {
+			auto spClient = _clients[i];
+			if (!spClient->spLocal || spClient->disconnected)
+				continue;
+			local::LocalPacket packet;
+			while (spClient->spLocal->toServerControl.pop(packet))
+				handlePacket(spClient, packet.spPacket, packet.type);
+			if (spClient->spLocal->closed)
+				disconnectClient(spClient);
+		}
+	}
+
+	// handles the packets that arrived completely, a client that sent part of a packet holds up nobody
+	void recvClient(std::shared_ptr<ClientData> spClient) {
+		if (!spClient->reader.receive(spClient->socket.stream)) {
+			disconnectClient(spClient);
+			return;
+		}
+		int type;
+		bool malformed = false;
+		while (auto spPacket = spClient->reader.next(type, malformed)) {
+			metrics::countReceived(type, spPacket->fullSize());
+			spClient->lastReceived = Clock::now();
+			handlePacket(spClient, spPacket, type);
+			if (spClient->disconnected)
+				return;
+		}
+		if (malformed)
+			disconnectClient(spClient);
+	}
+
+	// polls the stream of a client for POLLOUT while it has a backlog and disconnects the clients whose stream broke
+	void updateClientPolls() {
+		for (size_t i = 0; i < _clients.size(); i++) {
+			auto& spClient = _clients[i];
+			if (spClient->spLocal || spClient->disconnected)
+				continue;
+			if (spClient->streamBroken) {
+				disconnectClient(spClient);
+				continue;
+			}
+			_pollfds[i + 2].events = spClient->streamPending ? POLLIN | POLLOUT : POLLIN; // +2 for the server pollfds
+		}
+	}
+
+	void handlePoll(int pollCount) {
+		if (pollCount == 0) // return if there are no polls
+			return;
+
+		int checkedPollCount = 0;
+
+		pollfd serverStreamPollfd = _pollfds[0];
+		if (serverStreamPollfd.revents & POLLIN) { // accept client
+			acceptClient();
+			checkedPollCount++;
+		}
+		pollfd serverDgramPollfd = _pollfds[1];
+		if (serverDgramPollfd.revents & POLLIN) { // recvClientDgram
+			recvClientDgram();
+			checkedPollCount++;
+		}
+
+		// go through all clients
+		// i is the index of the client in _clients, accepted clients are appended and not polled yet
+		for (size_t i = 0; i < _pollfds.size()-2; i++) { // go through all client sockets
+			pollfd poll = _pollfds[i+2]; // +2 for the 2 server sockets
+			auto spClient = _clients[i];
+			if (poll.revents & POLLIN && !spClient->disconnected) {
+				recvClient(spClient);
+			}
+			if (poll.revents & POLLOUT && !spClient->disconnected) { // the socket takes more of the backlog
+				if (flushStream(*spClient).broken)
+					disconnectClient(spClient);
+			}
+			if (poll.revents & POLLHUP) {
+				disconnectClient(spClient);
+			}
+
+			if (poll.revents & (POLLIN | POLLOUT | POLLHUP)) // add checked if poll had events
+				checkedPollCount++;
+			if (checkedPollCount >= pollCount) // stop when all polls are checked
+				break;
+		}
+	}
+
+	// publishes the players and rooms for the interface
+	// the roster is only rebuilt when it changed, room stats at a fixed interval
+	void publishState(NetworkData& network) {
+		if (_rosterChanged) {
+			auto spRoster = std::make_shared<ServerRoster>();
+			spRoster->version = ++_rosterVersion;
+			for (auto& spClient : _clients)
+				if (!spClient->username.empty() && !spClient->disconnected)
+					spRoster->players.push_back(spClient->username);
+			std::atomic_store(&network.spRoster, std::shared_ptr<const ServerRoster>(spRoster));
+			metrics::setPlayers(spRoster->players.size());
+			_rosterChanged = false;
+		}
+
+		auto now = Clock::now();
+		if (now < _nextStatsPublish)
+			return;
+		_nextStatsPublish = now + _statsPublishInterval;
+
+		auto spRoomStats = std::make_shared<std::vector<RoomStats>>();
+		{
+			std::lock_guard<std::mutex> lk(_mRooms);
+			for (auto& roomPair : _rooms)
+				spRoomStats->push_back(roomPair.second->getStats());
+		}
+		std::sort(spRoomStats->begin(), spRoomStats->end(), [](const RoomStats& a, const RoomStats& b) { return a.info.id < b.info.id; });
+		std::atomic_store(&network.spRoomStats, std::shared_ptr<const std::vector<RoomStats>>(spRoomStats));
+		metrics::setRooms(spRoomStats->size());
+		std::atomic_store(&network.spIngressStats, std::shared_ptr<const IngressStats>(std::make_shared<IngressStats>(_ingressStats)));
+		std::atomic_store(&network.spWakeLatency, std::shared_ptr<const LatencyHistogram>(std::make_shared<LatencyHistogram>(_wakeLatency)));
+		if (_rxDelay.count > 0)
+			std::atomic_store(&network.spServerRxDelay, std::shared_ptr<const LatencyHistogram>(std::make_shared<LatencyHistogram>(_rxDelay)));
+	}
+
+	// free all resources
+	void freeResources(NetworkData& network) {
+		directory::stopRegistration(); // closing the registration removes the rooms from the directory
+		metrics::stop();
+		stopWorkers();
+		playerstats::close(); // after the workers, they add the stats
+		spectate::stop(); // after the workers, they push the frames
+		{
+			std::lock_guard<std::mutex> lk(_mRooms);
+			for (auto& roomPair : _rooms)
+				roomPair.second->shutdown();
+			_rooms.clear();
+			_nextRoomId = 1;
+			_defaultRoomId = 0;
+		}
+
+		conditioner::forgetSocket(_serverSocket.stream);
+		conditioner::forgetSocket(_serverSocket.dgram);
+		if (sock::closeSocket(_serverSocket.stream) == -1)
+			sock::printLastError("Server close(serverSocket.stream)");
+		if (sock::closeSocket(_serverSocket.dgram) == -1)
+			sock::printLastError("Server close(serverSocket.dgram)");
+		for (const auto& spClient : _clients)
+			closeClient(*spClient);
+		{
+			std::lock_guard<std::mutex> lk(_mLocal);
+			for (auto& spLocal : _pendingLocal)
+				spLocal->closed = true;
+			_pendingLocal.clear();
+			_acceptLocal = false;
+		}
+		capture::unregisterSocket(_serverSocket.stream);
+		capture::unregisterSocket(_serverSocket.dgram);
+		if (_isCapturing) {
+			capture::stop();
+			_isCapturing = false;
+		}
+
+		_pollfds.clear();
+		_clients.clear();
+		_timers.clear();
+		std::atomic_store(&network.spRoster, std::shared_ptr<const ServerRoster>());
+		std::atomic_store(&network.spRoomStats, std::shared_ptr<const std::vector<RoomStats>>());
+		std::atomic_store(&network.spIngressStats, std::shared_ptr<const IngressStats>());
+		std::atomic_store(&network.spWakeLatency, std::shared_ptr<const LatencyHistogram>());
+		std::atomic_store(&network.spServerRxDelay, std::shared_ptr<const LatencyHistogram>());
+		_wakeLatency = {};
+		_rxDelay = {};
+		_ingressStats = {};
+		_rosterChanged = true;
+	}
+
+	SocketData getServerSocket(NetworkData& network) {
+		std::lock_guard<std::mutex> lk(network.mNetwork);
+		SocketData socketData;
+
+		addrinfo hints;
+		addrinfo* serverInfo;
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_flags = AI_PASSIVE;
+
+		int status;
+		if ((status = getaddrinfo(NULL, network.port.c_str(), &hints, &serverInfo)) != 0) { // turn the port into a full address, ip is null because its a server
+			fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
+			exit(sock::lastError());
+		}
+
+		// creating the socket
+		// the protocol of the address is for one socket type only, linux refuses a dgram socket with the tcp protocol
+		if ((socketData.stream = socket(serverInfo->ai_family, SOCK_STREAM, 0)) < 0) {
+			sock::printLastError("socket");
+			exit(sock::lastError());
+		}
+		if ((socketData.dgram = socket(serverInfo->ai_family, SOCK_DGRAM, 0)) < 0) {
+			sock::printLastError("socket");
+			exit(sock::lastError());
+		}
+
+		// enable port reuse
+		const char yes = 1;
+		if (setsockopt(socketData.stream, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes) == -1) {
+			sock::printLastError("setsockopt");
+		}
+		if (setsockopt(socketData.dgram, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes) == -1) {
+			sock::printLastError("setsockopt");
+		}
+
+		// bind to port
+		if (bind(socketData.stream, serverInfo->ai_addr, serverInfo->ai_addrlen) < 0) {
+			sock::printLastError("bind");
+			exit(sock::lastError());
+		}
+		if (bind(socketData.dgram, serverInfo->ai_addr, serverInfo->ai_addrlen) < 0) {
+			sock::printLastError("bind");
+			exit(sock::lastError());
+		}
+
+		if (listen(socketData.stream, network.backlog) < 0) {
+			sock::printLastError("listen");
+			exit(sock::lastError());
+		}
+
+		if (network.serverBusyPoll && sock::setBusyPoll(socketData.dgram, network.serverBusyPollTime) < 0)
+			sock::printLastError("setBusyPoll(dgram)");
+		if (network.kernelTimestamps && sock::enableRxTimestamps(socketData.dgram) < 0)
+			sock::printLastError("enableRxTimestamps(dgram)");
+
+		capture::registerSocket(socketData.stream, capture::eSERVER);
+		capture::registerSocket(socketData.dgram, capture::eSERVER);
+		if (!network.capturePath.empty())
+			_isCapturing = capture::start(network.capturePath);
+
+		socketData.addr = *reinterpret_cast<sockaddr_storage*>(serverInfo->ai_addr);
+
+		pollfd serverStreamPollfd; // make a poll fd for the server socket, gets an event when a new client connects
+		serverStreamPollfd.fd = socketData.stream;
+		serverStreamPollfd.events = POLLIN;
+		serverStreamPollfd.revents = 0;
+		_pollfds.push_back(serverStreamPollfd);
+		pollfd serverDgramPollfd; // make a poll fd for the server socket, gets an event when a clientSocketDgram sends data
+		serverDgramPollfd.fd = socketData.dgram;
+		serverDgramPollfd.events = POLLIN;
+		serverDgramPollfd.revents = 0;
+		_pollfds.push_back(serverDgramPollfd);
+
+		freeaddrinfo(serverInfo);
+
+		return socketData;
+	}
+
+	void loop(NetworkData* network) {
+		_serverSocket = getServerSocket(*network);
+		std::string defaultRoomName;
+		std::string metricsPort;
+		std::string statsPath;
+		uint32_t workerCount;
+		{
+			std::lock_guard<std::mutex> lk(network->mNetwork);
+			_tickInterval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(1.f / std::max<float>(network->serverTickRate, 1)));
+			_maxRooms = std::max<uint32_t>(network->maxRooms, 1);
+			_maxRoomPlayers = network->maxRoomPlayers;
+			_clientBandwidth = network->clientBandwidth;
+			_allowStreamCompression = network->allowStreamCompression;
+			_clientTimeout = std::chrono::milliseconds(network->peerTimeout);
+			_heartbeatInterval = std::chrono::milliseconds(std::max(network->heartbeatInterval, 1));
+			_udpConnectRetransmit = std::chrono::milliseconds(std::max(network->udpConnectRetransmit, 1));
+			_busyPoll = network->serverBusyPoll;
+			_busyPollTime = network->serverBusyPollTime;
+			_serverCore = network->serverCore;
+			_hostGameCore = network->hostGameCore;
+			_spectatorFrameInterval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(1.f / std::max<float>(network->spectatorRate, 1)));
+			_keyframeInterval = std::chrono::milliseconds(std::max(network->keyframeInterval, 1));
+			_ingressRates[eINGRESS_MOVE] = network->ingressMoveRate;
+			_ingressRates[eINGRESS_RAY] = network->ingressRayRate;
+			_ingressRates[eINGRESS_EVENT] = network->ingressEventRate;
+			_ingressRates[eINGRESS_CONTROL] = network->ingressControlRate;
+			workerCount = network->serverWorkerCount;
+			defaultRoomName = network->roomName;
+			metricsPort = network->metricsPort;
+			statsPath = network->statsPath;
+		}
+		if (_serverCore >= 0) {
+			if (!affinity::pinCurrentThread(_serverCore))
+				printf("could not pin the server to core %i\n", _serverCore);
+		}
+		else if (_hostGameCore >= 0)
+			affinity::avoidCores({ _hostGameCore });
+
+		metrics::reset();
+		if (!metricsPort.empty() && !metrics::start(metricsPort))
+			printf("could not serve metrics on port %s\n", metricsPort.c_str());
+
+		if (!statsPath.empty() && !playerstats::open(statsPath))
+			printf("could not open the player stats in %s, stats won't be kept\n", statsPath.c_str());
+
+		_timerStart = Clock::now();
+		{
+			std::lock_guard<std::mutex> lk(_mLocal);
+			_acceptLocal = true;
+		}
+		startWorkers(workerCount);
+		createRoom(defaultRoomName, _maxRoomPlayers, true);
+
+		{
+			std::lock_guard<std::mutex> lk(_mRunning);
+			_isRunning = true;
+		}
+		_cvRunning.notify_all();
+		printf("server running%s\n", _busyPoll ? " (busy poll)" : "");
+		directory::startRegistration(*network);
+		spectate::start(*network);
+
+		while (true) {
+			{
+				std::lock_guard<std::mutex> lk(_mTerminate);
+				if (_shouldStop) {
+					break;
+				}
+			}
+
+			// busy poll never sleeps, the sockets are checked again right after the work is done
+			int pollTimeout = _busyPoll ? 0 : static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(_timerResolution).count());
+			auto beginPoll = Clock::now();
+			int pollCount = sock::pollState(_pollfds.data(), _pollfds.size(), pollTimeout);// fetch events of the given pollfds
+
+			if (pollCount == -1) {
+				sock::printLastError("poll");
+				exit(sock::lastError());
+			}
+			if (pollCount == 0) {
+				auto overshoot = Clock::now() - beginPoll - std::chrono::milliseconds(pollTimeout);
+				_wakeLatency.add(std::max<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(overshoot).count(), 0));
+			}
+
+			handlePoll(pollCount);
+			acceptLocalClients();
+			handleLocalClients();
+			advanceTimers();
+			updateClientPolls();
+			removeDisconnectedClients();
+
+			publishState(*network);
+		}
+
+		freeResources(*network);
+
+		printf("server done\n");
+		{
+			std::lock_guard<std::mutex> lk(_mRunning);
+			_isRunning = false;
+		}
+		_cvRunning.notify_all();
+	}
+}
+
+void runServer(NetworkData& network) {
+	if (server::isRunning())
+		return;
+
+	server::_shouldStop = false;
+	server::_thread = std::thread(server::loop, &network);
+}
+
+void waitServerStartup() {
+	std::unique_lock lk(server::_mRunning);
+	server::_cvRunning.wait(lk, [] {return server::_isRunning; });
+}
+
+std::shared_ptr<local::Connection> connectLocalClient() {
+	std::lock_guard<std::mutex> lk(server::_mLocal);
+	if (!server::_acceptLocal)
+		return nullptr;
+	auto spLocal = std::make_shared<local::Connection>();
+	server::_pendingLocal.push_back(spLocal);
+	return spLocal;
+}
+
+void terminateServer() {
+	if (!server::isRunning())
+		return;
+	{
+		std::lock_guard<std::mutex> lk(server::_mTerminate);
+		server::_shouldStop = true;
+	}
+	server::_thread.join();
+	server::_shouldStop = false;
+}
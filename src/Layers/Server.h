@@ -0,0 +1,26 @@
+#pragma once
+
+#include "Shares/NetworkData.h"
+
+#include <memory>
+
+namespace local {
+	struct Connection;
+}
+
+namespace server {
+	bool isRunning();
+}
+
+// starts the server thread
+// takes a copy of the network data, this cannot be changed while the server is running, needs a restart
+void runServer(NetworkData& network);
+
+void waitServerStartup();
+
+// connects the client of the hosting player through queues instead of sockets, see LocalTransport.h
+// the network thread picks the connection up with its next poll
+// returns nullptr if the server isn't running
+std::shared_ptr<local::Connection> connectLocalClient();
+
+void terminateServer();
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "SPSCQueue.h"
+#include "Objects/Packets.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <stdio.h>
+
+// connects the client of the hosting player with the server in the same process
+// packets are handed over as objects through lock-free queues, nothing is packed and no socket is involved
+namespace local {
+	struct LocalPacket {
+		std::shared_ptr<Packet> spPacket;
+		int type = 0;
+	};
+	typedef SPSCQueue<LocalPacket, 4096> PacketQueue;
+
+	struct Connection {
+		// written by the client while it holds its terminate mutex
+		PacketQueue toServerControl; // packets the server network thread handles, like connect and room join
+		PacketQueue toServerRoom; // all other packets, read by the room of the client when it ticks
+		std::deque<LocalPacket> roomBacklog; // stream packets that didn't fit into toServerRoom yet, in order
+		// written by the server while it holds the send mutex of the client, read by the game thread of the client
+		PacketQueue toClient;
+		std::atomic<bool> closed = false; // set by the side that disconnects
+	};
+
+	// the packets the server network thread handles instead of the room
+	inline bool isControlPacket(int type) {
+		return type == eCONNECT || type == eROOM_LIST || type == eROOM_CREATE || type == eROOM_JOIN;
+	}
+
+	// copies the packet so it can be queued, T has to be the concrete packet class
+	template<class T>
+	LocalPacket share(const T& packet) {
+		return { std::make_shared<T>(packet), T::packetType };
+	}
+
+	// waits while the queue is full, the reader empties it regularly
+	// drops the packet if the connection closed
+	inline void push(Connection& connection, PacketQueue& queue, LocalPacket packet) {
+		while (!queue.push(packet)) {
+			if (connection.closed)
+				return;
+			std::this_thread::yield();
+		}
+	}
+
+	// moves the backlog into the room queue as far as it fits
+	// called by the client with every send and every frame, so the backlog drains once the room reads again
+	inline void flushBacklog(Connection& connection) {
+		while (!connection.roomBacklog.empty() && connection.toServerRoom.push(connection.roomBacklog.front()))
+			connection.roomBacklog.pop_front();
+	}
+
+	// the room packets are only read once the client joined a room, so waiting on a full room queue could block the client for good
+	// stream packets are kept in the backlog until they fit, a full queue only drops dgrams
+	template<class T>
+	void sendToServer(Connection& connection, const T& packet, bool stream) {
+		if (isControlPacket(T::packetType)) {
+			push(connection, connection.toServerControl, share(packet));
+			return;
+		}
+		flushBacklog(connection);
+		if (connection.roomBacklog.empty() && connection.toServerRoom.push(share(packet)))
+			return;
+		if (stream)
+			connection.roomBacklog.push_back(share(packet)); // behind the backlog, stream packets keep their order
+		else
+			printf("local server queue full, dropped packet %i\n", T::packetType);
+	}
+
+	template<class T>
+	void sendToClient(Connection& connection, const T& packet) {
+		push(connection, connection.toClient, share(packet));
+	}
+}
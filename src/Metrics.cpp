@@ -0,0 +1,319 @@
+#include "Metrics.h"
+
+#include "SockUitls.h"
+#include "Objects/Packets.h"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include <cstdarg>
+#include <stdio.h>
+
+namespace metrics {
+	const int _maxType = 128; // packet types at or above are counted as type 0
+	const int _stopCheckInterval = 100; // milliseconds the http thread waits for a connection before checking if it should stop
+	const int _requestTimeout = 1000; // milliseconds a scraper may take to send its request
+	const size_t _requestBufferSize = 2048;
+
+	struct TypeName {
+		int type;
+		const char* name;
+	};
+	const TypeName _typeNames[] = {
+		{ eMESSAGE, "message" },
+		{ eCONNECT, "connect" },
+		{ eDISCONNECT, "disconnect" },
+		{ eSTATE, "state" },
+		{ eDamage, "damage" },
+		{ eSpawn, "spawn" },
+		{ eDeath, "death" },
+		{ eUDP_CONNECT, "udp_connect" },
+		{ eROOM_CREATE, "room_create" },
+		{ eROOM_LIST, "room_list" },
+		{ eROOM_JOIN, "room_join" },
+		{ eBATCH, "batch" },
+		{ eJOIN_SNAPSHOT, "join_snapshot" },
+		{ eHEARTBEAT, "heartbeat" },
+		{ eDIRECTORY_REGISTER, "directory_register" },
+		{ eDIRECTORY_QUERY, "directory_query" },
+		{ eDIRECTORY_ROOMS, "directory_rooms" },
+		{ eREDIRECT, "redirect" },
+		{ eSPECTATE, "spectate" },
+		{ eSPECTATOR_FRAME, "spectator_frame" },
+		{ eSNAPSHOT, "snapshot" },
+		{ eSNAPSHOT_ACK, "snapshot_ack" },
+		{ eRay, "ray" }
+	};
+
+	// counts values into buckets with fixed upper bounds, the +Inf bucket is implicit
+	// buckets aren't cumulative, render sums them up
+	struct Histogram {
+		static const uint32_t maxBounds = 15;
+		const std::vector<double> bounds;
+		const double unit; // the sum is kept in whole multiples of this, there is no atomic double
+		std::atomic<uint64_t> buckets[maxBounds + 1] = {};
+		std::atomic<uint64_t> sum = 0;
+
+		Histogram(std::vector<double> bounds, double unit)
+			: bounds(bounds), unit(unit)
+		{}
+
+		void observe(double value) {
+			size_t bucket = std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin(); // the bounds are inclusive
+			buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+			sum.fetch_add(static_cast<uint64_t>(value / unit + 0.5), std::memory_order_relaxed);
+		}
+
+		void reset() {
+			for (auto& bucket : buckets)
+				bucket = 0;
+			sum = 0;
+		}
+	};
+
+	std::atomic<uint64_t> _packetsReceived[_maxType] = {};
+	std::atomic<uint64_t> _bytesReceived[_maxType] = {};
+	std::atomic<uint64_t> _packetsSent[_maxType] = {};
+	std::atomic<uint64_t> _bytesSent[_maxType] = {};
+	std::atomic<uint64_t> _packetsThrottled[_maxType] = {};
+	std::atomic<uint64_t> _movesCoalesced = 0;
+	std::atomic<uint64_t> _updatesDeferred = 0;
+	std::atomic<uint64_t> _players = 0;
+	std::atomic<uint64_t> _rooms = 0;
+	Histogram _tickDuration({ 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1 }, 1e-6); // seconds
+	Histogram _queueDepth({ 1, 2, 4, 8, 16, 32, 64, 128, 256 }, 1); // packets
+
+	std::mutex _mServe; // guards starting and stopping the http thread
+	std::thread _thread;
+	std::atomic<bool> _shouldStop = false;
+	int _listenSocket = -1;
+
+	int typeIndex(int type) {
+		return type > 0 && type < _maxType ? type : 0;
+	}
+
+	void add(std::atomic<uint64_t>& counter, uint64_t value) {
+		counter.fetch_add(value, std::memory_order_relaxed);
+	}
+
+	void countReceived(int type, uint32_t bytes) {
+		add(_packetsReceived[typeIndex(type)], 1);
+		add(_bytesReceived[typeIndex(type)], bytes);
+	}
+
+	void countSent(int type, uint32_t bytes) {
+		add(_packetsSent[typeIndex(type)], 1);
+		add(_bytesSent[typeIndex(type)], bytes);
+	}
+
+	void countThrottled(int type) {
+		add(_packetsThrottled[typeIndex(type)], 1);
+	}
+
+	void countCoalesced() {
+		add(_movesCoalesced, 1);
+	}
+
+	void countDeferred(uint64_t updates) {
+		add(_updatesDeferred, updates);
+	}
+
+	void setPlayers(uint64_t players) {
+		_players.store(players, std::memory_order_relaxed);
+	}
+
+	void setRooms(uint64_t rooms) {
+		_rooms.store(rooms, std::memory_order_relaxed);
+	}
+
+	void observeTick(float seconds) {
+		_tickDuration.observe(seconds);
+	}
+
+	void observeQueueDepth(uint32_t packets) {
+		_queueDepth.observe(packets);
+	}
+
+	void reset() {
+		for (int i = 0; i < _maxType; i++) {
+			_packetsReceived[i] = 0;
+			_bytesReceived[i] = 0;
+			_packetsSent[i] = 0;
+			_bytesSent[i] = 0;
+			_packetsThrottled[i] = 0;
+		}
+		_movesCoalesced = 0;
+		_updatesDeferred = 0;
+		_players = 0;
+		_rooms = 0;
+		_tickDuration.reset();
+		_queueDepth.reset();
+	}
+
+	void appendf(std::string& out, const char* format, ...) {
+		char line[256];
+		va_list args;
+		va_start(args, format);
+		int len = vsnprintf(line, sizeof line, format, args);
+		va_end(args);
+		if (len > 0)
+			out.append(line, std::min<size_t>(len, sizeof line - 1));
+	}
+
+	void renderHeader(std::string& out, const char* name, const char* type, const char* help) {
+		appendf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+	}
+
+	void renderValue(std::string& out, const char* name, const char* type, const char* help, uint64_t value) {
+		renderHeader(out, name, type, help);
+		appendf(out, "%s %llu\n", name, static_cast<unsigned long long>(value));
+	}
+
+	// one series per packet type, labels holds the labels before the type
+	void renderByType(std::string& out, const char* name, const char* help, const char* labels, std::atomic<uint64_t>* counters) {
+		renderHeader(out, name, "counter", help);
+		for (const auto& typeName : _typeNames)
+			appendf(out, "%s{%stype=\"%s\"} %llu\n", name, labels, typeName.name, static_cast<unsigned long long>(counters[typeName.type].load(std::memory_order_relaxed)));
+	}
+
+	void renderHistogram(std::string& out, const char* name, const char* help, const Histogram& histogram) {
+		renderHeader(out, name, "histogram", help);
+		uint64_t count = 0;
+		for (size_t i = 0; i < histogram.bounds.size(); i++) {
+			count += histogram.buckets[i].load(std::memory_order_relaxed);
+			appendf(out, "%s_bucket{le=\"%g\"} %llu\n", name, histogram.bounds[i], static_cast<unsigned long long>(count));
+		}
+		count += histogram.buckets[histogram.bounds.size()].load(std::memory_order_relaxed);
+		appendf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, static_cast<unsigned long long>(count));
+		appendf(out, "%s_sum %g\n", name, histogram.sum.load(std::memory_order_relaxed) * histogram.unit);
+		appendf(out, "%s_count %llu\n", name, static_cast<unsigned long long>(count));
+	}
+
+	std::string render() {
+		std::string out;
+		renderValue(out, "vod_players", "gauge", "Players connected to the server.", _players.load(std::memory_order_relaxed));
+		renderValue(out, "vod_rooms", "gauge", "Open rooms.", _rooms.load(std::memory_order_relaxed));
+		renderByType(out, "vod_packets_received_total", "Packets received from clients.", "", _packetsReceived);
+		renderByType(out, "vod_bytes_received_total", "Bytes received from clients.", "", _bytesReceived);
+		renderByType(out, "vod_packets_sent_total", "Packets sent to clients.", "", _packetsSent);
+		renderByType(out, "vod_bytes_sent_total", "Bytes sent to clients before stream compression.", "", _bytesSent);
+
+		// both reasons in one family, so they can be summed up
+		renderByType(out, "vod_packets_dropped_total", "Packets received from clients but not handled.", "reason=\"throttled\",", _packetsThrottled);
+		appendf(out, "vod_packets_dropped_total{reason=\"coalesced\",type=\"move\"} %llu\n", static_cast<unsigned long long>(_movesCoalesced.load(std::memory_order_relaxed)));
+
+		renderValue(out, "vod_updates_deferred_total", "counter", "Entity updates that didn't fit into the bandwidth budget of a client.", _updatesDeferred.load(std::memory_order_relaxed));
+		renderHistogram(out, "vod_tick_duration_seconds", "Time a worker needed to tick a room.", _tickDuration);
+		renderHistogram(out, "vod_send_queue_depth", "Stream packets queued for a client when the queue was flushed.", _queueDepth);
+		return out;
+	}
+
+	void sendAll(int socket, const std::string& data) {
+		size_t offset = 0;
+		while (offset < data.size()) {
+			int bytesSent = send(socket, data.data() + offset, data.size() - offset, 0);
+			if (bytesSent <= 0)
+				return; // the scraper went away
+			offset += bytesSent;
+		}
+	}
+
+	// answers one request, the connection is closed afterwards
+	void serveClient(int socket) {
+		char buf[_requestBufferSize];
+		size_t size = 0;
+		buf[0] = '\0';
+		while (!strstr(buf, "\r\n\r\n")) { // only the request head matters, scrapes have no body
+			if (size >= sizeof buf - 1)
+				return;
+			pollfd pfd = { socket, POLLIN, 0 };
+			if (sock::pollState(&pfd, 1, _requestTimeout) <= 0)
+				return;
+			int bytesRead = recv(socket, buf + size, sizeof buf - 1 - size, 0);
+			if (bytesRead <= 0)
+				return;
+			size += bytesRead;
+			buf[size] = '\0';
+		}
+
+		std::string response;
+		if (strncmp(buf, "GET /metrics ", 13) == 0 || strncmp(buf, "GET /metrics?", 13) == 0) {
+			std::string body = render();
+			appendf(response, "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body.size());
+			response += body;
+		}
+		else
+			response = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+		sendAll(socket, response);
+	}
+
+	// scrapes are rare and small, one connection is served at a time
+	void serveLoop() {
+		while (!_shouldStop) {
+			pollfd pfd = { _listenSocket, POLLIN, 0 };
+			int pollCount = sock::pollState(&pfd, 1, _stopCheckInterval);
+			if (pollCount < 0) {
+				sock::printLastError("metrics poll");
+				return;
+			}
+			if (pollCount == 0)
+				continue;
+			int socket = accept(_listenSocket, nullptr, nullptr);
+			if (socket < 0) {
+				sock::printLastError("metrics accept");
+				continue;
+			}
+			serveClient(socket);
+			sock::closeSocket(socket);
+		}
+	}
+
+	bool start(std::string port) {
+		std::lock_guard<std::mutex> lk(_mServe);
+		if (_thread.joinable())
+			return true;
+
+		addrinfo hints = {};
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo* info;
+		int status;
+		if ((status = getaddrinfo("127.0.0.1", port.c_str(), &hints, &info)) != 0) { // only local scrapers, the metrics have no authentication
+			fprintf(stderr, "metrics getaddrinfo: %s\n", gai_strerror(status));
+			return false;
+		}
+		if ((_listenSocket = socket(info->ai_family, info->ai_socktype, info->ai_protocol)) < 0) {
+			sock::printLastError("metrics socket");
+			freeaddrinfo(info);
+			return false;
+		}
+		int yes = 1;
+		if (setsockopt(_listenSocket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&yes), sizeof yes) == -1)
+			sock::printLastError("metrics setsockopt");
+		if (bind(_listenSocket, info->ai_addr, info->ai_addrlen) < 0 || listen(_listenSocket, 4) < 0) {
+			sock::printLastError("metrics bind");
+			sock::closeSocket(_listenSocket);
+			_listenSocket = -1;
+			freeaddrinfo(info);
+			return false;
+		}
+		freeaddrinfo(info);
+
+		_shouldStop = false;
+		_thread = std::thread(serveLoop);
+		printf("metrics served on http://127.0.0.1:%s/metrics\n", port.c_str());
+		return true;
+	}
+
+	void stop() {
+		std::lock_guard<std::mutex> lk(_mServe);
+		if (!_thread.joinable())
+			return;
+		_shouldStop = true;
+		_thread.join();
+		sock::closeSocket(_listenSocket);
+		_listenSocket = -1;
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+// counters of the server for monitoring, the server threads update them with relaxed atomics and never lock
+// a thread of its own serves them over http in the prometheus text format, so a scrape never stalls the server
+// only network traffic is counted, the packets of the hosting player's local client are not
+namespace metrics {
+	void countReceived(int type, uint32_t bytes);
+
+	// bytes are the packed size, before the stream is compressed
+	void countSent(int type, uint32_t bytes);
+
+	// a packet dropped because the client exceeded its ingress budget
+	void countThrottled(int type);
+
+	// a move replaced by a newer move of the same client before the room handled it
+	void countCoalesced();
+
+	void countDeferred(uint64_t updates);
+
+	void setPlayers(uint64_t players);
+
+	void setRooms(uint64_t rooms);
+
+	void observeTick(float seconds);
+
+	// stream packets of a client sent together in one flush
+	void observeQueueDepth(uint32_t packets);
+
+	// the metrics in the prometheus text format
+	std::string render();
+
+	// serves the metrics at http://127.0.0.1:<port>/metrics until stop is called
+	// returns false if the port can't be bound
+	bool start(std::string port);
+
+	void stop();
+
+	// sets all metrics to 0, called when the server starts
+	void reset();
+}
@@ -1,5 +1,46 @@
 #include "Packets.h"
 
+#include "Capture.h"
+#include "Conditioner.h"
+
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+
+// true if size bytes are left between buf and end
+// the unpack functions set buf to nullptr when a value doesn't fit, later reads return empty values and the packet is dropped
+bool fits(const char* buf, const char* end, uint64_t size) {
+	return buf && static_cast<uint64_t>(end - buf) >= size;
+}
+
+// takes a ptr to an already allocated chunk of memory and packs the value into it
+// the ptr will point to the end of the packed value
+void packUint32(char*& buf, uint32_t value) {
+	uint32_t nValue = htonl(value);
+	memcpy(buf, &nValue, sizeof(uint32_t)); buf += sizeof(uint32_t);
+}
+
+// takes a ptr to a packed value
+// the ptr will point to the end of the packed value
+uint32_t unpackUint32(const char*& buf, const char* end) {
+	if (!fits(buf, end, sizeof(uint32_t))) {
+		buf = nullptr;
+		return 0;
+	}
+	uint32_t nValue;
+	memcpy(&nValue, buf, sizeof(uint32_t)); buf += sizeof(uint32_t);
+	return ntohl(nValue);
+}
+
+// takes a ptr to a packed byte, the flags are single bytes
+uint8_t unpackUint8(const char*& buf, const char* end) {
+	if (!fits(buf, end, sizeof(uint8_t))) {
+		buf = nullptr;
+		return 0;
+	}
+	return static_cast<uint8_t>(*buf++);
+}
+
 // takes a ptr to an already allocated chunk of memory and packs the string into it
 // the ptr will point to the end of the packed string
 void packString(char*& buf, std::string string) {
@@ -10,55 +51,591 @@ void packString(char*& buf, std::string string) {
 
 // takes a ptr to a packed string
 // the ptr will point to the end of the packed string
-std::string unpackString(const char*& buf) {
-	uint32_t usernameSize = ntohl(reinterpret_cast<const uint32_t*>(buf)[0]); buf += sizeof(uint32_t);
+std::string unpackString(const char*& buf, const char* end) {
+	uint32_t usernameSize = unpackUint32(buf, end);
+	if (!fits(buf, end, usernameSize)) {
+		buf = nullptr;
+		return "";
+	}
 	auto str = std::string(buf, usernameSize); buf += usernameSize;
 	return str;
 }
 
+// takes a ptr to size raw bytes
+std::vector<char> unpackBytes(const char*& buf, const char* end, uint32_t size) {
+	if (!fits(buf, end, size)) {
+		buf = nullptr;
+		return {};
+	}
+	std::vector<char> bytes(buf, buf + size); buf += size;
+	return bytes;
+}
+
+// receives exactly size bytes, a single recv may return less on a stream socket
+// returns size, 0 if the peer closed the connection or -1 on failure
+int receiveAll(int socket, char* buf, uint32_t size) {
+	uint32_t offset = 0;
+	while (offset < size) {
+		int bytesRead = recv(socket, buf + offset, size - offset, 0);
+		if (bytesRead <= 0)
+			return bytesRead;
+		offset += bytesRead;
+	}
+	return size;
+}
+
+// takes a ptr to an already allocated chunk of memory and packs the value into it
+// the ptr will point to the end of the packed value
+void packFloat(char*& buf, float value) {
+	uint32_t nValue = sock::htonFloat(value);
+	memcpy(buf, &nValue, sizeof(uint32_t)); buf += sizeof(uint32_t);
+}
+
+// takes a ptr to a packed value
+// the ptr will point to the end of the packed value
+float unpackFloat(const char*& buf, const char* end) {
+	if (!fits(buf, end, sizeof(uint32_t))) {
+		buf = nullptr;
+		return 0;
+	}
+	uint32_t nValue;
+	memcpy(&nValue, buf, sizeof(uint32_t)); buf += sizeof(uint32_t);
+	return sock::ntohFloat(nValue);
+}
+
+// the bits needed for every value from 0 to range
+uint32_t bitsForRange(uint32_t range) {
+	uint32_t bits = 0;
+	while (bits < 32 && (range >> bits) != 0)
+		bits++;
+	return bits;
+}
+
+// the value clamped to the range and rounded to one of 2^bits evenly spaced steps, as the index of the step
+uint32_t toSteps(float value, float min, float max, uint32_t bits) {
+	uint32_t steps = (uint32_t(1) << bits) - 1;
+	return uint32_t((std::clamp(value, min, max) - min) * (steps / (max - min)) + 0.5f); // not negative, truncating rounds
+}
+
+float fromSteps(uint32_t value, float min, float max, uint32_t bits) {
+	uint32_t steps = (uint32_t(1) << bits) - 1;
+	return min + value * (max - min) / steps;
+}
+
+float quantize(float value, float min, float max, uint32_t bits) {
+	return fromSteps(toSteps(value, min, max, bits), min, max, bits);
+}
+
+const float _maxSmallestComponent = 0.70710678f; // the other components of a unit quaternion can't be larger than its largest
+
+// a player transform as it is sent, player transforms only rotate and move so the bottom row is left out
+// the rotation is a quaternion without its largest component, the receiver restores it from the others
+struct PackedTransform {
+	uint32_t position[3];
+	uint32_t largest; // index of the left out component, 2 bits
+	uint32_t rotation[3];
+};
+
+PackedTransform packTransform(const glm::mat4& transform) {
+	auto m = [&](int row, int column) { return transform[column][row]; };
+	float q[4]; // x, y, z, w
+	float trace = m(0, 0) + m(1, 1) + m(2, 2);
+	if (trace > 0) {
+		float s = std::sqrt(trace + 1) * 2;
+		q[0] = (m(2, 1) - m(1, 2)) / s;
+		q[1] = (m(0, 2) - m(2, 0)) / s;
+		q[2] = (m(1, 0) - m(0, 1)) / s;
+		q[3] = s / 4;
+	}
+	else if (m(0, 0) > m(1, 1) && m(0, 0) > m(2, 2)) {
+		float s = std::sqrt(1 + m(0, 0) - m(1, 1) - m(2, 2)) * 2;
+		q[0] = s / 4;
+		q[1] = (m(0, 1) + m(1, 0)) / s;
+		q[2] = (m(0, 2) + m(2, 0)) / s;
+		q[3] = (m(2, 1) - m(1, 2)) / s;
+	}
+	else if (m(1, 1) > m(2, 2)) {
+		float s = std::sqrt(1 + m(1, 1) - m(0, 0) - m(2, 2)) * 2;
+		q[0] = (m(0, 1) + m(1, 0)) / s;
+		q[1] = s / 4;
+		q[2] = (m(1, 2) + m(2, 1)) / s;
+		q[3] = (m(0, 2) - m(2, 0)) / s;
+	}
+	else {
+		float s = std::sqrt(1 + m(2, 2) - m(0, 0) - m(1, 1)) * 2;
+		q[0] = (m(0, 2) + m(2, 0)) / s;
+		q[1] = (m(1, 2) + m(2, 1)) / s;
+		q[2] = s / 4;
+		q[3] = (m(1, 0) - m(0, 1)) / s;
+	}
+
+	PackedTransform packed;
+	for (int row = 0; row < 3; row++)
+		packed.position[row] = toSteps(transform[3][row], -_positionRange, _positionRange, _positionBits);
+	packed.largest = 0;
+	for (uint32_t i = 1; i < 4; i++)
+		if (std::abs(q[i]) > std::abs(q[packed.largest]))
+			packed.largest = i;
+	float sign = q[packed.largest] < 0 ? -1.f : 1.f; // q and -q are the same rotation, the left out component is restored as positive
+	for (uint32_t i = 0, j = 0; i < 4; i++)
+		if (i != packed.largest)
+			packed.rotation[j++] = toSteps(q[i] * sign, -_maxSmallestComponent, _maxSmallestComponent, _rotationBits);
+	return packed;
+}
+
+glm::mat4 unpackTransform(const PackedTransform& packed) {
+	glm::mat4 transform = glm::mat4(1);
+	for (int row = 0; row < 3; row++)
+		transform[3][row] = fromSteps(packed.position[row], -_positionRange, _positionRange, _positionBits);
+	float q[4];
+	float sum = 0;
+	for (uint32_t i = 0, j = 0; i < 4; i++) {
+		if (i == packed.largest)
+			continue;
+		q[i] = fromSteps(packed.rotation[j++], -_maxSmallestComponent, _maxSmallestComponent, _rotationBits);
+		sum += q[i] * q[i];
+	}
+	q[packed.largest] = std::sqrt(std::max(0.f, 1 - sum));
+
+	float x = q[0], y = q[1], z = q[2], w = q[3];
+	transform[0][0] = 1 - 2 * (y * y + z * z);
+	transform[0][1] = 2 * (x * y + z * w);
+	transform[0][2] = 2 * (x * z - y * w);
+	transform[1][0] = 2 * (x * y - z * w);
+	transform[1][1] = 1 - 2 * (x * x + z * z);
+	transform[1][2] = 2 * (y * z + x * w);
+	transform[2][0] = 2 * (x * z + y * w);
+	transform[2][1] = 2 * (y * z - x * w);
+	transform[2][2] = 1 - 2 * (x * x + y * y);
+	return transform;
+}
+
+void writeTransform(BitWriter& writer, const glm::mat4& transform) {
+	PackedTransform packed = packTransform(transform);
+	for (uint32_t value : packed.position)
+		writer.writeBits(value, _positionBits);
+	writer.writeBits(packed.largest, 2);
+	for (uint32_t value : packed.rotation)
+		writer.writeBits(value, _rotationBits);
+}
+
+glm::mat4 readTransform(BitReader& reader) {
+	PackedTransform packed;
+	for (uint32_t& value : packed.position)
+		value = reader.readBits(_positionBits);
+	packed.largest = reader.readBits(2);
+	for (uint32_t& value : packed.rotation)
+		value = reader.readBits(_rotationBits);
+	return unpackTransform(packed);
+}
+
+glm::mat4 quantizeTransform(const glm::mat4& transform) {
+	return unpackTransform(packTransform(transform));
+}
+
+// BitWriter
+BitWriter::BitWriter(char* buf)
+	: m_buf(reinterpret_cast<uint8_t*>(buf))
+{}
+
+void BitWriter::writeBits(uint32_t value, uint32_t bits) {
+	if (bits == 0)
+		return;
+	if (m_scratchBits == 0 && bits % 8 == 0) { // whole bytes at a byte boundary go straight into the buffer
+		if (m_buf)
+			for (uint32_t shift = bits; shift > 0; shift -= 8)
+				m_buf[m_bits / 8 + (bits - shift) / 8] = uint8_t(value >> (shift - 8));
+		m_bits += bits;
+		return;
+	}
+	m_scratch = (m_scratch << bits) | (value & (~uint64_t(0) >> (64 - bits)));
+	m_scratchBits += bits;
+	while (m_scratchBits >= 8) {
+		m_scratchBits -= 8;
+		if (m_buf)
+			m_buf[(m_bits + bits - m_scratchBits) / 8 - 1] = uint8_t(m_scratch >> m_scratchBits);
+	}
+	m_bits += bits;
+	if (m_buf && m_scratchBits > 0) // the partial byte is written right away, so no flush is needed
+		m_buf[m_bits / 8] = uint8_t(m_scratch << (8 - m_scratchBits));
+}
+
+void BitWriter::writeBool(bool value) {
+	writeBits(value ? 1 : 0, 1);
+}
+
+void BitWriter::writeRanged(int32_t value, int32_t min, int32_t max) {
+	value = std::clamp(value, min, max);
+	writeBits(uint32_t(int64_t(value) - min), bitsForRange(uint32_t(int64_t(max) - min)));
+}
+
+void BitWriter::writeVarint(uint32_t value) {
+	while (value >= 0x80) {
+		writeBits((value & 0x7f) | 0x80, 8);
+		value >>= 7;
+	}
+	writeBits(value, 8);
+}
+
+void BitWriter::writeFloat(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(uint32_t));
+	writeBits(bits, 32);
+}
+
+void BitWriter::writeQuantized(float value, float min, float max, uint32_t bits) {
+	writeBits(toSteps(value, min, max, bits), bits);
+}
+
+void BitWriter::writeString(const std::string& string) {
+	writeVarint(string.size());
+	if (m_scratchBits == 0) {
+		if (m_buf)
+			memcpy(m_buf + m_bits / 8, string.data(), string.size());
+		m_bits += static_cast<uint32_t>(string.size()) * 8;
+		return;
+	}
+	for (char c : string)
+		writeBits(uint8_t(c), 8);
+}
+
+uint32_t BitWriter::bitCount() {
+	return m_bits;
+}
+
+uint32_t BitWriter::byteCount() {
+	return (m_bits + 7) / 8;
+}
+
+// BitReader
+BitReader::BitReader(const char* buf, uint32_t size)
+	: m_buf(reinterpret_cast<const uint8_t*>(buf)), m_size(size)
+{}
+
+uint32_t BitReader::readBits(uint32_t bits) {
+	if (bits == 0)
+		return 0;
+	if (m_scratchBits == 0 && bits % 8 == 0 && m_pos + bits / 8 <= m_size) { // whole bytes at a byte boundary
+		uint32_t value = 0;
+		for (uint32_t i = 0; i < bits / 8; i++)
+			value = (value << 8) | m_buf[m_pos++];
+		return value;
+	}
+	while (m_scratchBits < bits) {
+		uint8_t byte = 0;
+		if (m_pos < m_size)
+			byte = m_buf[m_pos++];
+		else
+			m_overflowed = true;
+		m_scratch = (m_scratch << 8) | byte;
+		m_scratchBits += 8;
+	}
+	m_scratchBits -= bits;
+	return uint32_t((m_scratch >> m_scratchBits) & (~uint64_t(0) >> (64 - bits)));
+}
+
+bool BitReader::readBool() {
+	return readBits(1) != 0;
+}
+
+int32_t BitReader::readRanged(int32_t min, int32_t max) {
+	int64_t value = int64_t(min) + readBits(bitsForRange(uint32_t(int64_t(max) - min)));
+	return int32_t(std::min<int64_t>(value, max));
+}
+
+uint32_t BitReader::readVarint() {
+	uint32_t value = 0;
+	for (uint32_t shift = 0; shift < 35; shift += 7) {
+		uint32_t group = readBits(8);
+		value |= (group & 0x7f) << shift;
+		if (!(group & 0x80))
+			break;
+	}
+	return value;
+}
+
+float BitReader::readFloat() {
+	uint32_t bits = readBits(32);
+	float value;
+	memcpy(&value, &bits, sizeof(float));
+	return value;
+}
+
+float BitReader::readQuantized(float min, float max, uint32_t bits) {
+	return fromSteps(readBits(bits), min, max, bits);
+}
+
+std::string BitReader::readString() {
+	uint32_t size = readVarint();
+	if (size > m_size) { // can't be right, the string would be longer than the buffer
+		m_overflowed = true;
+		return "";
+	}
+	std::string string(size, '\0');
+	if (m_scratchBits == 0 && m_pos + size <= m_size) {
+		memcpy(&string[0], m_buf + m_pos, size);
+		m_pos += size;
+		return string;
+	}
+	for (char& c : string)
+		c = char(readBits(8));
+	return string;
+}
+
+bool BitReader::overflowed() {
+	return m_overflowed;
+}
+
+// ReplicatedValue
+bool ReplicatedValue::operator==(const ReplicatedValue& other) const {
+	return transform == other.transform && number == other.number && integer == other.integer;
+}
+
+bool ReplicatedValue::operator!=(const ReplicatedValue& other) const {
+	return !(*this == other);
+}
+
+// ReplicatedState
+void ReplicatedState::set(ReplicatedField field, const ReplicatedValue& value) {
+	mask |= 1 << field;
+	values[field] = value;
+}
+
+void ReplicatedState::merge(const ReplicatedState& delta) {
+	for (uint32_t field = 0; field < eFIELD_COUNT; field++)
+		if (delta.mask & (1 << field))
+			values[field] = delta.values[field];
+	mask |= delta.mask;
+}
+
+uint32_t ReplicatedState::changedFields(const ReplicatedState& other) const {
+	uint32_t changed = mask & ~other.mask;
+	for (uint32_t field = 0; field < eFIELD_COUNT; field++)
+		if ((mask & other.mask & (1 << field)) && values[field] != other.values[field])
+			changed |= 1 << field;
+	return changed;
+}
+
+void ReplicatedState::quantize() {
+	for (uint32_t field = 0; field < eFIELD_COUNT; field++) {
+		const ReplicatedFieldInfo& info = _replicatedFields[field];
+		if (info.type == eREPLICATED_QUANTIZED)
+			values[field].number = ::quantize(values[field].number, info.min, info.max, info.bits);
+		else if (info.type == eREPLICATED_TRANSFORM)
+			values[field].transform = quantizeTransform(values[field].transform);
+	}
+}
+
+void ReplicatedState::keepClientOwned() {
+	for (uint32_t field = 0; field < eFIELD_COUNT; field++) {
+		if (!_replicatedFields[field].clientOwned && (mask & (1 << field))) {
+			mask &= ~(1 << field);
+			values[field] = {};
+		}
+	}
+}
+
+void ReplicatedState::write(BitWriter& writer) const {
+	writer.writeBits(mask, eFIELD_COUNT);
+	for (uint32_t field = 0; field < eFIELD_COUNT; field++) {
+		if (!(mask & (1 << field)))
+			continue;
+		const ReplicatedFieldInfo& info = _replicatedFields[field];
+		const ReplicatedValue& value = values[field];
+		switch (info.type)
+		{
+		case eREPLICATED_BOOL:
+			writer.writeBool(value.integer != 0);
+			break;
+		case eREPLICATED_UINT:
+			writer.writeBits(value.integer, info.bits);
+			break;
+		case eREPLICATED_FLOAT:
+			writer.writeFloat(value.number);
+			break;
+		case eREPLICATED_QUANTIZED:
+			writer.writeQuantized(value.number, info.min, info.max, info.bits);
+			break;
+		case eREPLICATED_TRANSFORM:
+			writeTransform(writer, value.transform);
+			break;
+		}
+	}
+}
+
+void ReplicatedState::read(BitReader& reader) {
+	mask = reader.readBits(eFIELD_COUNT);
+	for (uint32_t field = 0; field < eFIELD_COUNT; field++) {
+		if (!(mask & (1 << field)))
+			continue;
+		const ReplicatedFieldInfo& info = _replicatedFields[field];
+		ReplicatedValue& value = values[field];
+		switch (info.type)
+		{
+		case eREPLICATED_BOOL:
+			value.integer = reader.readBool() ? 1 : 0;
+			break;
+		case eREPLICATED_UINT:
+			value.integer = reader.readBits(info.bits);
+			break;
+		case eREPLICATED_FLOAT:
+			value.number = reader.readFloat();
+			break;
+		case eREPLICATED_QUANTIZED:
+			value.number = reader.readQuantized(info.min, info.max, info.bits);
+			break;
+		case eREPLICATED_TRANSFORM:
+			value.transform = readTransform(reader);
+			break;
+		}
+	}
+}
+
 // Packet
-void Packet::sendTo(int socket, int flags) {
+uint32_t Packet::sendTo(int socket, int flags) {
 	uint32_t len = fullSize();
 	char* buf = new char[len];
-	auto* delBuf = buf;
 	pack(buf);
+	uint32_t bytesSent = sendBuffer(socket, buf, len);
+	delete[] buf;
+	return bytesSent;
+}
+
+uint32_t Packet::sendBuffer(int socket, const char* buf, uint32_t len) {
+	capture::record(capture::eSEND, capture::eSTREAM, socket, nullptr, buf, len);
+	if (conditioner::sendStream(socket, buf, len))
+		return len;
 
 	uint32_t offset = 0;
 	while (offset < len) {
 		int bytesSent = send(socket, buf + offset, len - offset, 0);
 		if (bytesSent == -1) {
 			sock::printLastError("Packet::send");
-			delete[] delBuf;
-			return;
+			return 0;
 		}
 		offset += bytesSent;
 	}
-	delete[] delBuf;
+	return len;
 }
 
-void Packet::sendToDgram(int socket, const sockaddr* addr, int flags) {
+PackedPacket Packet::packShared() {
+	auto spBuf = std::make_shared<std::vector<char>>(fullSize());
+	pack(spBuf->data());
+	return spBuf;
+}
+
+std::shared_ptr<Packet> Packet::unpackFrom(int& type, const char*& buf, const char* end) {
+	if (static_cast<size_t>(end - buf) < headerSize())
+		return nullptr;
+	uint32_t dataSize;
+	unpackHeader(buf, dataSize, type);
+	if (static_cast<uint64_t>(end - buf) < uint64_t(headerSize()) + dataSize)
+		return nullptr;
+	const char* constBuf = buf + headerSize();
+	buf += headerSize() + dataSize;
+
+	std::shared_ptr<Packet> spPacket = create(type);
+	if (!spPacket) {
+		printf("Packet::unpackFrom unknown packet type %i\n", type);
+		return nullptr;
+	}
+	if (!spPacket->unpackAll(constBuf, dataSize)) {
+		printf("Packet::unpackFrom malformed packet of type %i\n", type);
+		return nullptr;
+	}
+	return spPacket;
+}
+
+uint64_t Packet::claimedSize(const char* buf, const char* end) {
+	if (static_cast<size_t>(end - buf) < headerSize())
+		return 0;
+	uint32_t dataSize;
+	int type;
+	unpackHeader(buf, dataSize, type);
+	return uint64_t(headerSize()) + dataSize;
+}
+
+uint32_t Packet::sendToDgram(int socket, const sockaddr* addr, int flags) {
 	char buf[UDP_PACKET_BUFFER_SIZE];
 	pack(buf);
+	return sendBufferDgram(socket, addr, buf, fullSize());
+}
 
-	int addrlen;
+int dgramAddrlen(const sockaddr* addr) {
 	if (addr->sa_family == AF_INET)
-		addrlen = sizeof(sockaddr_in);
-	else if (addr->sa_family == AF_INET6)
-		addrlen = sizeof(sockaddr_in6);
-	else {
-		printf("Packet::sendToDgram address family not supported\n");
-		exit(0);
-	}
-	int bytesSent = sendto(socket, buf, UDP_PACKET_BUFFER_SIZE, 0, addr, addrlen); // send header only
+		return sizeof(sockaddr_in);
+	if (addr->sa_family == AF_INET6)
+		return sizeof(sockaddr_in6);
+	printf("Packet::sendToDgram address family not supported\n");
+	exit(0);
+}
+
+uint32_t Packet::sendBufferDgram(int socket, const sockaddr* addr, const char* buf, uint32_t len) {
+	capture::record(capture::eSEND, capture::eDGRAM, socket, addr, buf, len);
+
+	int addrlen = dgramAddrlen(addr);
+	if (conditioner::sendDgram(socket, addr, addrlen, buf, len))
+		return len;
+	int bytesSent = sendto(socket, buf, len, 0, addr, addrlen); // only the packet, the receiver reads into a full sized buffer
 	if (bytesSent == -1) {
 		sock::printLastError("Packet::sendto header");
-		return;
+		return 0;
+	}
+	return bytesSent;
+}
+
+const size_t _maxSegments = 64; // the kernel rejects more segments per send
+const size_t _maxSegmentedSize = 65000; // below the largest udp payload
+std::atomic<bool> _segmentationSupported = true; // cleared when a segmented send fails because it isn't supported
+
+uint32_t Packet::sendBuffersDgram(int socket, const sockaddr* addr, const std::vector<PackedPacket>& packets) {
+	uint32_t bytesSent = 0;
+	std::vector<char> segments;
+	size_t begin = 0;
+	while (begin < packets.size()) {
+		// a run of equal sized packets, the last segment may be shorter
+		size_t segmentSize = packets[begin]->size();
+		size_t size = segmentSize;
+		size_t end = begin + 1;
+		while (end < packets.size() && end - begin < _maxSegments && packets[end]->size() <= segmentSize && size + packets[end]->size() <= _maxSegmentedSize) {
+			size += packets[end]->size();
+			end++;
+			if (packets[end - 1]->size() < segmentSize)
+				break;
+		}
+
+		bool sent = false;
+		if (end - begin > 1 && _segmentationSupported && !conditioner::isActive()) { // conditioned dgrams are sent one by one
+			segments.clear();
+			for (size_t i = begin; i < end; i++)
+				segments.insert(segments.end(), packets[i]->begin(), packets[i]->end());
+			int result = sock::sendSegments(socket, segments.data(), segments.size(), addr, dgramAddrlen(addr), static_cast<uint16_t>(segmentSize));
+			if (result >= 0) {
+				for (size_t i = begin; i < end; i++)
+					capture::record(capture::eSEND, capture::eDGRAM, socket, addr, packets[i]->data(), packets[i]->size());
+				bytesSent += result;
+				sent = true;
+			}
+			else if (sock::isUnsupported() && _segmentationSupported.exchange(false)) {
+				sock::printLastError("Packet::sendSegments, sending dgrams one by one");
+			}
+			// any other error, e.g. full buffers, only sends this run one by one
+		}
+		if (!sent)
+			for (size_t i = begin; i < end; i++)
+				bytesSent += sendBufferDgram(socket, addr, packets[i]->data(), packets[i]->size());
+		begin = end;
 	}
+	return bytesSent;
 }
 
 std::shared_ptr<Packet> Packet::receiveFrom(int& type, int socket, int flags) {
 	char* buf = new char[headerSize()];
-	int bytesRead = recv(socket, buf, headerSize(), 0); // get just header
+	int bytesRead = receiveAll(socket, buf, headerSize()); // get just header
+	if (bytesRead == 0) { // connection was closed by the peer
+		delete[] buf;
+		return nullptr;
+	}
 	if (bytesRead == -1) {
 		sock::printLastError("Packet::recv header");
 		delete[] buf;
@@ -66,128 +643,132 @@ std::shared_ptr<Packet> Packet::receiveFrom(int& type, int socket, int flags) {
 	}
 	uint32_t dataSize;
 	unpackHeader(buf, dataSize, type);
-	delete[] buf;
+	if (dataSize > _maxStreamPacketSize) {
+		printf("Packet::receiveFrom packet of type %i claims %u bytes\n", type, dataSize);
+		delete[] buf;
+		return nullptr;
+	}
 
-	buf = new char[dataSize];
-	const char* constBuf = buf;
-	bytesRead = recv(socket, buf, dataSize, 0); // get just data
+	char* headerBuf = buf; // keep the header in front of the data for the capture
+	buf = new char[headerSize() + dataSize];
+	memcpy(buf, headerBuf, headerSize());
+	delete[] headerBuf;
+	const char* constBuf = buf + headerSize();
+	bytesRead = receiveAll(socket, buf + headerSize(), dataSize); // get just data
+	if (bytesRead == 0) { // connection was closed by the peer
+		delete[] buf;
+		return nullptr;
+	}
 	if (bytesRead == -1) {
 		sock::printLastError("Packet::recv data");
 		delete[] buf;
 		return nullptr;
 	}
+	capture::record(capture::eRECV, capture::eSTREAM, socket, nullptr, buf, headerSize() + dataSize);
 
-	std::shared_ptr<Packet> spPacket;
-	switch (type)
-	{
-		//case eMESSAGE: {
-		//	spPacket = std::make_shared<MessagePacket>();
-		//	spPacket->unpackData(buf, dataSize);
-		//	break;
-		//}
-	case eCONNECT: {
-		spPacket = std::make_shared<ConnectPacket>();
-		break;
-	}
-	case eUDP_CONNECT: {
-		spPacket = std::make_shared<UDPConnectPacket>();
-		break;
-	}
-	case eDISCONNECT: {
-		spPacket = std::make_shared<DisconnectPacket>();
-		break;
-	}
-	case eMOVE: {
-		spPacket = std::make_shared<MovePacket>();
-		break;
-	}
-	case eDamage: {
-		spPacket = std::make_shared<DamagePacket>();
-		break;
-	}
-	case eSpawn: {
-		spPacket = std::make_shared<SpawnPacket>();
-		break;
-	}
-	case eDeath: {
-		spPacket = std::make_shared<DeathPacket>();
-		break;
-	}
-	case eRay: {
-		spPacket = std::make_shared<RayPacket>();
-		break;
-	}
-	default:
-		break;
+	std::shared_ptr<Packet> spPacket = create(type);
+	if (!spPacket) {
+		printf("Packet::receiveFrom unknown packet type %i\n", type);
+		delete[] buf;
+		return nullptr;
 	}
-	spPacket->unpackGeneralData(constBuf);
-	spPacket->unpackData(constBuf, dataSize-spPacket->generalDataSize());
+	bool valid = spPacket->unpackAll(constBuf, dataSize);
 	delete[] buf;
+	if (!valid) {
+		printf("Packet::receiveFrom malformed packet of type %i\n", type);
+		return nullptr;
+	}
 
 	return spPacket;
 }
 
-std::shared_ptr<Packet> Packet::receiveFromDgram(int& type, int socket, sockaddr* addr, int* addrlen, int flags) {
+std::shared_ptr<Packet> Packet::receiveFromDgram(int& type, int socket, sockaddr* addr, int* addrlen, int flags, int64_t* receiveTime) {
 	char buf[UDP_PACKET_BUFFER_SIZE];
 	const char* constBuf = buf;
-	int bytesRead = recvfrom(socket, buf, UDP_PACKET_BUFFER_SIZE, 0, addr, addrlen); // get just header
+	int64_t timestamp;
+	int bytesRead = sock::recvFromTimestamped(socket, buf, UDP_PACKET_BUFFER_SIZE, 0, addr, addrlen, timestamp); // get just header
+	if (receiveTime)
+		*receiveTime = timestamp;
 	if (bytesRead == -1) {
 		sock::printLastError("Packet::recvfrom");
 		return nullptr;
 	}
+	if (bytesRead < static_cast<int>(headerSize()))
+		return nullptr;
 	uint32_t dataSize;
 	unpackHeader(constBuf, dataSize, type);
+	capture::record(capture::eRECV, capture::eDGRAM, socket, addr, buf, bytesRead); // what arrived, the header may claim more
 	constBuf += headerSize();
+	if (dataSize > bytesRead - headerSize()) // the readers are bounded by dataSize, it must not claim more than arrived
+		return nullptr;
 
-	std::shared_ptr<Packet> spPacket;
-	switch (type)
-	{
-		//case eMESSAGE: {
-		//	spPacket = std::make_shared<MessagePacket>();
-		//	spPacket->unpackData(ptr, dataSize);
-		//	break;
-		//}
-	case eCONNECT: {
-		spPacket = std::make_shared<ConnectPacket>();
-		break;
-	}
-	case eUDP_CONNECT: {
-		spPacket = std::make_shared<UDPConnectPacket>();
-		break;
-	}
-	case eDISCONNECT: {
-		spPacket = std::make_shared<DisconnectPacket>();
-		break;
-	}
-	case eMOVE: {
-		spPacket = std::make_shared<MovePacket>();
-		break;
-	}
-	case eDamage: {
-		spPacket = std::make_shared<DamagePacket>();
-		break;
-	}
-	case eSpawn: {
-		spPacket = std::make_shared<SpawnPacket>();
-		break;
-	}
-	case eDeath: {
-		spPacket = std::make_shared<DeathPacket>();
-		break;
-	}
-	case eRay: {
-		spPacket = std::make_shared<RayPacket>();
-		break;
+	std::shared_ptr<Packet> spPacket = create(type);
+	if (!spPacket) {
+		printf("Packet::receiveFromDgram unknown packet type %i\n", type);
+		return nullptr;
 	}
-	default:
-		break;
+	if (!spPacket->unpackAll(constBuf, dataSize)) {
+		printf("Packet::receiveFromDgram malformed packet of type %i\n", type);
+		return nullptr;
 	}
-	spPacket->unpackGeneralData(constBuf);
-	spPacket->unpackData(constBuf, dataSize - spPacket->generalDataSize());
 	return spPacket;
 
 }
 
+std::shared_ptr<Packet> Packet::create(int type) {
+	switch (type)
+	{
+		//case eMESSAGE:
+		//	return std::make_shared<MessagePacket>();
+	case eCONNECT:
+		return std::make_shared<ConnectPacket>();
+	case eUDP_CONNECT:
+		return std::make_shared<UDPConnectPacket>();
+	case eDISCONNECT:
+		return std::make_shared<DisconnectPacket>();
+	case eSTATE:
+		return std::make_shared<StatePacket>();
+	case eDamage:
+		return std::make_shared<DamagePacket>();
+	case eSpawn:
+		return std::make_shared<SpawnPacket>();
+	case eDeath:
+		return std::make_shared<DeathPacket>();
+	case eROOM_CREATE:
+		return std::make_shared<RoomCreatePacket>();
+	case eROOM_LIST:
+		return std::make_shared<RoomListPacket>();
+	case eROOM_JOIN:
+		return std::make_shared<RoomJoinPacket>();
+	case eBATCH:
+		return std::make_shared<BatchPacket>();
+	case eJOIN_SNAPSHOT:
+		return std::make_shared<JoinSnapshotPacket>();
+	case eHEARTBEAT:
+		return std::make_shared<HeartbeatPacket>();
+	case eDIRECTORY_REGISTER:
+		return std::make_shared<DirectoryRegisterPacket>();
+	case eDIRECTORY_QUERY:
+		return std::make_shared<DirectoryQueryPacket>();
+	case eDIRECTORY_ROOMS:
+		return std::make_shared<DirectoryRoomsPacket>();
+	case eREDIRECT:
+		return std::make_shared<RedirectPacket>();
+	case eSPECTATE:
+		return std::make_shared<SpectatePacket>();
+	case eSPECTATOR_FRAME:
+		return std::make_shared<SpectatorFramePacket>();
+	case eSNAPSHOT:
+		return std::make_shared<SnapshotPacket>();
+	case eSNAPSHOT_ACK:
+		return std::make_shared<SnapshotAckPacket>();
+	case eRay:
+		return std::make_shared<RayPacket>();
+	default:
+		return nullptr;
+	}
+}
+
 uint32_t Packet::fullSize() {
 	return headerSize() + generalDataSize() + dataSize();
 }
@@ -217,8 +798,16 @@ void Packet::packGeneralData(char*& buf, const int type) {
 	packString(buf, username);
 }
 
-void Packet::unpackGeneralData(const char*& buf) {
-	username = unpackString(buf);
+bool Packet::unpackGeneralData(const char*& buf, const char* end) {
+	username = unpackString(buf, end);
+	return buf != nullptr;
+}
+
+bool Packet::unpackAll(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	if (!unpackGeneralData(buf, end))
+		return false;
+	return unpackData(buf, end - buf);
 }
 
 // MessagePacket
@@ -246,15 +835,20 @@ void Packet::unpackGeneralData(const char*& buf) {
 
 // ConnectPacket
 uint32_t ConnectPacket::dataSize() {
-	return 0;
+	return sizeof(uint32_t);
 }
 
 void ConnectPacket::pack(char* buf) {
 	packGeneralData(buf, eCONNECT);
 	/* data */
+	packUint32(buf, flags);
 }
 
-void ConnectPacket::unpackData(const char* buf, uint32_t size) {}
+bool ConnectPacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	flags = unpackUint32(buf, end);
+	return buf != nullptr;
+}
 
 // UDPConnectPacket
 uint32_t UDPConnectPacket::dataSize() {
@@ -266,7 +860,9 @@ void UDPConnectPacket::pack(char* buf) {
 	/* data */
 }
 
-void UDPConnectPacket::unpackData(const char* buf, uint32_t size) {}
+bool UDPConnectPacket::unpackData(const char* buf, uint32_t size) {
+	return true;
+}
 
 // DisconnectPacket
 uint32_t DisconnectPacket::dataSize() {
@@ -278,21 +874,28 @@ void DisconnectPacket::pack(char* buf) {
 	/* data */
 }
 
-void DisconnectPacket::unpackData(const char* buf, uint32_t size) {}
+bool DisconnectPacket::unpackData(const char* buf, uint32_t size) {
+	return true;
+}
 
-// MovePacket
-uint32_t MovePacket::dataSize() {
-	return sizeof(glm::mat4);
+// StatePacket
+uint32_t StatePacket::dataSize() {
+	BitWriter writer;
+	state.write(writer);
+	return writer.byteCount();
 }
 
-void MovePacket::pack(char* buf) {
-	packGeneralData(buf, eMOVE);
+void StatePacket::pack(char* buf) {
+	packGeneralData(buf, eSTATE);
 	/* data */
-	sock::htonMat4(transform, buf);
+	BitWriter writer(buf);
+	state.write(writer);
 }
 
-void MovePacket::unpackData(const char* buf, uint32_t size) {
-	sock::ntohMat4(buf, transform);
+bool StatePacket::unpackData(const char* buf, uint32_t size) {
+	BitReader reader(buf, size);
+	state.read(reader);
+	return !reader.overflowed();
 }
 
 // DamagePacket
@@ -304,29 +907,34 @@ void DamagePacket::pack(char* buf) {
 	packGeneralData(buf, eDamage);
 	/* data */
 	packString(buf, usernameDamager);
-	uint32_t nDamage = htonf(damage);
-	memcpy(buf, &nDamage, sizeof(uint32_t)); buf += sizeof(uint32_t);
-	uint32_t nHealth = htonf(health);
-	memcpy(buf, &nHealth, sizeof(uint32_t));
+	packFloat(buf, damage);
+	packFloat(buf, health);
 }
 
-void DamagePacket::unpackData(const char* buf, uint32_t size) {
-	usernameDamager = unpackString(buf);
-	damage = ntohf(reinterpret_cast<const uint32_t*>(buf)[0]);
-	health = ntohf(reinterpret_cast<const uint32_t*>(buf)[1]);
+bool DamagePacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	usernameDamager = unpackString(buf, end);
+	damage = unpackFloat(buf, end);
+	health = unpackFloat(buf, end);
+	return buf != nullptr;
 }
 
 // SpawnPacket
 uint32_t SpawnPacket::dataSize() {
-	return 0;
+	return sizeof(float);
 }
 
 void SpawnPacket::pack(char* buf) {
 	packGeneralData(buf, eSpawn);
 	/* data */
+	packFloat(buf, health);
 }
 
-void SpawnPacket::unpackData(const char* buf, uint32_t size) {}
+bool SpawnPacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	health = unpackFloat(buf, end);
+	return buf != nullptr;
+}
 
 // DeathPacket
 uint32_t DeathPacket::dataSize() {
@@ -339,8 +947,10 @@ void DeathPacket::pack(char* buf) {
 	packString(buf, usernameKiller);
 }
 
-void DeathPacket::unpackData(const char* buf, uint32_t size) {
-	usernameKiller = unpackString(buf);
+bool DeathPacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	usernameKiller = unpackString(buf, end);
+	return buf != nullptr;
 }
 
 // RayPacket
@@ -355,7 +965,462 @@ void RayPacket::pack(char* buf) {
 	sock::htonVec3(direction, buf);
 }
 
-void RayPacket::unpackData(const char* buf, uint32_t size) {
+bool RayPacket::unpackData(const char* buf, uint32_t size) {
+	if (size < 2*sizeof(glm::vec3))
+		return false;
 	sock::ntohVec3(buf, origin); buf += sizeof(glm::vec3);
 	sock::ntohVec3(buf, direction);
+	return true;
+}
+
+// RoomCreatePacket
+uint32_t RoomCreatePacket::dataSize() {
+	return 3*sizeof(uint32_t) + name.size();
+}
+
+void RoomCreatePacket::pack(char* buf) {
+	packGeneralData(buf, eROOM_CREATE);
+	/* data */
+	packUint32(buf, roomId);
+	packString(buf, name);
+	packUint32(buf, maxPlayers);
+}
+
+bool RoomCreatePacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	roomId = unpackUint32(buf, end);
+	name = unpackString(buf, end);
+	maxPlayers = unpackUint32(buf, end);
+	return buf != nullptr;
+}
+
+// RoomListPacket
+uint32_t RoomListPacket::dataSize() {
+	uint32_t size = sizeof(uint32_t);
+	for (const auto& room : rooms)
+		size += 4*sizeof(uint32_t) + room.name.size();
+	return size;
+}
+
+void RoomListPacket::pack(char* buf) {
+	packGeneralData(buf, eROOM_LIST);
+	/* data */
+	packUint32(buf, rooms.size());
+	for (const auto& room : rooms) {
+		packUint32(buf, room.id);
+		packString(buf, room.name);
+		packUint32(buf, room.players);
+		packUint32(buf, room.maxPlayers);
+	}
+}
+
+bool RoomListPacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	uint32_t count = unpackUint32(buf, end);
+	if (!fits(buf, end, uint64_t(count) * 4*sizeof(uint32_t))) // every room takes at least 16 bytes
+		return false;
+	rooms.resize(count);
+	for (auto& room : rooms) {
+		room.id = unpackUint32(buf, end);
+		room.name = unpackString(buf, end);
+		room.players = unpackUint32(buf, end);
+		room.maxPlayers = unpackUint32(buf, end);
+	}
+	return buf != nullptr;
+}
+
+// RoomJoinPacket
+uint32_t RoomJoinPacket::dataSize() {
+	return sizeof(uint32_t);
+}
+
+void RoomJoinPacket::pack(char* buf) {
+	packGeneralData(buf, eROOM_JOIN);
+	/* data */
+	packUint32(buf, roomId);
+}
+
+bool RoomJoinPacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	roomId = unpackUint32(buf, end);
+	return buf != nullptr;
+}
+
+// BatchPacket
+uint32_t BatchPacket::dataSize() {
+	return 2*sizeof(uint32_t) + data.size();
+}
+
+void BatchPacket::pack(char* buf) {
+	packGeneralData(buf, eBATCH);
+	/* data */
+	packUint32(buf, rawSize);
+	packUint32(buf, data.size());
+	memcpy(buf, data.data(), data.size());
+}
+
+bool BatchPacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	rawSize = unpackUint32(buf, end);
+	uint32_t dataSize = unpackUint32(buf, end);
+	data = unpackBytes(buf, end, dataSize);
+	return buf != nullptr;
+}
+
+// JoinSnapshotPacket
+uint32_t JoinSnapshotPacket::dataSize() {
+	uint32_t size = sizeof(uint32_t);
+	for (const auto& player : players)
+		size += sizeof(uint32_t) + player.username.size() + sizeof(uint8_t) + 2*sizeof(float) + 2*sizeof(uint32_t);
+	return size;
+}
+
+void JoinSnapshotPacket::pack(char* buf) {
+	packGeneralData(buf, eJOIN_SNAPSHOT);
+	/* data */
+	packUint32(buf, players.size());
+	for (const auto& player : players) {
+		packString(buf, player.username);
+		*buf++ = player.alive ? 1 : 0;
+		packFloat(buf, player.health);
+		packUint32(buf, player.kills);
+		packUint32(buf, player.deaths);
+		packFloat(buf, player.damage);
+	}
+}
+
+bool JoinSnapshotPacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	uint32_t count = unpackUint32(buf, end);
+	if (!fits(buf, end, uint64_t(count) * (sizeof(uint32_t) + sizeof(uint8_t) + 2*sizeof(float) + 2*sizeof(uint32_t))))
+		return false;
+	players.resize(count);
+	for (auto& player : players) {
+		player.username = unpackString(buf, end);
+		player.alive = unpackUint8(buf, end) != 0;
+		player.health = unpackFloat(buf, end);
+		player.kills = unpackUint32(buf, end);
+		player.deaths = unpackUint32(buf, end);
+		player.damage = unpackFloat(buf, end);
+	}
+	return buf != nullptr;
+}
+
+// SnapshotPacket
+void encodeSnapshotEntity(BitWriter& writer, const SnapshotEntity& entity) {
+	writer.writeString(entity.username);
+	entity.state.write(writer);
+}
+
+uint32_t SnapshotPacket::entityBits(const SnapshotEntity& entity) {
+	BitWriter writer;
+	encodeSnapshotEntity(writer, entity);
+	return writer.bitCount();
+}
+
+void SnapshotPacket::encode(BitWriter& writer) {
+	writer.writeVarint(sequence);
+	writer.writeBool(baseline != 0);
+	if (baseline != 0)
+		writer.writeVarint(sequence - baseline); // the baseline is a few snapshots back, this fits into a byte
+	writer.writeVarint(entities.size());
+	for (const auto& entity : entities)
+		encodeSnapshotEntity(writer, entity);
+}
+
+uint32_t SnapshotPacket::dataSize() {
+	BitWriter writer;
+	encode(writer);
+	return writer.byteCount();
+}
+
+void SnapshotPacket::pack(char* buf) {
+	packGeneralData(buf, eSNAPSHOT);
+	/* data */
+	BitWriter writer(buf);
+	encode(writer);
+}
+
+bool SnapshotPacket::unpackData(const char* buf, uint32_t size) {
+	BitReader reader(buf, size);
+	sequence = reader.readVarint();
+	baseline = reader.readBool() ? sequence - reader.readVarint() : 0;
+	uint32_t count = reader.readVarint();
+	if (count > size) // every entity takes at least a byte
+		return false;
+	entities.resize(count);
+	for (auto& entity : entities) {
+		entity.username = reader.readString();
+		entity.state.read(reader);
+	}
+	return !reader.overflowed();
+}
+
+// SnapshotAckPacket
+uint32_t SnapshotAckPacket::dataSize() {
+	return sizeof(uint32_t);
+}
+
+void SnapshotAckPacket::pack(char* buf) {
+	packGeneralData(buf, eSNAPSHOT_ACK);
+	/* data */
+	packUint32(buf, sequence);
+}
+
+bool SnapshotAckPacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	sequence = unpackUint32(buf, end);
+	return buf != nullptr;
+}
+
+// HeartbeatPacket
+uint32_t HeartbeatPacket::dataSize() {
+	return 0;
+}
+
+void HeartbeatPacket::pack(char* buf) {
+	packGeneralData(buf, eHEARTBEAT);
+	/* data */
+}
+
+bool HeartbeatPacket::unpackData(const char* buf, uint32_t size) {
+	return true;
+}
+
+// DirectoryRegisterPacket
+uint32_t DirectoryRegisterPacket::dataSize() {
+	uint32_t size = 5*sizeof(uint32_t) + address.size() + port.size() + region.size();
+	for (const auto& room : rooms)
+		size += 4*sizeof(uint32_t) + room.name.size();
+	return size + removedRooms.size()*sizeof(uint32_t);
+}
+
+void DirectoryRegisterPacket::pack(char* buf) {
+	packGeneralData(buf, eDIRECTORY_REGISTER);
+	/* data */
+	packString(buf, address);
+	packString(buf, port);
+	packString(buf, region);
+	packUint32(buf, rooms.size());
+	for (const auto& room : rooms) {
+		packUint32(buf, room.id);
+		packString(buf, room.name);
+		packUint32(buf, room.players);
+		packUint32(buf, room.maxPlayers);
+	}
+	packUint32(buf, removedRooms.size());
+	for (uint32_t roomId : removedRooms)
+		packUint32(buf, roomId);
+}
+
+bool DirectoryRegisterPacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	address = unpackString(buf, end);
+	port = unpackString(buf, end);
+	region = unpackString(buf, end);
+	uint32_t count = unpackUint32(buf, end);
+	if (!fits(buf, end, uint64_t(count) * 4*sizeof(uint32_t)))
+		return false;
+	rooms.resize(count);
+	for (auto& room : rooms) {
+		room.id = unpackUint32(buf, end);
+		room.name = unpackString(buf, end);
+		room.players = unpackUint32(buf, end);
+		room.maxPlayers = unpackUint32(buf, end);
+	}
+	count = unpackUint32(buf, end);
+	if (!fits(buf, end, uint64_t(count) * sizeof(uint32_t)))
+		return false;
+	removedRooms.resize(count);
+	for (auto& roomId : removedRooms)
+		roomId = unpackUint32(buf, end);
+	return buf != nullptr;
+}
+
+// DirectoryQueryPacket
+uint32_t DirectoryQueryPacket::dataSize() {
+	return 6*sizeof(uint32_t) + region.size() + namePrefix.size();
+}
+
+void DirectoryQueryPacket::pack(char* buf) {
+	packGeneralData(buf, eDIRECTORY_QUERY);
+	/* data */
+	packUint32(buf, queryId);
+	packString(buf, region);
+	packString(buf, namePrefix);
+	packUint32(buf, minFreeSlots);
+	packUint32(buf, limit);
+	packUint32(buf, offset);
+}
+
+bool DirectoryQueryPacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	queryId = unpackUint32(buf, end);
+	region = unpackString(buf, end);
+	namePrefix = unpackString(buf, end);
+	minFreeSlots = unpackUint32(buf, end);
+	limit = unpackUint32(buf, end);
+	offset = unpackUint32(buf, end);
+	return buf != nullptr;
+}
+
+// DirectoryRoomsPacket
+uint32_t DirectoryRoomsPacket::roomSize(const DirectoryRoom& room) {
+	return 7*sizeof(uint32_t) + room.address.size() + room.port.size() + room.region.size() + room.info.name.size();
+}
+
+uint32_t DirectoryRoomsPacket::dataSize() {
+	uint32_t size = 2*sizeof(uint32_t) + sizeof(uint8_t);
+	for (const auto& room : rooms)
+		size += roomSize(room);
+	return size;
+}
+
+void DirectoryRoomsPacket::pack(char* buf) {
+	packGeneralData(buf, eDIRECTORY_ROOMS);
+	/* data */
+	packUint32(buf, queryId);
+	*buf++ = more ? 1 : 0;
+	packUint32(buf, rooms.size());
+	for (const auto& room : rooms) {
+		packString(buf, room.address);
+		packString(buf, room.port);
+		packString(buf, room.region);
+		packUint32(buf, room.info.id);
+		packString(buf, room.info.name);
+		packUint32(buf, room.info.players);
+		packUint32(buf, room.info.maxPlayers);
+	}
+}
+
+bool DirectoryRoomsPacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	queryId = unpackUint32(buf, end);
+	more = unpackUint8(buf, end) != 0;
+	uint32_t count = unpackUint32(buf, end);
+	if (!fits(buf, end, uint64_t(count) * 7*sizeof(uint32_t)))
+		return false;
+	rooms.resize(count);
+	for (auto& room : rooms) {
+		room.address = unpackString(buf, end);
+		room.port = unpackString(buf, end);
+		room.region = unpackString(buf, end);
+		room.info.id = unpackUint32(buf, end);
+		room.info.name = unpackString(buf, end);
+		room.info.players = unpackUint32(buf, end);
+		room.info.maxPlayers = unpackUint32(buf, end);
+	}
+	return buf != nullptr;
+}
+
+// RedirectPacket
+uint32_t RedirectPacket::dataSize() {
+	return 3*sizeof(uint32_t) + address.size() + port.size();
+}
+
+void RedirectPacket::pack(char* buf) {
+	packGeneralData(buf, eREDIRECT);
+	/* data */
+	packString(buf, address);
+	packString(buf, port);
+	packUint32(buf, roomId);
+}
+
+bool RedirectPacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	address = unpackString(buf, end);
+	port = unpackString(buf, end);
+	roomId = unpackUint32(buf, end);
+	return buf != nullptr;
+}
+
+// SpectatePacket
+uint32_t SpectatePacket::dataSize() {
+	return sizeof(uint32_t) + sizeof(uint8_t);
+}
+
+void SpectatePacket::pack(char* buf) {
+	packGeneralData(buf, eSPECTATE);
+	/* data */
+	packUint32(buf, roomId);
+	*buf++ = keyframes ? 1 : 0;
+}
+
+bool SpectatePacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	roomId = unpackUint32(buf, end);
+	keyframes = unpackUint8(buf, end) != 0;
+	return buf != nullptr;
+}
+
+// SpectatorFramePacket
+void SpectatorFramePacket::append(const PackedPacket& spPacked) {
+	data.insert(data.end(), spPacked->begin(), spPacked->end());
+}
+
+uint32_t SpectatorFramePacket::dataSize() {
+	return 3*sizeof(uint32_t) + 2*sizeof(uint8_t) + data.size();
+}
+
+void SpectatorFramePacket::pack(char* buf) {
+	packGeneralData(buf, eSPECTATOR_FRAME);
+	/* data */
+	packUint32(buf, roomId);
+	packUint32(buf, sequence);
+	*buf++ = keyframe ? 1 : 0;
+	*buf++ = closed ? 1 : 0;
+	packUint32(buf, data.size());
+	memcpy(buf, data.data(), data.size());
+}
+
+bool SpectatorFramePacket::unpackData(const char* buf, uint32_t size) {
+	const char* end = buf + size;
+	roomId = unpackUint32(buf, end);
+	sequence = unpackUint32(buf, end);
+	keyframe = unpackUint8(buf, end) != 0;
+	closed = unpackUint8(buf, end) != 0;
+	uint32_t dataSize = unpackUint32(buf, end);
+	data = unpackBytes(buf, end, dataSize);
+	return buf != nullptr;
+}
+
+// StreamReader
+const uint32_t _streamReadSize = 64 * 1024; // per receive, the socket is polled again for the rest
+
+bool StreamReader::receive(int socket) {
+	m_socket = socket;
+	if (m_offset > 0) {
+		m_buf.erase(m_buf.begin(), m_buf.begin() + m_offset);
+		m_offset = 0;
+	}
+	size_t size = m_buf.size();
+	m_buf.resize(size + _streamReadSize);
+	int bytesRead = recv(socket, m_buf.data() + size, _streamReadSize, 0);
+	m_buf.resize(size + std::max(bytesRead, 0));
+	if (bytesRead == 0) // connection was closed by the peer
+		return false;
+	if (bytesRead < 0)
+		return sock::wouldBlock();
+	uint64_t claimed = Packet::claimedSize(m_buf.data(), m_buf.data() + m_buf.size());
+	if (claimed > uint64_t(_maxStreamPacketSize) + 2*sizeof(uint32_t)) {
+		printf("StreamReader::receive a packet claims %llu bytes\n", static_cast<unsigned long long>(claimed));
+		return false;
+	}
+	return true;
+}
+
+std::shared_ptr<Packet> StreamReader::next(int& type, bool& malformed) {
+	const char* start = m_buf.data() + m_offset;
+	const char* buf = start;
+	auto spPacket = Packet::unpackFrom(type, buf, m_buf.data() + m_buf.size());
+	malformed = !spPacket && buf != start; // unpackFrom only moves past whole packets
+	if (buf != start)
+		capture::record(capture::eRECV, capture::eSTREAM, m_socket, nullptr, start, static_cast<uint32_t>(buf - start));
+	m_offset += buf - start;
+	return spPacket;
+}
+
+void StreamReader::clear() {
+	m_buf.clear();
+	m_offset = 0;
 }
@@ -1,26 +1,208 @@
 #pragma once
 
 #include "SockUitls.h"
+#include "Shares/NetworkData.h"
 
 #include "glm.hpp"
 
 #include <string>
 #include <memory>
+#include <vector>
 
 #define UDP_PACKET_BUFFER_SIZE 1472
 
+const uint32_t _maxStreamPacketSize = 16 * 1024 * 1024; // stream packets claiming more are treated as corrupt, keyframes of big rooms stay far below
+
 enum PacketType {
 	eMESSAGE = 1,
 	eCONNECT = 2,
 	eDISCONNECT = 3,
-	eMOVE = 4,
+	eSTATE = 4,
 	eDamage = 5,
 	eSpawn = 6,
 	eDeath = 7,
 	eUDP_CONNECT = 8,
+	eROOM_CREATE = 9,
+	eROOM_LIST = 10,
+	eROOM_JOIN = 11,
+	eBATCH = 12,
+	eJOIN_SNAPSHOT = 13,
+	eHEARTBEAT = 14,
+	eDIRECTORY_REGISTER = 15,
+	eDIRECTORY_QUERY = 16,
+	eDIRECTORY_ROOMS = 17,
+	eREDIRECT = 18,
+	eSPECTATE = 19,
+	eSPECTATOR_FRAME = 20,
+	eSNAPSHOT = 21,
+	eSNAPSHOT_ACK = 22,
 	eRay = 100
 };
 
+// options a client asks for in its ConnectPacket
+enum ConnectFlagBits {
+	eCONNECT_FLAG_COMPRESSION = 0x1 // the server compresses the stream it sends to this client
+};
+
+// a packet serialized once and shared by every queue it is sent from
+typedef std::shared_ptr<const std::vector<char>> PackedPacket;
+
+// health and energy go from 0 to this, compact packets quantize them to _statBits
+const float _statRange = 100;
+const uint32_t _statBits = 10;
+
+// player positions go from -_positionRange to _positionRange on every axis, compact packets quantize them to _positionBits, about 2mm
+// the rotation is sent as the three smallest components of its quaternion with _rotationBits each
+const float _positionRange = 1024;
+const uint32_t _positionBits = 20;
+const uint32_t _rotationBits = 12;
+
+// writes values with only as many bits as they need, used by the compact packets
+// bits are written from the most significant bit of each byte, the last byte is padded with zeros
+class BitWriter {
+public:
+	// buf needs room for every bit written, without a buffer the writer only counts the bits
+	BitWriter(char* buf = nullptr);
+
+	// the lowest bits of the value, at most 32
+	void writeBits(uint32_t value, uint32_t bits);
+
+	void writeBool(bool value);
+
+	// the value is clamped to the range, sent with the bits the range needs
+	void writeRanged(int32_t value, int32_t min, int32_t max);
+
+	// 7 bits per group with a bit telling if another group follows, small values take one byte
+	void writeVarint(uint32_t value);
+
+	void writeFloat(float value);
+
+	// the value is clamped to the range and rounded to one of 2^bits evenly spaced steps
+	void writeQuantized(float value, float min, float max, uint32_t bits);
+
+	// the length as a varint, then the bytes
+	void writeString(const std::string& string);
+
+	uint32_t bitCount();
+
+	// the bits rounded up to whole bytes
+	uint32_t byteCount();
+
+private:
+	uint8_t* m_buf;
+	uint32_t m_bits = 0;
+	uint64_t m_scratch = 0; // bits not yet in a whole byte
+	uint32_t m_scratchBits = 0;
+};
+
+// reads what a BitWriter wrote, in the same order
+// reading past the end returns zeros and marks the reader as overflowed, so corrupt dgrams can't read outside the buffer
+class BitReader {
+public:
+	BitReader(const char* buf, uint32_t size);
+
+	uint32_t readBits(uint32_t bits);
+
+	bool readBool();
+
+	int32_t readRanged(int32_t min, int32_t max);
+
+	uint32_t readVarint();
+
+	float readFloat();
+
+	float readQuantized(float min, float max, uint32_t bits);
+
+	std::string readString();
+
+	bool overflowed();
+
+private:
+	const uint8_t* m_buf;
+	uint32_t m_size;
+	uint32_t m_pos = 0; // the next byte to read
+	uint64_t m_scratch = 0; // bits read from the buffer but not yet returned
+	uint32_t m_scratchBits = 0;
+	bool m_overflowed = false;
+};
+
+// the value as a BitReader reads it after BitWriter::writeQuantized
+float quantize(float value, float min, float max, uint32_t bits);
+
+// the transform as a BitReader reads it after a ReplicatedState wrote it
+glm::mat4 quantizeTransform(const glm::mat4& transform);
+
+// Replication, see Objects/Replica.h
+// the replicated fields of a player, a new field needs an entry here, one in _replicatedFields and a registration in the player
+// received fields are applied in this order, alive comes first because spawning resets the health and energy
+enum ReplicatedField {
+	eFIELD_ALIVE,
+	eFIELD_TRANSFORM,
+	eFIELD_HEALTH,
+	eFIELD_ENERGY,
+	eFIELD_COUNT
+};
+
+enum ReplicatedType {
+	eREPLICATED_BOOL,
+	eREPLICATED_UINT, // with the bits of the field
+	eREPLICATED_FLOAT,
+	eREPLICATED_QUANTIZED, // in the range and with the bits of the field
+	eREPLICATED_TRANSFORM // a rotation and a position, quantized with _rotationBits and _positionBits
+};
+
+// how a field is sent
+struct ReplicatedFieldInfo {
+	ReplicatedType type;
+	bool clientOwned = false; // the server takes it from the state packets of the player, the others it fills from its own state
+	float min = 0;
+	float max = 0;
+	uint32_t bits = 0;
+};
+
+// by ReplicatedField
+const ReplicatedFieldInfo _replicatedFields[eFIELD_COUNT] = {
+	{ eREPLICATED_BOOL, false },
+	{ eREPLICATED_TRANSFORM, true },
+	{ eREPLICATED_QUANTIZED, false, 0, _statRange, _statBits },
+	{ eREPLICATED_QUANTIZED, true, 0, _statRange, _statBits }
+};
+
+// the value of one field, only the member of its type is used, the others keep their defaults
+struct ReplicatedValue {
+	glm::mat4 transform = glm::mat4(1);
+	float number = 0; // floats and quantized floats
+	uint32_t integer = 0; // bools and uints
+
+	bool operator==(const ReplicatedValue& other) const;
+	bool operator!=(const ReplicatedValue& other) const;
+};
+
+// the replicated fields of one entity, only the fields in the mask are set
+struct ReplicatedState {
+	uint32_t mask = 0; // a bit for every ReplicatedField
+	ReplicatedValue values[eFIELD_COUNT];
+
+	void set(ReplicatedField field, const ReplicatedValue& value);
+
+	// copies the fields in the mask of the delta
+	void merge(const ReplicatedState& delta);
+
+	// the fields of this state that differ from the other or that the other doesn't have
+	uint32_t changedFields(const ReplicatedState& other) const;
+
+	// rounds the quantized fields to what the receiver gets, so changes below the precision can be ignored
+	void quantize();
+
+	// drops the fields that aren't client owned, a client may not claim its health or revive itself
+	void keepClientOwned();
+
+	// only the fields in the mask, as the schema in _replicatedFields says
+	void write(BitWriter& writer) const;
+	void read(BitReader& reader);
+};
+
+// every packet class has a static packetType, so packets can be handed over as objects without packing them
 class Packet {
 public:
 	// general data
@@ -29,11 +211,44 @@ public:
 
 	// send this packet to the specified socket
 	// socket has to be a stream socket or a connected dgram socket
-	void sendTo(int socket, int flags = 0);
+	// returns the number of bytes sent, 0 on failure
+	uint32_t sendTo(int socket, int flags = 0);
 
 	// send this packet to the specified socket
 	// socket has to be a dgram socket
-	void sendToDgram(int socket, const sockaddr* addr, int flags = 0);
+	// returns the number of bytes sent, 0 on failure
+	uint32_t sendToDgram(int socket, const sockaddr* addr, int flags = 0);
+
+	// sends already packed packets, e.g. a batch of packets from packShared
+	// socket has to be a stream socket
+	// returns the number of bytes sent, 0 on failure
+	static uint32_t sendBuffer(int socket, const char* buf, uint32_t len);
+
+	// sends an already packed packet
+	// socket has to be a dgram socket
+	// returns the number of bytes sent, 0 on failure
+	static uint32_t sendBufferDgram(int socket, const sockaddr* addr, const char* buf, uint32_t len);
+
+	// sends every packet as its own dgram to the same address
+	// runs of equal sized packets are sent with one call where segmentation offload is supported, order them by size to get long runs
+	// socket has to be a dgram socket
+	// returns the number of bytes sent
+	static uint32_t sendBuffersDgram(int socket, const sockaddr* addr, const std::vector<PackedPacket>& packets);
+
+	// packs this packet into a shared buffer, used to send the same packet to many clients
+	PackedPacket packShared();
+
+	// the size of the packed packet in bytes
+	uint32_t fullSize();
+
+	// unpacks the packet at buf, e.g. from a decompressed batch
+	// buf will point behind the packet
+	// returns nullptr if the buffer ends before the packet or the type is unknown
+	static std::shared_ptr<Packet> unpackFrom(int& type, const char*& buf, const char* end);
+
+	// the size of the packet at buf as its header claims, with the header
+	// returns 0 if the buffer ends before the header
+	static uint64_t claimedSize(const char* buf, const char* end);
 
 	// receive a packet from the specified socket
 	// socket has to be a stream socket or a connected dgram socket
@@ -42,10 +257,12 @@ public:
 	// receive a packet from the specified socket
 	// socket has to be a dgram socket
 	// the address that sent the received packet will be written to addr with the size of adrrlen
-	static std::shared_ptr<Packet> receiveFromDgram(int& type, int socket, sockaddr* addr, int* addrlen, int flags = 0);
+	// receiveTime gets the kernel receive time in nanoseconds since the system clock epoch if the socket has rx timestamps enabled, otherwise 0
+	static std::shared_ptr<Packet> receiveFromDgram(int& type, int socket, sockaddr* addr, int* addrlen, int flags = 0, int64_t* receiveTime = nullptr);
 
 protected:
-	uint32_t fullSize();
+	// creates an empty packet of the given type, returns nullptr for unknown types
+	static std::shared_ptr<Packet> create(int type);
 
 	static uint32_t headerSize();
 
@@ -65,17 +282,22 @@ protected:
 	// automatically moves the pointer
 	void packGeneralData(char*& buf, const int type);
 	
-	// unpacks data present in all packets including the header
-	// returns the size of the data stored in the packet and the type of packet
+	// unpacks data present in all packets, reads up to end
 	// automatically moves the pointer
-	void unpackGeneralData(const char*& buf);
+	// returns false if the data doesn't fit
+	bool unpackGeneralData(const char*& buf, const char* end);
+
+	// unpacks the general data and the data from the size bytes after the header
+	// returns false if the packet doesn't fit into size, it has to be dropped then
+	bool unpackAll(const char* buf, uint32_t size);
 
 	// takes the pointer to a buffer and fills it with the packed packet
 	// should use packHeader
 	virtual void pack(char* buf) = 0;
 
 	// takes the pointer to the data part and fills the package with data
-	virtual void unpackData(const char* buf, uint32_t size) = 0;
+	// reads no more than size bytes, returns false if the data doesn't fit
+	virtual bool unpackData(const char* buf, uint32_t size) = 0;
 };
 
 //class MessagePacket : public Packet {
@@ -98,7 +320,10 @@ protected:
 class ConnectPacket : public Packet {
 	friend class Packet;
 public:
+	static constexpr PacketType packetType = eCONNECT;
+
 	// data
+	uint32_t flags = 0; // ConnectFlagBits requested by the client
 
 protected:
 	uint32_t dataSize();
@@ -107,12 +332,14 @@ protected:
 	void pack(char* buf);
 
 	// takes just the data part
-	void unpackData(const char* buf, uint32_t size);
+	bool unpackData(const char* buf, uint32_t size);
 };
 
 class UDPConnectPacket : public Packet {
 	friend class Packet;
 public:
+	static constexpr PacketType packetType = eUDP_CONNECT;
+
 	// data
 
 protected:
@@ -122,12 +349,14 @@ protected:
 	void pack(char* buf);
 
 	// takes just the data part
-	void unpackData(const char* buf, uint32_t size);
+	bool unpackData(const char* buf, uint32_t size);
 };
 
 class DisconnectPacket : public Packet {
 	friend class Packet;
 public:
+	static constexpr PacketType packetType = eDISCONNECT;
+
 	// data
 
 protected:
@@ -137,14 +366,19 @@ protected:
 	void pack(char* buf);
 
 	// takes just the data part
-	void unpackData(const char* buf, uint32_t size);
+	bool unpackData(const char* buf, uint32_t size);
 };
 
-class MovePacket : public Packet {
+// the client owned replicated fields of the player of the client that changed, sent over dgrams
+// servers put the whole state of every player into the spectator frames
+// compact, packed with a BitWriter
+class StatePacket : public Packet {
 	friend class Packet;
 public:
+	static constexpr PacketType packetType = eSTATE;
+
 	// data
-	glm::mat4 transform = glm::mat4(1);
+	ReplicatedState state = {};
 
 protected:
 	uint32_t dataSize();
@@ -153,12 +387,14 @@ protected:
 	void pack(char* buf);
 
 	// takes just the data part
-	void unpackData(const char* buf, uint32_t size);
+	bool unpackData(const char* buf, uint32_t size);
 };
 
 class DamagePacket : public Packet {
 	friend class Packet;
 public:
+	static constexpr PacketType packetType = eDamage;
+
 	//data
 	std::string usernameDamager = "";
 	float damage = 0;
@@ -171,13 +407,16 @@ protected:
 	void pack(char* buf);
 
 	// takes just the data part
-	void unpackData(const char* buf, uint32_t size);
+	bool unpackData(const char* buf, uint32_t size);
 };
 
 class SpawnPacket : public Packet {
 	friend class Packet;
 public:
+	static constexpr PacketType packetType = eSpawn;
+
 	//data
+	float health = 0; // the health the player spawned with
 
 protected:
 	uint32_t dataSize();
@@ -186,12 +425,14 @@ protected:
 	void pack(char* buf);
 
 	// takes just the data part
-	void unpackData(const char* buf, uint32_t size);
+	bool unpackData(const char* buf, uint32_t size);
 };
 
 class DeathPacket : public Packet {
 	friend class Packet;
 public:
+	static constexpr PacketType packetType = eDeath;
+
 	//data
 	std::string usernameKiller = "";
 
@@ -202,13 +443,15 @@ protected:
 	void pack(char* buf);
 
 	// takes just the data part
-	void unpackData(const char* buf, uint32_t size);
+	bool unpackData(const char* buf, uint32_t size);
 };
 
-// Item Packetsgit 
+// Item Packets
 class RayPacket : public Packet {
 	friend class Packet;
 public:
+	static constexpr PacketType packetType = eRay;
+
 	//data
 	glm::vec3 origin = { 0, 0, 0 };
 	glm::vec3 direction = { 0, 0, 0 };
@@ -220,5 +463,356 @@ protected:
 	void pack(char* buf);
 
 	// takes just the data part
-	void unpackData(const char* buf, uint32_t size);
+	bool unpackData(const char* buf, uint32_t size);
+};
+
+// Room Packets
+// sent by a client to create a room, the server answers with the same packet and the id of the created room
+// roomId is 0 if the room couldn't be created
+class RoomCreatePacket : public Packet {
+	friend class Packet;
+public:
+	static constexpr PacketType packetType = eROOM_CREATE;
+
+	//data
+	uint32_t roomId = 0;
+	std::string name = "";
+	uint32_t maxPlayers = 0;
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	bool unpackData(const char* buf, uint32_t size);
+};
+
+// sent empty by a client to request the room list, the server answers with all rooms
+class RoomListPacket : public Packet {
+	friend class Packet;
+public:
+	static constexpr PacketType packetType = eROOM_LIST;
+
+	//data
+	std::vector<RoomInfo> rooms = {};
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	bool unpackData(const char* buf, uint32_t size);
+};
+
+// sent by a client after connecting to join a room, roomId 0 joins the default room
+// the server answers with the id of the joined room, roomId is 0 if the room couldn't be joined
+class RoomJoinPacket : public Packet {
+	friend class Packet;
+public:
+	static constexpr PacketType packetType = eROOM_JOIN;
+
+	//data
+	uint32_t roomId = 0;
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	bool unpackData(const char* buf, uint32_t size);
+};
+
+// a batch of stream packets compressed with the stream compressor of the connection
+// batches have to be decompressed in the order they were received
+class BatchPacket : public Packet {
+	friend class Packet;
+public:
+	static constexpr PacketType packetType = eBATCH;
+
+	//data
+	uint32_t rawSize = 0; // size of the packed packets before compression
+	std::vector<char> data = {};
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	bool unpackData(const char* buf, uint32_t size);
+};
+
+// the state of one player in a JoinSnapshotPacket
+struct PlayerSnapshot {
+	std::string username = "";
+	bool alive = false;
+	float health = 0;
+	uint32_t kills = 0;
+	uint32_t deaths = 0;
+	float damage = 0;
+};
+
+// sent once to a client joining a room, contains every player of the room including the joining one
+class JoinSnapshotPacket : public Packet {
+	friend class Packet;
+public:
+	static constexpr PacketType packetType = eJOIN_SNAPSHOT;
+
+	//data
+	std::vector<PlayerSnapshot> players = {};
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	bool unpackData(const char* buf, uint32_t size);
+};
+
+// one player in a SnapshotPacket, only the fields in the mask of the state are sent
+struct SnapshotEntity {
+	std::string username = "";
+	ReplicatedState state = {};
+};
+
+// the state of the other players of the room, sent by the server every tick something changed
+// the entities are deltas against the baseline, the snapshot the client acknowledged last, players that didn't change are left out
+// the client discards snapshots older than the newest it has and snapshots whose baseline it doesn't have anymore
+// compact, the fields are packed with a BitWriter
+class SnapshotPacket : public Packet {
+	friend class Packet;
+public:
+	static constexpr PacketType packetType = eSNAPSHOT;
+
+	//data
+	uint32_t sequence = 0; // increases with every snapshot sent to the client, starts at 1
+	uint32_t baseline = 0; // the sequence the deltas are against, 0 if every field is sent
+	std::vector<SnapshotEntity> entities = {};
+
+	// the bits the entity takes in the packet
+	static uint32_t entityBits(const SnapshotEntity& entity);
+
+protected:
+	// packs the snapshot bit by bit
+	void encode(BitWriter& writer);
+
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	bool unpackData(const char* buf, uint32_t size);
+};
+
+// sent by the client over dgrams for every snapshot it applied, the server sends the next deltas against it
+class SnapshotAckPacket : public Packet {
+	friend class Packet;
+public:
+	static constexpr PacketType packetType = eSNAPSHOT_ACK;
+
+	//data
+	uint32_t sequence = 0;
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	bool unpackData(const char* buf, uint32_t size);
+};
+
+// sent by the server over the stream in a fixed interval, the client answers with the same packet
+// keeps idle connections alive and lets both sides notice a peer that vanished without closing the connection
+class HeartbeatPacket : public Packet {
+	friend class Packet;
+public:
+	static constexpr PacketType packetType = eHEARTBEAT;
+
+	// data
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	bool unpackData(const char* buf, uint32_t size);
+};
+
+// Directory Packets, see Tools/Directory.cpp
+// sent by a server to the directory over a stream, the first packet after connecting has every room of the server
+// afterwards only changed and removed rooms are sent, a packet without rooms keeps the registration alive
+class DirectoryRegisterPacket : public Packet {
+	friend class Packet;
+public:
+	static constexpr PacketType packetType = eDIRECTORY_REGISTER;
+
+	//data
+	std::string address = ""; // where clients reach the server, empty uses the address the directory sees
+	std::string port = ""; // the port clients connect to
+	std::string region = "";
+	std::vector<RoomInfo> rooms = {}; // added or changed rooms
+	std::vector<uint32_t> removedRooms = {};
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	bool unpackData(const char* buf, uint32_t size);
+};
+
+// sent by a client to the directory as a dgram, the directory answers with a DirectoryRoomsPacket
+class DirectoryQueryPacket : public Packet {
+	friend class Packet;
+public:
+	static constexpr PacketType packetType = eDIRECTORY_QUERY;
+
+	//data
+	uint32_t queryId = 0; // repeated in the answer
+	std::string region = ""; // empty matches every region
+	std::string namePrefix = ""; // case insensitive, empty matches every name
+	uint32_t minFreeSlots = 0;
+	uint32_t limit = 0; // 0 answers with as many rooms as fit into one dgram
+	uint32_t offset = 0; // skips this many matching rooms, pages through more rooms than fit into one dgram
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	bool unpackData(const char* buf, uint32_t size);
+};
+
+// the rooms matching a DirectoryQueryPacket ordered by name, always fits into one dgram
+class DirectoryRoomsPacket : public Packet {
+	friend class Packet;
+public:
+	static constexpr PacketType packetType = eDIRECTORY_ROOMS;
+
+	//data
+	uint32_t queryId = 0;
+	bool more = false; // more rooms matched than the packet has
+	std::vector<DirectoryRoom> rooms = {};
+
+	// the bytes a room adds to the packet
+	static uint32_t roomSize(const DirectoryRoom& room);
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	bool unpackData(const char* buf, uint32_t size);
+};
+
+// Router Packets, see Tools/Router.cpp
+// sent by the router instead of joining a room, the client connects to the server hosting the room and joins it there
+class RedirectPacket : public Packet {
+	friend class Packet;
+public:
+	static constexpr PacketType packetType = eREDIRECT;
+
+	//data
+	std::string address = "";
+	std::string port = "";
+	uint32_t roomId = 0; // the id of the room on that server
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	bool unpackData(const char* buf, uint32_t size);
+};
+
+// Spectator Packets, see Tools/Relay.cpp
+// sent to a relay to watch a room, the relay answers with the latest keyframe of the room and every frame after it
+// relays send it to the relay they chain to, with roomId 0 and every keyframe, so they can serve spectators joining later
+class SpectatePacket : public Packet {
+	friend class Packet;
+public:
+	static constexpr PacketType packetType = eSPECTATE;
+
+	//data
+	uint32_t roomId = 0; // 0 watches every room
+	bool keyframes = false; // also send the keyframes after the first, spectators that kept up don't need them
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	bool unpackData(const char* buf, uint32_t size);
+};
+
+// the stream packets of one room over a short time, delayed by the server
+// a keyframe has the whole room, a join snapshot and the state of every player, the frames after it only what changed
+class SpectatorFramePacket : public Packet {
+	friend class Packet;
+public:
+	static constexpr PacketType packetType = eSPECTATOR_FRAME;
+
+	//data
+	uint32_t roomId = 0;
+	uint32_t sequence = 0; // increases with every frame of the room
+	bool keyframe = false;
+	bool closed = false; // the room closed, no frames follow
+	std::vector<char> data = {}; // packed packets, read with Packet::unpackFrom
+
+	// appends the packed packet to the data
+	void append(const PackedPacket& spPacked);
+
+protected:
+	uint32_t dataSize();
+
+	// packs the data into the given buffer, buffer needs to have the same size as packet.fullSize()
+	void pack(char* buf);
+
+	// takes just the data part
+	bool unpackData(const char* buf, uint32_t size);
+};
+
+// buffers what a non-blocking stream socket received until whole packets arrived
+// the server and the tools serve many peers on one thread with it, so a peer that sends part of a packet holds up nobody
+class StreamReader {
+public:
+	// reads what arrived without blocking
+	// returns false if the peer closed the connection, it failed or the next packet claims more than _maxStreamPacketSize
+	bool receive(int socket);
+
+	// unpacks the next complete packet
+	// returns nullptr if none is complete, malformed is set if the next packet can't be unpacked, the connection should be closed then
+	std::shared_ptr<Packet> next(int& type, bool& malformed);
+
+	// drops everything buffered
+	void clear();
+
+private:
+	int m_socket = -1; // the socket of the last receive, for the capture
+	std::vector<char> m_buf = {};
+	size_t m_offset = 0; // bytes at the front that are unpacked already
 };
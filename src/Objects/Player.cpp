@@ -18,6 +18,11 @@ Player::Player(Zap::Scene& scene, std::string username, Zap::ActorLoader loader)
 	m_scene.attachActor(m_camera);
 	m_camera.addTransform(glm::mat4(1));
 	m_camera.addCamera();
+
+	m_replica.addBool(eFIELD_ALIVE, [this]() { return m_active; }, [this](bool alive) { if (alive) syncSpawn(); else syncDeath(); });
+	m_replica.addTransform(eFIELD_TRANSFORM, [this]() { return getTransform(); }, [this](glm::mat4 transform) { if (m_active) setTransform(transform); });
+	m_replica.addFloat(eFIELD_HEALTH, [this]() { return m_health; }, [this](float health) { m_health = health; });
+	m_replica.addFloat(eFIELD_ENERGY, [this]() { return m_energy; }, [this](float energy) { m_energy = energy; });
 }
 
 Player::~Player() {
@@ -130,14 +135,13 @@ void Player::updateMechanics(Controls& controls, float dt) {
 		m_energy += (m_energy * 0.1 + 5) * dt;
 		m_energy = std::min<float>(m_energy, 100.f);
 		m_spawnProtection -= dt;
-
-		client::sendPlayerMove(*this);
 	}
 	else {
 		m_spawnTimeout -= dt;
 		if (m_spawnTimeout < 0)
 			spawn();
 	}
+	client::sendPlayerState(*this); // also while dead, the others have to see the death
 }
 
 void Player::update(Controls& controls, float dt) {
@@ -198,7 +202,7 @@ void Player::localKill() {
 void Player::spawn(Zap::ActorLoader loader) {
 	localSpawn(loader);
 	m_spawnProtection = 5;
-	client::sendPlayerSpawn(m_username);
+	client::sendPlayerSpawn(m_username, m_health);
 }
 
 void Player::kill() {
@@ -286,6 +290,10 @@ PlayerInventory& Player::getInventory() {
 	return m_inventory;
 }
 
+Replica& Player::getReplica() {
+	return m_replica;
+}
+
 std::string Player::getUsername() {
 	return m_username;
 }
@@ -323,6 +331,8 @@ bool Player::hasDoneDamage()  { return ZP_IS_FLAG_ENABLED(m_events, eDAMAGE_DONE
 bool Player::hasKilled()      { return ZP_IS_FLAG_ENABLED(m_events, eKILL); }
 
 void Player::syncSpawn() {
+	if (m_active) // a snapshot can spawn the player before the spawn packet arrives
+		return;
 	Zap::ActorLoader loader;
 	localSpawn(loader);
 }
@@ -336,9 +346,11 @@ void Player::syncDeath(Player& killer) {
 	killer.m_recordEvents |= eKILL;
 }
 
-void Player::syncMove(glm::mat4 transform) {
-	if(m_active)
-		setTransform(transform);
+void Player::syncStats(float health, uint32_t kills, uint32_t deaths, float damage) {
+	m_health = health;
+	m_kills = kills;
+	m_deaths = deaths;
+	m_damage = damage;
 }
 
 void Player::syncDamage(Player& damager, float damage, float newHealth) {
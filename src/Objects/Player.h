@@ -2,6 +2,7 @@
 
 #include "Shares/Controls.h"
 #include "Objects/Inventory.h"
+#include "Objects/Replica.h"
 
 #include "Zap/Zap.h"
 #include "Zap/FileLoader.h"
@@ -70,6 +71,9 @@ public:
 
 	PlayerInventory& getInventory();
 
+	// the fields other clients see, registered in the constructor
+	Replica& getReplica();
+
 	std::string getUsername();
 
 	Zap::Actor getCamera();
@@ -98,10 +102,11 @@ public:
 	void syncDeath();
 	void syncDeath(Player& killer);
 
-	void syncMove(glm::mat4 transform);
-
 	void syncDamage(Player& damager, float damage, float newHealth);
 
+	// sets the stats of a player that was already in the game when joining
+	void syncStats(float health, uint32_t kills, uint32_t deaths, float damage);
+
 private:
 	bool m_recvInput = false; // UI can block input
 	bool m_active = false; // switches between active and spectator mode TODO integrate into player modes
@@ -117,6 +122,7 @@ private:
 	Zap::Actor m_camera;
 
 	PlayerInventory m_inventory;
+	Replica m_replica; // the getters and setters point to this player, players must not be copied
 
 	float m_health = 100;
 	float m_energy = 100;
@@ -0,0 +1,48 @@
+#include "Replica.h"
+
+void Replica::add(ReplicatedField field, Getter get, Setter set) {
+	m_fields[field] = { get, set };
+	m_registered |= 1 << field;
+}
+
+void Replica::addBool(ReplicatedField field, std::function<bool()> get, std::function<void(bool)> set) {
+	add(field,
+		[get]() { ReplicatedValue value; value.integer = get() ? 1 : 0; return value; },
+		[set](const ReplicatedValue& value) { set(value.integer != 0); });
+}
+
+void Replica::addFloat(ReplicatedField field, std::function<float()> get, std::function<void(float)> set) {
+	add(field,
+		[get]() { ReplicatedValue value; value.number = get(); return value; },
+		[set](const ReplicatedValue& value) { set(value.number); });
+}
+
+void Replica::addTransform(ReplicatedField field, std::function<glm::mat4()> get, std::function<void(glm::mat4)> set) {
+	add(field,
+		[get]() { ReplicatedValue value; value.transform = get(); return value; },
+		[set](const ReplicatedValue& value) { set(value.transform); });
+}
+
+ReplicatedState Replica::collect(bool all) {
+	ReplicatedState current;
+	for (uint32_t field = 0; field < eFIELD_COUNT; field++)
+		if (m_registered & (1 << field))
+			current.set(ReplicatedField(field), m_fields[field].get());
+	current.quantize();
+
+	uint32_t changed = all ? current.mask : current.changedFields(m_collected) | (m_dirty & current.mask);
+	m_collected = current;
+	m_dirty = 0;
+	current.mask = changed;
+	return current;
+}
+
+void Replica::markDirty(ReplicatedField field) {
+	m_dirty |= 1 << field;
+}
+
+void Replica::apply(const ReplicatedState& state) {
+	for (uint32_t field = 0; field < eFIELD_COUNT; field++)
+		if ((state.mask & m_registered & (1 << field)))
+			m_fields[field].set(state.values[field]);
+}
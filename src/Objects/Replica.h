@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Objects/Packets.h"
+
+#include <functional>
+
+// the replicated fields of a game object, see ReplicatedField
+// the object registers a getter and a setter for each of its fields once, the network layer does the rest
+// fields are dirty if their value changed since the last collect, the values are compared as the receivers get them
+class Replica {
+public:
+	typedef std::function<ReplicatedValue()> Getter;
+	typedef std::function<void(const ReplicatedValue&)> Setter;
+
+	void add(ReplicatedField field, Getter get, Setter set);
+
+	void addBool(ReplicatedField field, std::function<bool()> get, std::function<void(bool)> set);
+	void addFloat(ReplicatedField field, std::function<float()> get, std::function<void(float)> set);
+	void addTransform(ReplicatedField field, std::function<glm::mat4()> get, std::function<void(glm::mat4)> set);
+
+	// the dirty fields, every registered field if all is set
+	// the fields aren't dirty afterwards
+	ReplicatedState collect(bool all = false);
+
+	// the field is collected next time even if it didn't change
+	void markDirty(ReplicatedField field);
+
+	// calls the setters of the fields in the mask of the state, in the order of ReplicatedField
+	void apply(const ReplicatedState& state);
+
+private:
+	struct Field {
+		Getter get = nullptr;
+		Setter set = nullptr;
+	};
+	Field m_fields[eFIELD_COUNT] = {};
+	uint32_t m_registered = 0; // a bit for every field with a getter and setter
+	uint32_t m_dirty = 0;
+	ReplicatedState m_collected = {}; // the values of the last collect
+};
@@ -0,0 +1,303 @@
+#include "PlayerStats.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <io.h>
+#elif __linux__
+#include <unistd.h>
+#endif
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <fstream>
+#include <set>
+#include <iterator>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstring>
+#include <cstdio>
+
+namespace playerstats {
+	const char _magic[8] = { 'V', 'O', 'D', 'S', 'T', 'S', '0', '1' };
+	const uint32_t _maxUsernameSize = 1024; // longer records are treated as corrupt
+	const std::chrono::milliseconds _flushInterval = std::chrono::milliseconds(1000); // changes reach the disk at least this often
+	const size_t _flushPlayers = 256; // the writer wakes early when this many players changed
+	const size_t _compactSlack = 1024; // the file is rewritten on open when it has this many more records than twice the players
+
+	// players ordered from best to worst
+	struct Rank {
+		uint32_t kills;
+		float damage;
+		std::string username;
+
+		bool operator<(const Rank& other) const {
+			if (kills != other.kills)
+				return kills > other.kills;
+			if (damage != other.damage)
+				return damage > other.damage;
+			return username < other.username;
+		}
+	};
+
+	std::mutex _mStore; // controls access to all variables of the store
+	std::condition_variable _cvWriter;
+	bool _isOpen = false;
+	bool _stopWriter = false;
+	std::thread _writer;
+	std::string _path = "";
+	FILE* _file = nullptr;
+	std::unordered_map<std::string, Record> _records = {};
+	std::unordered_set<std::string> _dirty = {}; // players changed since the last write, a player changing often is written once per batch
+	// the best leaderboardSize players, stats only grow so a player that drops out can only come back by passing the last one
+	std::set<Rank> _leaderboard = {};
+
+	Rank rankOf(const Record& record) {
+		return { record.kills, record.damage, record.username };
+	}
+
+	// moves the player to its new place, old is its rank before the change
+	void updateLeaderboard(const Rank& old, const Rank& rank) {
+		auto it = _leaderboard.find(old);
+		if (it != _leaderboard.end())
+			_leaderboard.erase(it);
+		else if (_leaderboard.size() >= leaderboardSize && !(rank < *_leaderboard.rbegin()))
+			return;
+		_leaderboard.insert(rank);
+		if (_leaderboard.size() > leaderboardSize)
+			_leaderboard.erase(std::prev(_leaderboard.end()));
+	}
+
+	void appendRecord(std::vector<char>& buf, const Record& record) {
+		uint16_t usernameSize = static_cast<uint16_t>(std::min<size_t>(record.username.size(), _maxUsernameSize));
+		uint32_t size = sizeof(uint16_t) + usernameSize + 2 * sizeof(uint32_t) + sizeof(float);
+		size_t offset = buf.size();
+		buf.resize(offset + sizeof(uint32_t) + size);
+		char* ptr = buf.data() + offset;
+		memcpy(ptr, &size, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+		memcpy(ptr, &usernameSize, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+		memcpy(ptr, record.username.data(), usernameSize); ptr += usernameSize;
+		memcpy(ptr, &record.kills, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+		memcpy(ptr, &record.deaths, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+		memcpy(ptr, &record.damage, sizeof(float));
+	}
+
+	// flushes the file and waits until the disk has it
+	bool syncFile(FILE* file) {
+		if (fflush(file) != 0)
+			return false;
+#ifdef _WIN32
+		return _commit(_fileno(file)) == 0;
+#elif __linux__
+		return fdatasync(fileno(file)) == 0;
+#endif
+	}
+
+	// reads the records of the file into _records
+	// returns false if the file isn't a stats file, torn is set if the file ends inside a record
+	bool load(std::string path, size_t& recordCount, bool& torn) {
+		recordCount = 0;
+		torn = false;
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+			return true; // nothing stored yet
+
+		char magic[sizeof(_magic)];
+		bool isShort = !file.read(magic, sizeof(magic));
+		if (memcmp(magic, _magic, file.gcount()) != 0) {
+			fprintf(stderr, "playerstats: %s is no stats file\n", path.c_str());
+			return false;
+		}
+		if (isShort) { // empty or cut off while it was created, it gets its header when it's rewritten
+			torn = true;
+			return true;
+		}
+
+		std::vector<char> data;
+		while (true) {
+			uint32_t size;
+			if (!file.read(reinterpret_cast<char*>(&size), sizeof(uint32_t))) {
+				torn = file.gcount() > 0;
+				break;
+			}
+			data.resize(size);
+			if (size < sizeof(uint16_t) + 2 * sizeof(uint32_t) + sizeof(float) || size > sizeof(uint16_t) + _maxUsernameSize + 2 * sizeof(uint32_t) + sizeof(float) || !file.read(data.data(), size)) {
+				torn = true; // everything from here on was never fully written
+				break;
+			}
+
+			Record record;
+			const char* ptr = data.data();
+			uint16_t usernameSize;
+			memcpy(&usernameSize, ptr, sizeof(uint16_t)); ptr += sizeof(uint16_t);
+			if (sizeof(uint16_t) + usernameSize + 2 * sizeof(uint32_t) + sizeof(float) != size) {
+				torn = true;
+				break;
+			}
+			record.username.assign(ptr, usernameSize); ptr += usernameSize;
+			memcpy(&record.kills, ptr, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+			memcpy(&record.deaths, ptr, sizeof(uint32_t)); ptr += sizeof(uint32_t);
+			memcpy(&record.damage, ptr, sizeof(float));
+			_records[record.username] = record;
+			recordCount++;
+		}
+		return true;
+	}
+
+	// writes all players into a new file and replaces the old one with it
+	bool compact(std::string path) {
+		std::vector<char> buf(_magic, _magic + sizeof(_magic));
+		for (auto& recordPair : _records)
+			appendRecord(buf, recordPair.second);
+
+		std::string tempPath = path + ".tmp";
+		FILE* file = fopen(tempPath.c_str(), "wb");
+		if (!file) {
+			perror("playerstats: fopen");
+			return false;
+		}
+		bool written = fwrite(buf.data(), 1, buf.size(), file) == buf.size() && syncFile(file);
+		fclose(file);
+		if (!written) {
+			fprintf(stderr, "playerstats: could not write %s\n", tempPath.c_str());
+			return false;
+		}
+#ifdef _WIN32
+		if (!MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+			fprintf(stderr, "playerstats: MoveFileEx failed (%lu)\n", GetLastError());
+			return false;
+		}
+#elif __linux__
+		if (rename(tempPath.c_str(), path.c_str()) != 0) { // atomic, a crash leaves either the old or the new file
+			perror("playerstats: rename");
+			return false;
+		}
+#endif
+		return true;
+	}
+
+	// appends the changed players to the file in batches, so the disk is synced once per batch
+	void writerLoop() {
+		std::vector<char> batch;
+		std::unique_lock<std::mutex> lk(_mStore);
+		while (true) {
+			_cvWriter.wait_for(lk, _flushInterval, [] { return _stopWriter || _dirty.size() >= _flushPlayers; });
+			if (_dirty.empty()) {
+				if (_stopWriter)
+					return;
+				continue;
+			}
+			batch.clear();
+			for (auto& username : _dirty)
+				appendRecord(batch, _records.at(username));
+			_dirty.clear();
+			lk.unlock();
+
+			if (fwrite(batch.data(), 1, batch.size(), _file) != batch.size() || !syncFile(_file))
+				fprintf(stderr, "playerstats: could not write %s\n", _path.c_str());
+
+			lk.lock();
+		}
+	}
+
+	bool open(std::string path) {
+		std::lock_guard<std::mutex> lk(_mStore);
+		if (_isOpen)
+			return true;
+
+		size_t recordCount;
+		bool torn;
+		if (!load(path, recordCount, torn)) {
+			_records.clear();
+			return false;
+		}
+		bool exists = static_cast<bool>(std::ifstream(path));
+		if (!exists || torn || recordCount > 2 * _records.size() + _compactSlack) {
+			if (!compact(path)) {
+				_records.clear();
+				return false;
+			}
+		}
+
+		_file = fopen(path.c_str(), "ab");
+		if (!_file) {
+			perror("playerstats: fopen");
+			_records.clear();
+			return false;
+		}
+		for (auto& recordPair : _records)
+			updateLeaderboard(rankOf(recordPair.second), rankOf(recordPair.second));
+
+		_path = path;
+		_stopWriter = false;
+		_writer = std::thread(writerLoop);
+		_isOpen = true;
+		printf("loaded the stats of %zu players from %s\n", _records.size(), path.c_str());
+		return true;
+	}
+
+	void close() {
+		{
+			std::lock_guard<std::mutex> lk(_mStore);
+			if (!_isOpen)
+				return;
+			_isOpen = false; // no more changes, the writer writes the last ones
+			_stopWriter = true;
+		}
+		_cvWriter.notify_all();
+		_writer.join();
+
+		std::lock_guard<std::mutex> lk(_mStore);
+		fclose(_file);
+		_file = nullptr;
+		_records.clear();
+		_dirty.clear();
+		_leaderboard.clear();
+	}
+
+	bool isOpen() {
+		std::lock_guard<std::mutex> lk(_mStore);
+		return _isOpen;
+	}
+
+	void add(const std::string& username, uint32_t kills, uint32_t deaths, float damage) {
+		bool wakeWriter;
+		{
+			std::lock_guard<std::mutex> lk(_mStore);
+			if (!_isOpen || username.empty())
+				return;
+			Record& record = _records[username];
+			Rank old = rankOf(record);
+			old.username = username;
+			record.username = username;
+			record.kills += kills;
+			record.deaths += deaths;
+			record.damage += damage;
+			updateLeaderboard(old, rankOf(record));
+			_dirty.insert(username);
+			wakeWriter = _dirty.size() >= _flushPlayers;
+		}
+		if (wakeWriter)
+			_cvWriter.notify_one();
+	}
+
+	bool get(const std::string& username, Record& record) {
+		std::lock_guard<std::mutex> lk(_mStore);
+		auto it = _records.find(username);
+		if (it == _records.end())
+			return false;
+		record = it->second;
+		return true;
+	}
+
+	std::vector<Record> top(size_t count) {
+		std::lock_guard<std::mutex> lk(_mStore);
+		std::vector<Record> records;
+		records.reserve(std::min(count, _leaderboard.size()));
+		for (auto it = _leaderboard.begin(); it != _leaderboard.end() && records.size() < count; it++)
+			records.push_back(_records.at(it->username));
+		return records;
+	}
+}
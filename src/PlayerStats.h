@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// the kills, deaths and damage of every username across matches, kept by the server in an append-only file
+// updates change the memory right away, a writer thread appends the changed players to the file and syncs it in batches
+// so the room workers never wait for the disk
+// the file starts with a magic followed by records, each record is its size and the full stats of one player, the last record of a player wins
+namespace playerstats {
+	struct Record {
+		std::string username = "";
+		uint32_t kills = 0;
+		uint32_t deaths = 0;
+		float damage = 0;
+	};
+
+	// the number of players the leaderboard keeps
+	const size_t leaderboardSize = 100;
+
+	// loads the file at path, creates it if it doesn't exist, and starts the writer
+	// rewrites the file with one record per player when it has grown too much or ends in a torn record
+	// returns false if the file can't be read or written
+	bool open(std::string path);
+
+	// writes the remaining changes and stops the writer
+	void close();
+
+	bool isOpen();
+
+	// adds to the stats of the player, can be called from any thread, does nothing if the store isn't open
+	void add(const std::string& username, uint32_t kills, uint32_t deaths, float damage);
+
+	// returns false if the player has no stats yet
+	bool get(const std::string& username, Record& record);
+
+	// the best players by kills, then damage, at most leaderboardSize
+	std::vector<Record> top(size_t count);
+}
@@ -0,0 +1,133 @@
+#include "Resolver.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+
+namespace resolver {
+	typedef std::chrono::steady_clock Clock;
+
+	struct CacheEntry {
+		std::vector<Address> addresses;
+		Clock::time_point time;
+	};
+
+	std::mutex _mCache;
+	std::unordered_map<std::string, CacheEntry> _cache = {};
+
+	std::string cacheKey(const std::string& host, const std::string& port) {
+		return host + ":" + port;
+	}
+
+	bool Request::wait(int timeout) {
+		std::unique_lock<std::mutex> lk(m_mutex);
+		return m_cv.wait_for(lk, std::chrono::milliseconds(timeout), [this] { return m_done; });
+	}
+
+	bool Request::succeeded() {
+		std::lock_guard<std::mutex> lk(m_mutex);
+		return m_done && !m_addresses.empty();
+	}
+
+	std::vector<Address> Request::getAddresses() {
+		std::lock_guard<std::mutex> lk(m_mutex);
+		return m_addresses;
+	}
+
+	std::string Request::getError() {
+		std::lock_guard<std::mutex> lk(m_mutex);
+		return m_error;
+	}
+
+	void Request::finish(std::vector<Address> addresses, std::string error) {
+		{
+			std::lock_guard<std::mutex> lk(m_mutex);
+			m_addresses = addresses;
+			m_error = error;
+			m_done = true;
+		}
+		m_cv.notify_all();
+	}
+
+	void lookup(std::shared_ptr<Request> spRequest, std::string host, std::string port) {
+		addrinfo hints;
+		addrinfo* info;
+
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		int status;
+		if ((status = getaddrinfo(host.c_str(), port.c_str(), &hints, &info)) != 0) {
+			spRequest->finish({}, gai_strerror(status));
+			return;
+		}
+
+		std::vector<Address> addresses;
+		for (addrinfo* p = info; p != nullptr; p = p->ai_next) {
+			if (p->ai_family != AF_INET && p->ai_family != AF_INET6)
+				continue;
+			Address address;
+			memcpy(&address.addr, p->ai_addr, p->ai_addrlen);
+			address.addrlen = static_cast<socklen_t>(p->ai_addrlen);
+			address.family = p->ai_family;
+			address.protocol = p->ai_protocol;
+			addresses.push_back(address);
+		}
+		freeaddrinfo(info);
+
+		if (addresses.empty()) {
+			spRequest->finish({}, "no usable address");
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lk(_mCache);
+			_cache[cacheKey(host, port)] = { addresses, Clock::now() };
+		}
+		spRequest->finish(addresses, "");
+	}
+
+	std::shared_ptr<Request> resolve(std::string host, std::string port, int cacheTime) {
+		auto spRequest = std::make_shared<Request>();
+		{
+			std::lock_guard<std::mutex> lk(_mCache);
+			auto it = _cache.find(cacheKey(host, port));
+			if (it != _cache.end()) {
+				if (Clock::now() - it->second.time < std::chrono::milliseconds(cacheTime)) {
+					spRequest->finish(it->second.addresses, "");
+					return spRequest;
+				}
+				_cache.erase(it);
+			}
+		}
+		std::thread(lookup, spRequest, host, port).detach(); // getaddrinfo can't be cancelled, a stopped client just stops waiting for it
+		return spRequest;
+	}
+
+	void invalidate(std::string host, std::string port) {
+		std::lock_guard<std::mutex> lk(_mCache);
+		_cache.erase(cacheKey(host, port));
+	}
+
+	std::vector<Address> interleaveFamilies(const std::vector<Address>& addresses) {
+		if (addresses.empty())
+			return {};
+		std::vector<Address> first;
+		std::vector<Address> second;
+		for (const auto& address : addresses) {
+			if (address.family == addresses[0].family)
+				first.push_back(address);
+			else
+				second.push_back(address);
+		}
+		std::vector<Address> ordered;
+		for (size_t i = 0; i < std::max(first.size(), second.size()); i++) {
+			if (i < first.size())
+				ordered.push_back(first[i]);
+			if (i < second.size())
+				ordered.push_back(second[i]);
+		}
+		return ordered;
+	}
+}
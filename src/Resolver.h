@@ -0,0 +1,55 @@
+#pragma once
+
+#include "SockUitls.h"
+
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <vector>
+
+// asynchronous name resolution with a cache, so connecting never blocks on getaddrinfo
+namespace resolver {
+	struct Address {
+		sockaddr_storage addr = {};
+		socklen_t addrlen = 0;
+		int family = AF_UNSPEC;
+		int protocol = 0;
+
+		sockaddr* getAddr() {
+			return reinterpret_cast<sockaddr*>(&addr);
+		}
+	};
+
+	// the result of a lookup, filled by the resolver thread
+	class Request {
+	public:
+		// waits at most timeout milliseconds
+		// returns true when the lookup is done
+		bool wait(int timeout);
+
+		// only valid after wait returned true
+		bool succeeded();
+		std::vector<Address> getAddresses();
+		std::string getError();
+
+		void finish(std::vector<Address> addresses, std::string error);
+
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_cv;
+		bool m_done = false;
+		std::vector<Address> m_addresses = {};
+		std::string m_error = "";
+	};
+
+	// starts resolving host and port on a detached thread
+	// a cached result younger than cacheTime milliseconds is returned immediately
+	std::shared_ptr<Request> resolve(std::string host, std::string port, int cacheTime);
+
+	// removes the cached result, used when none of its addresses could be reached
+	void invalidate(std::string host, std::string port);
+
+	// orders the addresses for staggered connection attempts, alternating the address families starting with the first returned one
+	std::vector<Address> interleaveFamilies(const std::vector<Address>& addresses);
+}
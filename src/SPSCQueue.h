@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+// bounded lock-free queue for exactly one producer thread and one consumer thread
+// _capacity has to be a power of two
+template<typename T, size_t _capacity>
+class SPSCQueue {
+	static_assert(_capacity > 0 && (_capacity & (_capacity - 1)) == 0, "SPSCQueue capacity has to be a power of two");
+public:
+	// returns false if the queue is full
+	// must only be called by the producer thread
+	bool push(T value) {
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail - m_head.load(std::memory_order_acquire) == _capacity)
+			return false;
+		m_items[tail & (_capacity - 1)] = std::move(value);
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	// returns false if the queue is empty
+	// must only be called by the consumer thread
+	bool pop(T& value) {
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+			return false;
+		value = std::move(m_items[head & (_capacity - 1)]);
+		m_items[head & (_capacity - 1)] = T(); // release resources held by the slot
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	// only a snapshot, the other thread may change the size at any time
+	size_t size() const {
+		return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+	}
+
+	bool empty() const {
+		return size() == 0;
+	}
+
+	size_t capacity() const {
+		return _capacity;
+	}
+
+private:
+	std::array<T, _capacity> m_items = {};
+
+	alignas(64) std::atomic<size_t> m_head = 0; // next slot to read, written by the consumer
+	alignas(64) std::atomic<size_t> m_tail = 0; // next slot to write, written by the producer
+};
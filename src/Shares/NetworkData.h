@@ -1,9 +1,11 @@
 #pragma once
 
 #include <string>
+#include <memory>
 #include <thread>
 #include <mutex>
 #include <vector>
+#include <algorithm>
 
 enum ClientErrorActionBits {
 	eTERMINATE_CLIENT = 0x1,
@@ -16,19 +18,151 @@ struct ClientError {
 	std::string description = "No error description available";
 };
 
+enum ConnectState {
+	eCONNECT_IDLE,
+	eCONNECT_RESOLVING,
+	eCONNECT_CONNECTING,
+	eCONNECT_CONNECTED,
+	eCONNECT_FAILED
+};
+
+struct RoomInfo {
+	uint32_t id = 0;
+	std::string name = "";
+	uint32_t players = 0;
+	uint32_t maxPlayers = 0;
+};
+
+struct RoomStats {
+	RoomInfo info = {};
+	uint64_t ticks = 0;
+	uint64_t packetsReceived = 0;
+	uint64_t packetsSent = 0;
+	uint64_t bytesSent = 0;
+	uint64_t updatesDeferred = 0; // entity updates that didn't fit into the bandwidth budget of a client
+	uint64_t streamBytesRaw = 0; // stream bytes before compression
+	uint64_t streamBytesSent = 0;
+	float compressTime = 0; // total seconds spent compressing
+	float tickDuration = 0; // average duration of the last ticks in seconds
+	uint64_t movesCoalesced = 0; // moves replaced by a newer move of the same player before the room handled them
+};
+
+// packets the server dropped because a client exceeded its ingress budget
+struct IngressStats {
+	uint64_t movesThrottled = 0;
+	uint64_t raysThrottled = 0;
+	uint64_t eventsThrottled = 0; // damage, spawn and death packets
+	uint64_t controlThrottled = 0; // connect and room packets
+	uint64_t clientsThrottled = 0; // clients that exceeded a budget at least once
+};
+
+// a room of any server, as listed by the matchmaking directory
+struct DirectoryRoom {
+	std::string address = ""; // of the server hosting the room
+	std::string port = "";
+	std::string region = "";
+	RoomInfo info = {};
+};
+
+// counts latencies in power of two buckets of microseconds
+// bucket i holds [2^i, 2^(i+1)) us, bucket 0 also everything below 1us
+struct LatencyHistogram {
+	static const uint32_t bucketCount = 24;
+	uint64_t buckets[bucketCount] = {};
+	uint64_t count = 0;
+	uint64_t max = 0; // microseconds
+
+	void add(uint64_t microseconds) {
+		uint32_t bucket = 0;
+		while (bucket < bucketCount - 1 && (microseconds >> (bucket + 1)) != 0)
+			bucket++;
+		buckets[bucket]++;
+		count++;
+		max = std::max(max, microseconds);
+	}
+
+	// the upper bound in microseconds of the bucket that contains the given fraction of the samples, e.g. 0.99
+	uint64_t percentile(float fraction) const {
+		uint64_t target = static_cast<uint64_t>(fraction * count);
+		uint64_t sum = 0;
+		for (uint32_t i = 0; i < bucketCount; i++) {
+			sum += buckets[i];
+			if (sum > target || sum == count)
+				return std::min(uint64_t(2) << i, max);
+		}
+		return max;
+	}
+};
+
+// the players connected to the server, never changed after it's published
+struct ServerRoster {
+	uint64_t version = 0; // increases with every published roster
+	std::vector<std::string> players = {};
+};
+
 struct NetworkData {
 	std::mutex mNetwork;
 	std::string username = "user"; // this username serves as an id for the client
 	std::string port = "12525";
 	std::string ip = "zap.internet-box.ch";
+	std::string capturePath = ""; // when set all traffic of the client and server is recorded into this file
+	std::string directoryIp = ""; // the matchmaking directory the server registers its rooms at and clients search, empty doesn't use one
+	std::string directoryPort = "12526";
+	std::string region = "eu"; // the region the server lists its rooms in at the directory
+	std::string publicAddress = ""; // the address clients reach the server at, empty uses the address the directory sees
+
+	uint32_t roomId = 0; // the room the client joins, 0 joins the default room of the server
+	std::string roomName = "Room"; // name of the default room when hosting
+	int connectTimeout = 5000; // milliseconds until connecting to the server fails
+	int resolveCacheTime = 60000; // milliseconds a resolved server address is reused
+	bool streamCompression = false; // asks the server to compress the stream it sends
+	bool kernelTimestamps = false; // the kernel timestamps received dgrams to measure how long they wait in the socket buffer, linux only
+	int peerTimeout = 10000; // milliseconds without any packet until the client gives up on the server and the server on a client
+	bool spectate = false; // the client watches room roomId through the spectator relay at ip and port instead of playing
 
 	std::mutex mClient;
 
 	std::vector<ClientError> clientErrorStack = {};
+	ConnectState connectState = eCONNECT_IDLE;
+	std::string connectStatus = ""; // describes the current connect step for the interface
+	std::vector<RoomInfo> roomList = {}; // the rooms last received from the server
+	std::string directoryStatus = ""; // describes the last directory query for the interface
 
-	std::mutex mServer;
-	std::vector<std::string> playerList;
+	// published by the server thread with std::atomic_store, read with std::atomic_load so readers never block the server
+	std::shared_ptr<const ServerRoster> spRoster = nullptr; // republished when a player joins or leaves
+	std::shared_ptr<const std::vector<RoomStats>> spRoomStats = nullptr; // republished a few times per second
+	std::shared_ptr<const std::vector<DirectoryRoom>> spDirectoryRooms = nullptr; // the answer to the last directory query, published by the query thread
+	std::shared_ptr<const IngressStats> spIngressStats = nullptr; // republished with the room stats
+	std::shared_ptr<const LatencyHistogram> spWakeLatency = nullptr; // how late the server network thread noticed work, republished with the room stats
+	// microseconds from the kernel receiving a dgram until the application reads it, only with kernelTimestamps
+	std::shared_ptr<const LatencyHistogram> spServerRxDelay = nullptr; // republished with the room stats
+	std::shared_ptr<const LatencyHistogram> spClientRxDelay = nullptr; // republished by the client a few times per second
 
 	// server specific
 	const int backlog = 10;
+	uint32_t serverWorkerCount = 0; // threads ticking the rooms, 0 uses one per hardware thread
+	float serverTickRate = 64; // room ticks per second
+	uint32_t maxRooms = 64;
+	uint32_t maxRoomPlayers = 32;
+	float clientBandwidth = 64 * 1024; // bytes per second the server sends to each client at most
+	bool allowStreamCompression = true; // compress the stream for clients that ask for it
+	int heartbeatInterval = 1000; // milliseconds between the heartbeats the server sends to each client
+	bool serverBusyPoll = false; // the network thread spins on its sockets instead of sleeping in poll, lowers latency but keeps a core busy
+	int serverBusyPollTime = 50; // microseconds the kernel polls the device for each socket read in busy poll mode, SO_BUSY_POLL on linux
+	int serverCore = -1; // core the server network thread is pinned to, -1 doesn't pin
+	int hostGameCore = -1; // when hosting, the game thread is pinned to this core and the server threads avoid it, -1 doesn't pin
+	// packets per second the server accepts from each client, a client may send one second worth at once
+	// the host isn't limited
+	float ingressMoveRate = 128;
+	float ingressRayRate = 20;
+	float ingressEventRate = 50; // damage, spawn and death packets
+	float ingressControlRate = 5; // connect and room packets
+	std::string statsPath = "playerstats.dat"; // the server keeps the kills, deaths and damage of every username in this file, empty doesn't keep them
+	std::string metricsPort = ""; // the server serves prometheus metrics at http://127.0.0.1:<port>/metrics, empty disables it
+	std::string relayIp = ""; // the spectator relay the server streams its rooms to, empty doesn't stream, see Tools/Relay.cpp
+	std::string relayPort = "12527";
+	int spectatorDelay = 10000; // milliseconds the spectator stream lags behind the match
+	float spectatorRate = 20; // spectator frames per second of each room
+	int keyframeInterval = 5000; // milliseconds between the keyframes spectators join from
+	int udpConnectRetransmit = 250; // milliseconds until the first repeat of the udp connect packet for a client whose dgrams didn't arrive yet, doubles with every try
 };
\ No newline at end of file
@@ -3,13 +3,26 @@
 #include "glm.hpp"
 
 #include <string>
+#include <cstring>
+
+#if defined(__AVX2__) // vector extensions used for bulk endian conversion
+#include <immintrin.h>
+#define SOCK_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOCK_SIMD_SSE2
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define SOCK_BIG_ENDIAN // network order equals host order, no swapping needed
+#endif
 
 #ifdef _WIN32 // windows specific socket include
 
 #include <WinSock2.h>
 #include <WS2tcpip.h>
 
-#elif __linux__
+#else // posix
 
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -18,6 +31,14 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <poll.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <ctime>
+#if defined(__linux__) // kernel timestamps and segmentation offload, only used where __linux__ is checked too
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include <netinet/udp.h>
+#endif
 
 typedef in_addr IN_ADDR;
 typedef in6_addr IN6_ADDR;
@@ -28,7 +49,7 @@ namespace sock {
 	inline int closeSocket(int socket) {
 #ifdef _WIN32
 		return closesocket(socket);
-#elif __linux__
+#else
 		return close(socket);
 #endif
 	}
@@ -36,46 +57,242 @@ namespace sock {
 	inline int pollState(pollfd fds[], size_t nfds, int timeout) {
 #ifdef _WIN32
 		return WSAPoll(fds, nfds, timeout);
-#elif __linux__
+#else
 		return poll(fds, nfds, timeout);
 #endif
 	}
 
+	// lets the kernel busy poll the device queue for up to the given microseconds when the socket has no data yet
+	// returns -1 on failure or where SO_BUSY_POLL isn't supported
+	inline int setBusyPoll(int socket, int microseconds) {
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+		return setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, &microseconds, sizeof microseconds);
+#else
+		return -1;
+#endif
+	}
+
+	// lets the kernel timestamp received dgrams in software, read the timestamps with recvFromTimestamped
+	// returns -1 on failure or where SO_TIMESTAMPING isn't supported
+	inline int enableRxTimestamps(int socket) {
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+		int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+		return setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof flags);
+#else
+		return -1;
+#endif
+	}
+
+	// recvfrom that also returns when the kernel received the dgram, in nanoseconds since the epoch of std::chrono::system_clock
+	// timestamp is 0 if the socket has no rx timestamps enabled
+	inline int recvFromTimestamped(int socket, char* buf, int len, int flags, sockaddr* addr, int* addrlen, int64_t& timestamp) {
+		timestamp = 0;
+#if defined(__linux__) && defined(SO_TIMESTAMPING)
+		iovec iov;
+		iov.iov_base = buf;
+		iov.iov_len = len;
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(scm_timestamping))];
+		msghdr msg = {};
+		msg.msg_name = addr;
+		msg.msg_namelen = *addrlen;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof control;
+		int bytesRead = recvmsg(socket, &msg, flags);
+		if (bytesRead < 0)
+			return bytesRead;
+		*addrlen = msg.msg_namelen;
+		for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+				scm_timestamping stamps;
+				memcpy(&stamps, CMSG_DATA(cmsg), sizeof stamps);
+				timestamp = static_cast<int64_t>(stamps.ts[0].tv_sec) * 1000000000 + stamps.ts[0].tv_nsec; // ts[0] is the software timestamp
+			}
+		}
+		return bytesRead;
+#elif defined(_WIN32)
+		return recvfrom(socket, buf, len, flags, addr, addrlen);
+#else
+		socklen_t socklen = *addrlen;
+		int bytesRead = recvfrom(socket, buf, len, flags, addr, &socklen);
+		*addrlen = socklen;
+		return bytesRead;
+#endif
+	}
+
+	// sends buf as dgrams of segmentSize bytes with one call, the last dgram may be shorter
+	// the kernel or the network device splits the buffer (generic segmentation offload)
+	// returns the bytes sent or -1 on failure, also where UDP_SEGMENT isn't supported, isUnsupported is true then
+	inline int sendSegments(int socket, const char* buf, int len, const sockaddr* addr, int addrlen, uint16_t segmentSize) {
+#if defined(__linux__) && defined(UDP_SEGMENT)
+		iovec iov;
+		iov.iov_base = const_cast<char*>(buf);
+		iov.iov_len = len;
+		alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint16_t))] = {};
+		msghdr msg = {};
+		msg.msg_name = const_cast<sockaddr*>(addr);
+		msg.msg_namelen = addrlen;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof control;
+		cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = IPPROTO_UDP;
+		cmsg->cmsg_type = UDP_SEGMENT;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+		memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof segmentSize);
+		return sendmsg(socket, &msg, 0);
+#elif defined(_WIN32)
+		WSASetLastError(WSAEOPNOTSUPP);
+		return -1;
+#else
+		errno = EOPNOTSUPP;
+		return -1;
+#endif
+	}
+
+	// returns -1 on failure
+	inline int setBlocking(int socket, bool blocking) {
+#ifdef _WIN32
+		u_long mode = blocking ? 0 : 1;
+		return ioctlsocket(socket, FIONBIO, &mode);
+#else
+		int flags = fcntl(socket, F_GETFL, 0);
+		if (flags < 0)
+			return -1;
+		return fcntl(socket, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+#endif
+	}
+
+	// returns true if the last connect on a non-blocking socket is still in progress
+	inline bool isConnectPending() {
+#ifdef _WIN32
+		return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+		return errno == EINPROGRESS;
+#endif
+	}
+
+	// returns true if the last call failed because the socket, the kernel or the device doesn't support what was asked
+	// other errors like full buffers or unreachable peers pass, the call may succeed next time
+	inline bool isUnsupported() {
+#ifdef _WIN32
+		int error = WSAGetLastError();
+		return error == WSAEINVAL || error == WSAEOPNOTSUPP || error == WSAENOPROTOOPT;
+#else
+		return errno == EINVAL || errno == EOPNOTSUPP || errno == ENOPROTOOPT || errno == EIO; // EIO if the device can't checksum the segments
+#endif
+	}
+
+	// returns true if the last send or recv on a non-blocking socket failed only because it would have blocked
+	inline bool wouldBlock() {
+#ifdef _WIN32
+		return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+		return errno == EWOULDBLOCK || errno == EAGAIN;
+#endif
+	}
+
+	// returns the pending error of the socket, e.g. the result of a non-blocking connect
+	inline int socketError(int socket) {
+		int error = 0;
+		socklen_t len = sizeof(error);
+		if (getsockopt(socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &len) < 0)
+			return -1;
+		return error;
+	}
+
+	// swaps the byte order of count 32 bit words from src into dst
+	// src and dst may be the same buffer, neither has to be aligned
+	inline void swapBytes32(const void* src, void* dst, size_t count) {
+#ifdef SOCK_BIG_ENDIAN
+		if (src != dst)
+			memmove(dst, src, count * sizeof(uint32_t));
+#else
+		const char* srcBytes = reinterpret_cast<const char*>(src);
+		char* dstBytes = reinterpret_cast<char*>(dst);
+		size_t i = 0;
+#if defined(SOCK_SIMD_AVX2)
+		const __m256i shuffle = _mm256_setr_epi8(
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+		for (; i + 8 <= count; i += 8) { // 8 words per iteration
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcBytes + i * sizeof(uint32_t)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dstBytes + i * sizeof(uint32_t)), _mm256_shuffle_epi8(v, shuffle));
+		}
+#elif defined(SOCK_SIMD_SSE2)
+		for (; i + 4 <= count; i += 4) { // 4 words per iteration, sse2 has no byte shuffle so swap the 16 bit halves first
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcBytes + i * sizeof(uint32_t)));
+			v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+			v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dstBytes + i * sizeof(uint32_t)), v);
+		}
+#endif
+		for (; i < count; i++) { // scalar fallback and remainder
+			uint32_t word;
+			memcpy(&word, srcBytes + i * sizeof(uint32_t), sizeof(uint32_t));
+			word = htonl(word);
+			memcpy(dstBytes + i * sizeof(uint32_t), &word, sizeof(uint32_t));
+		}
+#endif // SOCK_BIG_ENDIAN
+	}
+
 	// host network conversion
+	// htonf and ntohf only exist in winsock, these work everywhere
+	inline uint32_t htonFloat(float value) {
+		uint32_t word;
+		memcpy(&word, &value, sizeof(uint32_t));
+		return htonl(word);
+	}
+
+	inline float ntohFloat(uint32_t nValue) {
+		uint32_t word = ntohl(nValue);
+		float value;
+		memcpy(&value, &word, sizeof(float));
+		return value;
+	}
+
+	// bulk versions convert whole arrays in one call, nData needs count times the size of the element
+	inline void htonFloats(const float* floats, void* nData, size_t count) {
+		swapBytes32(floats, nData, count);
+	}
+
+	inline void ntohFloats(const void* nData, float* floats, size_t count) {
+		swapBytes32(nData, floats, count);
+	}
+
+	// glm stores matrices column major without padding, the wire format is the same column major order
+	inline void htonMat4Array(const glm::mat4* mat4s, void* nData, size_t count) {
+		htonFloats(reinterpret_cast<const float*>(mat4s), nData, count * 16);
+	}
+
+	inline void ntohMat4Array(const void* nData, glm::mat4* mat4s, size_t count) {
+		ntohFloats(nData, reinterpret_cast<float*>(mat4s), count * 16);
+	}
+
+	inline void htonVec3Array(const glm::vec3* vec3s, void* nData, size_t count) {
+		htonFloats(reinterpret_cast<const float*>(vec3s), nData, count * 3);
+	}
+
+	inline void ntohVec3Array(const void* nData, glm::vec3* vec3s, size_t count) {
+		ntohFloats(nData, reinterpret_cast<float*>(vec3s), count * 3);
+	}
+
 	inline void htonMat4(const glm::mat4& mat4, void* nData) {
-		uint32_t* buf = reinterpret_cast<uint32_t*>(nData);
-		for (size_t i = 0; i < 16; i += 1) {
-			uint32_t nf = htonf(mat4[floor(i / 4)][i % 4]);
-			buf[i] = nf;
-		}
+		htonMat4Array(&mat4, nData, 1);
 	}
 
 	inline void ntohMat4(const void* nData, glm::mat4& mat4) {
-		const uint32_t* buf = reinterpret_cast<const uint32_t*>(nData);
-		for (size_t i = 0; i < 16; i += 1) {
-			float hf = ntohf(buf[i]);
-			mat4[floor(i / 4)][i % 4] = hf;
-		}
+		ntohMat4Array(nData, &mat4, 1);
 	}
 
 	inline void htonVec3(const glm::vec3& vec3, void* nData) {
-		uint32_t* buf = reinterpret_cast<uint32_t*>(nData);
-		uint32_t nx = htonf(vec3.x);
-		buf[0] = nx;
-		uint32_t ny = htonf(vec3.y);
-		buf[1] = ny;
-		uint32_t nz = htonf(vec3.z);
-		buf[2] = nz;
+		htonVec3Array(&vec3, nData, 1);
 	}
 
 	inline void ntohVec3(const void* nData, glm::vec3& vec3) {
-		const uint32_t* buf = reinterpret_cast<const uint32_t*>(nData);
-		float hx = ntohf(buf[0]);
-		vec3.x = hx;
-		float hy = ntohf(buf[1]);
-		vec3.y = hy;
-		float hz = ntohf(buf[2]);
-		vec3.z = hz;
+		ntohVec3Array(nData, &vec3, 1);
 	}
 
 	inline void htonAddr(const sockaddr_storage& addr, void* nData) {
@@ -147,7 +364,7 @@ namespace sock {
 	inline int lastError() {
 #ifdef _WIN32
 		return WSAGetLastError();
-#elif __linux__
+#else
 		return errno;
 #endif
 	}
@@ -160,8 +377,25 @@ namespace sock {
 			MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),
 			(LPSTR)&s, 0, NULL);
 		fprintf(stderr, "%s: %s\n", msg, s);
-#elif __linux__
+#else
 		perror(msg);
 #endif
 	}
 }
+
+struct SocketData { // combine the socket and its address into one type, cause they're always needed when using both tcp and udp.
+	int stream;
+	int dgram;
+	sockaddr_storage addr; // the udp address
+
+	sockaddr* getAddr() {
+		return reinterpret_cast<sockaddr*>(&addr);
+	}
+
+	// returns 0 if equal
+	int compAddr(const SocketData& socket) {
+		auto* saa = reinterpret_cast<const sockaddr*>(&addr);
+		auto* sab = reinterpret_cast<const sockaddr*>(&socket.addr);
+		return sock::cmpAddr(saa, sab);
+	}
+};
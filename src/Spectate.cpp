@@ -0,0 +1,177 @@
+#include "Spectate.h"
+
+#include "SockUitls.h"
+#include "Conditioner.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <algorithm>
+#include <stdio.h>
+
+namespace spectate {
+	typedef std::chrono::steady_clock Clock;
+
+	const Clock::duration _reconnectInterval = std::chrono::seconds(5);
+	const int _connectTimeout = 2000; // milliseconds
+	const size_t _maxQueuedBytes = 64 * 1024 * 1024; // frames beyond this are dropped, the relay waits for the next keyframe of the room
+
+	struct QueuedFrame {
+		Clock::time_point due;
+		PackedPacket spPacked;
+	};
+
+	std::mutex _mQueue; // guards the queue and starting and stopping
+	std::condition_variable _cvQueue;
+	std::deque<QueuedFrame> _queue = {}; // ordered by due time, all frames have the same delay
+	size_t _queuedBytes = 0;
+	bool _stop = false;
+	bool _reportedFull = false;
+	std::thread _thread;
+	std::atomic<bool> _isEnabled = false;
+	Clock::duration _delay = {};
+
+	void closeSocket(int socket) {
+		conditioner::forgetSocket(socket);
+		sock::closeSocket(socket);
+	}
+
+	// connects without blocking longer than _connectTimeout
+	// returns the socket or -1 on failure
+	int connectStream(std::string ip, std::string port) {
+		addrinfo hints = {};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo* info;
+		int status;
+		if ((status = getaddrinfo(ip.c_str(), port.c_str(), &hints, &info)) != 0) {
+			fprintf(stderr, "relay getaddrinfo: %s\n", gai_strerror(status));
+			return -1;
+		}
+		int socketFd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+		if (socketFd < 0) {
+			sock::printLastError("relay socket");
+			freeaddrinfo(info);
+			return -1;
+		}
+		sock::setBlocking(socketFd, false);
+		int result = connect(socketFd, info->ai_addr, info->ai_addrlen);
+		bool failed = result < 0 && !sock::isConnectPending();
+		freeaddrinfo(info);
+		pollfd pfd = { socketFd, POLLOUT, 0 };
+		if (failed || (result < 0 && sock::pollState(&pfd, 1, _connectTimeout) <= 0) || sock::socketError(socketFd) != 0) {
+			closeSocket(socketFd);
+			return -1;
+		}
+		sock::setBlocking(socketFd, true);
+		return socketFd;
+	}
+
+	void sendLoop(std::string ip, std::string port) {
+		int socketFd = -1;
+		Clock::time_point nextConnect = {};
+		bool reportedFailure = false;
+
+		std::unique_lock<std::mutex> lk(_mQueue);
+		while (!_stop) {
+			if (_queue.empty()) {
+				_cvQueue.wait(lk);
+				continue;
+			}
+			if (_queue.front().due > Clock::now()) {
+				_cvQueue.wait_until(lk, _queue.front().due);
+				continue;
+			}
+			PackedPacket spPacked = _queue.front().spPacked;
+			_queuedBytes -= spPacked->size();
+			_queue.pop_front();
+			lk.unlock();
+
+			if (socketFd < 0 && Clock::now() >= nextConnect) { // frames are dropped while the relay is away
+				socketFd = connectStream(ip, port);
+				nextConnect = Clock::now() + _reconnectInterval;
+				if (socketFd >= 0) {
+					printf("streaming spectators to the relay %s:%s\n", ip.c_str(), port.c_str());
+					reportedFailure = false;
+				}
+				else if (!reportedFailure) {
+					printf("could not reach the relay %s:%s, retrying\n", ip.c_str(), port.c_str());
+					reportedFailure = true;
+				}
+			}
+			if (socketFd >= 0 && Packet::sendBuffer(socketFd, spPacked->data(), spPacked->size()) == 0) {
+				printf("lost the relay, reconnecting\n");
+				closeSocket(socketFd);
+				socketFd = -1;
+			}
+			lk.lock();
+		}
+		if (socketFd >= 0)
+			closeSocket(socketFd);
+	}
+
+	void start(NetworkData& network) {
+		std::string ip;
+		std::string port;
+		Clock::duration delay;
+		{
+			std::lock_guard<std::mutex> lk(network.mNetwork);
+			if (network.relayIp.empty())
+				return;
+			ip = network.relayIp;
+			port = network.relayPort;
+			delay = std::chrono::milliseconds(std::max(network.spectatorDelay, 0));
+		}
+		std::lock_guard<std::mutex> lk(_mQueue);
+		if (_thread.joinable())
+			return;
+		_delay = delay;
+		_stop = false;
+		_reportedFull = false;
+		_isEnabled = true;
+		_thread = std::thread(sendLoop, ip, port);
+	}
+
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lk(_mQueue);
+			if (!_thread.joinable())
+				return;
+			_stop = true;
+			_isEnabled = false;
+		}
+		_cvQueue.notify_all();
+		_thread.join();
+		_queue.clear();
+		_queuedBytes = 0;
+	}
+
+	bool isEnabled() {
+		return _isEnabled.load(std::memory_order_relaxed);
+	}
+
+	void push(SpectatorFramePacket& frame) {
+		PackedPacket spPacked = frame.packShared(); // outside the lock, rooms of all workers push
+		bool wasEmpty;
+		{
+			std::lock_guard<std::mutex> lk(_mQueue);
+			if (!_isEnabled)
+				return;
+			if (_queuedBytes + spPacked->size() > _maxQueuedBytes) {
+				if (!_reportedFull) {
+					printf("the spectator stream is falling behind, dropping frames\n");
+					_reportedFull = true;
+				}
+				return;
+			}
+			wasEmpty = _queue.empty();
+			_queue.push_back({ Clock::now() + _delay, spPacked });
+			_queuedBytes += spPacked->size();
+		}
+		if (wasEmpty) // otherwise the sender already waits for an earlier frame
+			_cvQueue.notify_one();
+	}
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "Shares/NetworkData.h"
+#include "Objects/Packets.h"
+
+// the spectator stream of the server, rooms hand their frames over and a thread sends them to the relay once they are old enough
+// the relay is set with network.relayIp and network.relayPort, see Tools/Relay.cpp
+namespace spectate {
+	// starts the sending thread, does nothing without a relay
+	// reconnects when the relay goes away, every room starts again with its next keyframe
+	void start(NetworkData& network);
+
+	void stop();
+
+	// true while the stream runs, rooms only build frames then
+	bool isEnabled();
+
+	// queues the frame until network.spectatorDelay passed, can be called from any thread
+	void push(SpectatorFramePacket& frame);
+}
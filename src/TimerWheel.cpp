@@ -0,0 +1,119 @@
+#include "TimerWheel.h"
+
+#include <algorithm>
+
+TimerWheel::TimerWheel() {
+	std::fill(std::begin(m_heads), std::end(m_heads), -1);
+}
+
+TimerWheel::TimerId TimerWheel::schedule(uint64_t delay, std::function<void()> callback) {
+	uint32_t index;
+	if (!m_free.empty()) {
+		index = m_free.back();
+		m_free.pop_back();
+	}
+	else {
+		index = static_cast<uint32_t>(m_timers.size());
+		m_timers.push_back({});
+		m_timers.back().generation = 1;
+	}
+
+	Timer& timer = m_timers[index];
+	timer.due = m_tick + std::clamp<uint64_t>(delay, 1, _maxDelay);
+	timer.callback = std::move(callback);
+	timer.pending = true;
+	insert(index);
+	m_size++;
+	return (static_cast<uint64_t>(timer.generation) << 32) | index;
+}
+
+void TimerWheel::cancel(TimerId id) {
+	uint32_t index = static_cast<uint32_t>(id);
+	if (id == 0 || index >= m_timers.size())
+		return;
+	Timer& timer = m_timers[index];
+	if (!timer.pending || timer.generation != static_cast<uint32_t>(id >> 32))
+		return;
+	unlink(index);
+	release(index);
+}
+
+void TimerWheel::advance(uint64_t tick) {
+	while (m_tick < tick) {
+		m_tick++;
+		for (uint32_t level = _levels - 1; level > 0; level--) // move the timers of the higher levels down when the lower levels wrapped
+			if ((m_tick & ((uint64_t(1) << (level * _slotBits)) - 1)) == 0)
+				cascade(level);
+
+		int32_t& head = m_heads[m_tick & (_slots - 1)];
+		while (head >= 0) {
+			uint32_t index = head;
+			unlink(index);
+			std::function<void()> callback = std::move(m_timers[index].callback);
+			release(index);
+			callback(); // may insert into this slot only for later ticks, so the loop ends
+		}
+	}
+}
+
+void TimerWheel::clear() {
+	m_timers.clear();
+	m_free.clear();
+	std::fill(std::begin(m_heads), std::end(m_heads), -1);
+	m_tick = 0;
+	m_size = 0;
+}
+
+uint64_t TimerWheel::getTick() {
+	return m_tick;
+}
+
+size_t TimerWheel::size() {
+	return m_size;
+}
+
+void TimerWheel::insert(uint32_t index) {
+	Timer& timer = m_timers[index];
+	uint32_t level = 0;
+	while (level < _levels - 1 && (timer.due ^ m_tick) >> ((level + 1) * _slotBits)) // the lowest level whose current rotation contains the due tick
+		level++;
+	timer.slot = level * _slots + ((timer.due >> (level * _slotBits)) & (_slots - 1));
+
+	timer.prev = -1;
+	timer.next = m_heads[timer.slot];
+	if (timer.next >= 0)
+		m_timers[timer.next].prev = index;
+	m_heads[timer.slot] = index;
+}
+
+void TimerWheel::unlink(uint32_t index) {
+	Timer& timer = m_timers[index];
+	if (timer.prev >= 0)
+		m_timers[timer.prev].next = timer.next;
+	else
+		m_heads[timer.slot] = timer.next;
+	if (timer.next >= 0)
+		m_timers[timer.next].prev = timer.prev;
+	timer.prev = -1;
+	timer.next = -1;
+}
+
+void TimerWheel::release(uint32_t index) {
+	Timer& timer = m_timers[index];
+	timer.pending = false;
+	timer.callback = nullptr;
+	timer.generation++;
+	m_free.push_back(index);
+	m_size--;
+}
+
+void TimerWheel::cascade(uint32_t level) {
+	uint32_t slot = level * _slots + ((m_tick >> (level * _slotBits)) & (_slots - 1));
+	int32_t index = m_heads[slot];
+	m_heads[slot] = -1;
+	while (index >= 0) {
+		int32_t next = m_timers[index].next;
+		insert(index);
+		index = next;
+	}
+}
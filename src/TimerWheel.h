@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// hierarchical timer wheel, scheduling, cancelling and advancing by one tick cost O(1)
+// 4 levels of 64 slots, level 0 holds timers due in the current 64 ticks, every higher level covers 64 times the range of the one below
+// when the lower levels wrap around, the timers of the next slot of the higher level are moved down
+class TimerWheel {
+public:
+	typedef uint64_t TimerId; // 0 is never a valid id
+
+	TimerWheel();
+
+	// runs callback when the wheel advanced delay ticks, at least 1
+	// delays beyond the range of the wheel are clamped
+	TimerId schedule(uint64_t delay, std::function<void()> callback);
+
+	// does nothing if the timer already fired or was cancelled
+	void cancel(TimerId id);
+
+	// fires all timers due up to and including tick, callbacks may schedule and cancel timers
+	void advance(uint64_t tick);
+
+	// drops all timers without firing them and starts again at tick 0
+	void clear();
+
+	uint64_t getTick();
+
+	// the number of pending timers
+	size_t size();
+
+private:
+	static constexpr uint32_t _levels = 4;
+	static constexpr uint32_t _slotBits = 6;
+	static constexpr uint32_t _slots = 1 << _slotBits;
+	static constexpr uint64_t _maxDelay = (uint64_t(1) << (_levels * _slotBits)) - 1;
+
+	struct Timer {
+		uint64_t due = 0;
+		std::function<void()> callback;
+		uint32_t generation = 0; // increased when the timer is freed, so old ids don't match reused timers
+		bool pending = false;
+		uint32_t slot = 0; // level * _slots + slot index
+		int32_t prev = -1;
+		int32_t next = -1;
+	};
+
+	std::vector<Timer> m_timers = {};
+	std::vector<uint32_t> m_free = {};
+	int32_t m_heads[_levels * _slots]; // first timer of every slot, -1 if empty
+	uint64_t m_tick = 0;
+	size_t m_size = 0;
+
+	void insert(uint32_t index);
+	void unlink(uint32_t index);
+	void release(uint32_t index);
+	void cascade(uint32_t level);
+};
@@ -0,0 +1,260 @@
+// measures the hot paths of the network layer in isolation
+// usage:
+//   VODBench [seconds per case]
+// every case runs for the given time, 1 second by default, and prints its rate
+// build it optimized, the numbers of a debug build say nothing
+
+#include "SockUitls.h"
+#include "Objects/Packets.h"
+#include "Objects/Replica.h"
+
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstdlib>
+
+typedef std::chrono::steady_clock Clock;
+
+double _seconds = 1;
+volatile uint32_t _sink = 0; // results are folded into it so the compiler can't drop the work
+
+// calls run until the time of a case is up and prints how often it ran
+// run returns the units it processed, e.g. bytes or packets
+template<class F>
+void bench(const char* name, const char* unit, F run) {
+	run(); // warm up caches and allocations
+	uint64_t calls = 0;
+	uint64_t units = 0;
+	auto start = Clock::now();
+	auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(_seconds));
+	auto now = start;
+	while (now < end) {
+		for (int i = 0; i < 64; i++, calls++) // reading the clock less often
+			units += run();
+		now = Clock::now();
+	}
+	double elapsed = std::chrono::duration<double>(now - start).count();
+	printf("%-32s %12.0f calls/s %12.1f M%s/s %10.1f ns/call\n", name, calls / elapsed, units / elapsed / 1e6, unit, elapsed * 1e9 / calls);
+}
+
+// Byte swap
+
+void benchByteSwap() {
+	const size_t count = 64 * 16; // the transforms of 64 players
+	std::vector<float> floats(count);
+	for (size_t i = 0; i < count; i++)
+		floats[i] = i * 0.25f;
+	std::vector<char> nData(count * sizeof(float));
+
+	bench("swap scalar htonl", "B", [&]() {
+		for (size_t i = 0; i < count; i++) {
+			uint32_t word;
+			memcpy(&word, &floats[i], sizeof(uint32_t));
+			word = htonl(word);
+			memcpy(nData.data() + i * sizeof(uint32_t), &word, sizeof(uint32_t));
+		}
+		_sink += nData.back();
+		return count * sizeof(float);
+	});
+	bench("swap sock::htonFloats", "B", [&]() {
+		sock::htonFloats(floats.data(), nData.data(), count);
+		_sink += nData.back();
+		return count * sizeof(float);
+	});
+#if defined(SOCK_SIMD_AVX2)
+	printf("(swapBytes32 uses avx2)\n");
+#elif defined(SOCK_SIMD_SSE2)
+	printf("(swapBytes32 uses sse2)\n");
+#else
+	printf("(swapBytes32 is scalar)\n");
+#endif
+}
+
+// Bit packing
+
+// the states of a full room with every field set, as a full snapshot sends them
+std::vector<ReplicatedState> makeStates(size_t count) {
+	std::vector<ReplicatedState> states(count);
+	for (size_t i = 0; i < count; i++) {
+		glm::mat4 transform(1);
+		transform[3][0] = i * 1.5f;
+		transform[3][1] = 2.0f;
+		transform[3][2] = i * -0.75f;
+		ReplicatedValue alive, moved, health, energy;
+		alive.integer = 1;
+		moved.transform = transform;
+		health.number = 100.0f - i;
+		energy.number = i * 0.5f;
+		states[i].set(eFIELD_ALIVE, alive);
+		states[i].set(eFIELD_TRANSFORM, moved);
+		states[i].set(eFIELD_HEALTH, health);
+		states[i].set(eFIELD_ENERGY, energy);
+	}
+	return states;
+}
+
+// packs the states with a BitWriter and reads them back with a BitReader
+// for comparison the same fields as 32 bit words, the way the packets without a BitWriter send them
+void benchBitPacking() {
+	const size_t count = 64;
+	const size_t words = 1 + 12 + 2; // alive, the transform without its bottom row, health and energy
+	std::vector<ReplicatedState> states = makeStates(count);
+	BitWriter counter;
+	for (auto& state : states)
+		state.write(counter);
+	std::vector<char> buf(counter.byteCount());
+	std::vector<char> wordBuf(count * words * sizeof(uint32_t));
+
+	bench("pack states as words", "states", [&]() {
+		char* dst = wordBuf.data();
+		for (auto& state : states) {
+			uint32_t alive = htonl(state.values[eFIELD_ALIVE].integer);
+			memcpy(dst, &alive, sizeof(uint32_t));
+			dst += sizeof(uint32_t);
+			const glm::mat4& transform = state.values[eFIELD_TRANSFORM].transform;
+			for (int column = 0; column < 4; column++)
+				for (int row = 0; row < 3; row++) {
+					uint32_t word = sock::htonFloat(transform[column][row]);
+					memcpy(dst, &word, sizeof(uint32_t));
+					dst += sizeof(uint32_t);
+				}
+			float stats[2] = { state.values[eFIELD_HEALTH].number, state.values[eFIELD_ENERGY].number };
+			sock::htonFloats(stats, dst, 2);
+			dst += sizeof(stats);
+		}
+		_sink += wordBuf.back();
+		return count;
+	});
+	bench("pack states with BitWriter", "states", [&]() {
+		BitWriter writer(buf.data());
+		for (auto& state : states)
+			state.write(writer);
+		_sink += buf.back();
+		return count;
+	});
+	bench("unpack states with BitReader", "states", [&]() {
+		BitReader reader(buf.data(), buf.size());
+		ReplicatedState state;
+		for (size_t i = 0; i < count; i++)
+			state.read(reader);
+		_sink += state.mask;
+		return count;
+	});
+	printf("(%zu bytes per state as words, %.1f with BitWriter)\n", words * sizeof(uint32_t), static_cast<double>(buf.size()) / count);
+}
+
+// Replica collect
+
+// the replicated fields of a player, registered like the player registers its own
+struct BenchPlayer {
+	bool alive = true;
+	glm::mat4 transform = glm::mat4(1);
+	float health = 100;
+	float energy = 50;
+	Replica replica;
+
+	BenchPlayer() {
+		replica.addBool(eFIELD_ALIVE, [this]() { return alive; }, [this](bool value) { alive = value; });
+		replica.addTransform(eFIELD_TRANSFORM, [this]() { return transform; }, [this](glm::mat4 value) { transform = value; });
+		replica.addFloat(eFIELD_HEALTH, [this]() { return health; }, [this](float value) { health = value; });
+		replica.addFloat(eFIELD_ENERGY, [this]() { return energy; }, [this](float value) { energy = value; });
+	}
+};
+
+// collects the replicas of a full room, once unchanged, once with every player moving and once everything
+void benchReplicaCollect() {
+	const size_t count = 64;
+	std::vector<BenchPlayer> players(count);
+	uint32_t step = 0;
+
+	bench("collect unchanged", "replicas", [&]() {
+		for (auto& player : players)
+			_sink += player.replica.collect().mask;
+		return count;
+	});
+	bench("collect moving", "replicas", [&]() {
+		step++;
+		for (auto& player : players) {
+			player.transform[3][0] = step * 0.1f;
+			_sink += player.replica.collect().mask;
+		}
+		return count;
+	});
+	bench("collect all", "replicas", [&]() {
+		for (auto& player : players)
+			_sink += player.replica.collect(true).mask;
+		return count;
+	});
+	ReplicatedState state = players[0].replica.collect(true);
+	bench("apply all", "replicas", [&]() {
+		for (auto& player : players)
+			player.replica.apply(state);
+		_sink += players.back().alive;
+		return count;
+	});
+}
+
+// Segmented send
+
+// sends a batch of equal sized dgrams to a loopback socket, once segmented and once dgram by dgram
+// nobody reads the receiver, the kernel drops what doesn't fit so only the sending side is measured
+void benchSegmentedSend() {
+	int receiver = socket(AF_INET, SOCK_DGRAM, 0);
+	int sender = socket(AF_INET, SOCK_DGRAM, 0);
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t addrlen = sizeof(addr);
+	if (receiver < 0 || sender < 0 || bind(receiver, reinterpret_cast<sockaddr*>(&addr), addrlen) < 0 ||
+		getsockname(receiver, reinterpret_cast<sockaddr*>(&addr), &addrlen) < 0) {
+		sock::printLastError("bench socket");
+		return;
+	}
+
+	const size_t count = 64; // one snapshot to every player of a full room
+	const size_t size = 1000;
+	std::vector<PackedPacket> packets;
+	for (size_t i = 0; i < count; i++)
+		packets.push_back(std::make_shared<const std::vector<char>>(size, static_cast<char>(i)));
+	const sockaddr* pAddr = reinterpret_cast<sockaddr*>(&addr);
+
+	bench("send dgram by dgram", "B", [&]() {
+		uint32_t bytesSent = 0;
+		for (auto& spPacked : packets)
+			bytesSent += Packet::sendBufferDgram(sender, pAddr, spPacked->data(), spPacked->size());
+		return bytesSent;
+	});
+	bench("send segmented", "B", [&]() {
+		return Packet::sendBuffersDgram(sender, pAddr, packets);
+	});
+
+	sock::closeSocket(sender);
+	sock::closeSocket(receiver);
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1)
+		_seconds = atof(argv[1]);
+	if (_seconds <= 0) {
+		fprintf(stderr, "usage: VODBench [seconds per case]\n");
+		return 1;
+	}
+
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+		fprintf(stderr, "WSAStartup failed\n");
+		return 1;
+	}
+#endif // _WIN32
+
+	benchByteSwap();
+	benchBitPacking();
+	benchReplicaCollect();
+	benchSegmentedSend();
+
+#ifdef _WIN32
+	WSACleanup();
+#endif // _WIN32
+	return 0;
+}
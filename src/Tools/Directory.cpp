@@ -0,0 +1,314 @@
+// the matchmaking directory, servers register their rooms and clients search them
+// usage:
+//   VODDirectory <port> [server timeout in ms]
+// servers keep a stream open and send their room changes, see DirectoryRegisterPacket
+// a server that closes its stream or stays silent for the timeout loses its rooms
+// clients query with dgrams on the same port, see DirectoryQueryPacket, every query is answered from the in-memory index
+
+#include "SockUitls.h"
+#include "Objects/Packets.h"
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <string>
+#include <cctype>
+
+typedef std::chrono::steady_clock Clock;
+
+const int _pollTimeout = 1000; // milliseconds, also how often server timeouts are checked
+
+// the rooms of all servers, indexed by name and by region and name
+// registrations change single entries, queries walk the name range of their prefix and stop at the limit
+class RoomIndex {
+public:
+	// adds the room or replaces the room with the same key
+	void update(uint64_t key, const DirectoryRoom& room) {
+		auto it = m_rooms.find(key);
+		if (it != m_rooms.end()) {
+			if (it->second.info.name == room.info.name && it->second.region == room.region) { // most updates only change the player count
+				it->second = room;
+				return;
+			}
+			unindex(key, it->second);
+		}
+		m_rooms[key] = room;
+		std::string nameKey = nameKeyOf(key, room.info.name);
+		m_byName[nameKey] = key;
+		m_byRegion[room.region][nameKey] = key;
+	}
+
+	void remove(uint64_t key) {
+		auto it = m_rooms.find(key);
+		if (it == m_rooms.end())
+			return;
+		unindex(key, it->second);
+		m_rooms.erase(it);
+	}
+
+	// calls match for every room of the region whose name starts with the prefix and has enough free slots, ordered by name
+	// stops when match returns false
+	template<class F>
+	void query(const std::string& region, const std::string& namePrefix, uint32_t minFreeSlots, F match) const {
+		const std::map<std::string, uint64_t>* pNames = &m_byName;
+		if (!region.empty()) {
+			auto regionIt = m_byRegion.find(region);
+			if (regionIt == m_byRegion.end())
+				return;
+			pNames = &regionIt->second;
+		}
+		std::string prefix = lower(namePrefix);
+		for (auto it = pNames->lower_bound(prefix); it != pNames->end() && it->first.compare(0, prefix.size(), prefix) == 0; it++) {
+			const DirectoryRoom& room = m_rooms.at(it->second);
+			if (room.info.players > room.info.maxPlayers || minFreeSlots > room.info.maxPlayers - room.info.players) // no sum, it could overflow
+				continue;
+			if (!match(room))
+				return;
+		}
+	}
+
+	size_t size() const {
+		return m_rooms.size();
+	}
+
+private:
+	std::unordered_map<uint64_t, DirectoryRoom> m_rooms = {};
+	std::map<std::string, uint64_t> m_byName = {};
+	std::unordered_map<std::string, std::map<std::string, uint64_t>> m_byRegion = {};
+
+	static std::string lower(std::string text) {
+		std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+		return text;
+	}
+
+	// the lower case name followed by the key, so equal names stay apart and sort before longer names
+	static std::string nameKeyOf(uint64_t key, const std::string& name) {
+		std::string nameKey = lower(name);
+		nameKey.push_back('\0');
+		for (int shift = 56; shift >= 0; shift -= 8)
+			nameKey.push_back(static_cast<char>((key >> shift) & 0xFF));
+		return nameKey;
+	}
+
+	void unindex(uint64_t key, const DirectoryRoom& room) {
+		std::string nameKey = nameKeyOf(key, room.info.name);
+		m_byName.erase(nameKey);
+		auto regionIt = m_byRegion.find(room.region);
+		if (regionIt == m_byRegion.end())
+			return;
+		regionIt->second.erase(nameKey);
+		if (regionIt->second.empty())
+			m_byRegion.erase(regionIt);
+	}
+};
+
+struct RegisteredServer {
+	int socket = -1;
+	uint32_t id = 0;
+	std::string peerAddress = ""; // the address the directory sees the server at
+	Clock::time_point lastReceived = {}; // of the last whole packet
+	std::unordered_set<uint32_t> rooms = {};
+	StreamReader reader; // registrations may arrive in pieces
+};
+
+RoomIndex _index;
+std::vector<RegisteredServer> _servers = {}; // in the order of their pollfds
+std::vector<pollfd> _pollfds = {}; // #0 stream, #1 dgram, then one per server
+uint32_t _nextServerId = 1;
+Clock::duration _serverTimeout = std::chrono::seconds(10);
+uint64_t _queries = 0;
+
+uint64_t roomKey(uint32_t serverId, uint32_t roomId) {
+	return (static_cast<uint64_t>(serverId) << 32) | roomId;
+}
+
+std::string ipOf(sockaddr* addr) {
+	if (addr->sa_family == AF_INET)
+		return sock::addrToPresentationIPv4(reinterpret_cast<sockaddr_in*>(addr)->sin_addr);
+	return sock::addrToPresentationIPv6(reinterpret_cast<sockaddr_in6*>(addr)->sin6_addr);
+}
+
+// binds a socket of the given type to the port on all interfaces
+// returns -1 on failure
+int bindSocket(std::string port, int type) {
+	addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = type;
+	hints.ai_flags = AI_PASSIVE;
+	addrinfo* info;
+	int status;
+	if ((status = getaddrinfo(NULL, port.c_str(), &hints, &info)) != 0) {
+		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
+		return -1;
+	}
+	int socketFd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+	if (socketFd < 0) {
+		sock::printLastError("socket");
+		freeaddrinfo(info);
+		return -1;
+	}
+	int yes = 1;
+	if (setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&yes), sizeof yes) == -1)
+		sock::printLastError("setsockopt");
+	if (bind(socketFd, info->ai_addr, info->ai_addrlen) < 0 || (type == SOCK_STREAM && listen(socketFd, 64) < 0)) {
+		sock::printLastError("bind");
+		sock::closeSocket(socketFd);
+		socketFd = -1;
+	}
+	freeaddrinfo(info);
+	return socketFd;
+}
+
+void acceptServer() {
+	sockaddr_storage addr;
+	socklen_t addrlen = sizeof addr;
+	int socketFd = accept(_pollfds[0].fd, reinterpret_cast<sockaddr*>(&addr), &addrlen);
+	if (socketFd < 0) {
+		sock::printLastError("accept");
+		return;
+	}
+	sock::setBlocking(socketFd, false); // a server that stops halfway through a packet must not stall the queries
+	RegisteredServer server;
+	server.socket = socketFd;
+	server.id = _nextServerId++;
+	server.peerAddress = ipOf(reinterpret_cast<sockaddr*>(&addr));
+	server.lastReceived = Clock::now();
+	_servers.push_back(server);
+	_pollfds.push_back({ socketFd, POLLIN, 0 });
+	printf("server %u connected from %s\n", server.id, server.peerAddress.c_str());
+}
+
+void handleRegister(RegisteredServer& server, DirectoryRegisterPacket& packet) {
+	DirectoryRoom room;
+	room.address = packet.address.empty() ? server.peerAddress : packet.address;
+	room.port = packet.port;
+	room.region = packet.region;
+	for (auto& info : packet.rooms) {
+		room.info = info;
+		_index.update(roomKey(server.id, info.id), room);
+		server.rooms.insert(info.id);
+	}
+	for (uint32_t roomId : packet.removedRooms) {
+		_index.remove(roomKey(server.id, roomId));
+		server.rooms.erase(roomId);
+	}
+}
+
+// removes the server and its rooms, i is its index in _servers
+void removeServer(size_t i, const char* reason) {
+	RegisteredServer& server = _servers[i];
+	for (uint32_t roomId : server.rooms)
+		_index.remove(roomKey(server.id, roomId));
+	printf("server %u %s, %zu rooms left\n", server.id, reason, _index.size());
+	sock::closeSocket(server.socket);
+	_servers.erase(_servers.begin() + i);
+	_pollfds.erase(_pollfds.begin() + i + 2);
+}
+
+// returns false if the server closed its stream or sent a malformed packet
+bool recvServer(RegisteredServer& server) {
+	if (!server.reader.receive(server.socket))
+		return false;
+	int type;
+	bool malformed = false;
+	while (auto spPacket = server.reader.next(type, malformed)) {
+		server.lastReceived = Clock::now();
+		if (type == eDIRECTORY_REGISTER)
+			handleRegister(server, *reinterpret_cast<DirectoryRegisterPacket*>(spPacket.get()));
+	}
+	return !malformed;
+}
+
+void answerQuery(int socket) {
+	sockaddr_storage addr;
+	int addrlen = sizeof addr;
+	int type;
+	auto spPacket = Packet::receiveFromDgram(type, socket, reinterpret_cast<sockaddr*>(&addr), &addrlen);
+	if (!spPacket || type != eDIRECTORY_QUERY)
+		return;
+	DirectoryQueryPacket& query = *reinterpret_cast<DirectoryQueryPacket*>(spPacket.get());
+	_queries++;
+
+	DirectoryRoomsPacket answer;
+	answer.queryId = query.queryId;
+	uint32_t size = answer.fullSize();
+	uint32_t skip = query.offset;
+	_index.query(query.region, query.namePrefix, query.minFreeSlots, [&](const DirectoryRoom& room) {
+		if (skip > 0) {
+			skip--;
+			return true;
+		}
+		uint32_t roomSize = DirectoryRoomsPacket::roomSize(room);
+		if ((query.limit != 0 && answer.rooms.size() >= query.limit) || size + roomSize > UDP_PACKET_BUFFER_SIZE) {
+			answer.more = true;
+			return false;
+		}
+		answer.rooms.push_back(room);
+		size += roomSize;
+		return true;
+	});
+	answer.sendToDgram(socket, reinterpret_cast<sockaddr*>(&addr));
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: VODDirectory <port> [server timeout in ms]\n");
+		return 1;
+	}
+	if (argc >= 3)
+		_serverTimeout = std::chrono::milliseconds(atoi(argv[2]));
+
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+		fprintf(stderr, "WSAStartup failed\n");
+		return 1;
+	}
+#endif // _WIN32
+
+	int streamSocket = bindSocket(argv[1], SOCK_STREAM);
+	int dgramSocket = bindSocket(argv[1], SOCK_DGRAM);
+	if (streamSocket < 0 || dgramSocket < 0)
+		return 1;
+	_pollfds.push_back({ streamSocket, POLLIN, 0 });
+	_pollfds.push_back({ dgramSocket, POLLIN, 0 });
+	printf("directory listening on port %s\n", argv[1]);
+
+	auto nextReport = Clock::now();
+	while (true) {
+		if (sock::pollState(_pollfds.data(), _pollfds.size(), _pollTimeout) < 0) {
+			sock::printLastError("poll");
+			break;
+		}
+		if (_pollfds[0].revents & POLLIN)
+			acceptServer();
+		if (_pollfds[1].revents & POLLIN)
+			answerQuery(dgramSocket);
+
+		auto now = Clock::now();
+		for (size_t i = 0; i < _servers.size(); i++) { // accepted servers are appended and not polled yet
+			short revents = _pollfds[i + 2].revents;
+			if ((revents & POLLIN && !recvServer(_servers[i])) || revents & POLLHUP)
+				removeServer(i--, "disconnected");
+			else if (now - _servers[i].lastReceived > _serverTimeout)
+				removeServer(i--, "timed out");
+		}
+
+		if (now >= nextReport) {
+			printf("%zu servers, %zu rooms, %llu queries\n", _servers.size(), _index.size(), static_cast<unsigned long long>(_queries));
+			nextReport = now + std::chrono::seconds(60);
+		}
+	}
+
+	for (auto& server : _servers)
+		sock::closeSocket(server.socket);
+	sock::closeSocket(streamSocket);
+	sock::closeSocket(dgramSocket);
+#ifdef _WIN32
+	WSACleanup();
+#endif // _WIN32
+	return 0;
+}
@@ -0,0 +1,421 @@
+// the spectator relay, fans the delayed spectator stream of a server out to many spectators
+// usage:
+//   VODRelay <port> [upstream ip] [upstream port]
+// a server streams its rooms to the relay, see Spectate.h, or the relay watches every room of an upstream relay, so relays can be chained
+// spectators connect and send a SpectatePacket, they get the latest keyframe of their room and every frame after it
+// every frame is packed once and queued for all spectators of its room, a spectator that falls too far behind skips to the next keyframe
+
+#include "SockUitls.h"
+#include "Objects/Packets.h"
+
+#include <chrono>
+#include <map>
+#include <deque>
+#include <unordered_set>
+#include <vector>
+#include <string>
+#include <csignal>
+
+typedef std::chrono::steady_clock Clock;
+
+const int _pollTimeout = 100; // milliseconds
+const Clock::duration _heartbeatInterval = std::chrono::seconds(1); // spectators time out without packets, rooms can be quiet
+const Clock::duration _reconnectInterval = std::chrono::seconds(5);
+const Clock::duration _handshakeTimeout = std::chrono::seconds(10); // connections have to say what they are until then
+const size_t _maxQueuedBytes = 4 * 1024 * 1024; // a spectator with more unsent bytes skips to the next keyframe
+
+// the frames of one room that a joining spectator needs
+struct Feed {
+	std::vector<PackedPacket> frames = {}; // the latest keyframe and every frame after it
+	uint32_t nextSequence = 0;
+};
+
+enum PeerRole {
+	ePEER_UNKNOWN, // accepted, the first packet decides
+	ePEER_SOURCE, // the server or the upstream relay
+	ePEER_SPECTATOR // a spectator or a downstream relay
+};
+
+// the sockets of all peers don't block, a slow or stalling peer must not hold up the others
+struct Peer {
+	int socket = -1;
+	PeerRole role = ePEER_UNKNOWN;
+	bool isUpstream = false;
+	bool connecting = false; // the upstream connection isn't established yet
+	Clock::time_point accepted = {};
+	StreamReader reader; // packets of unknown peers and sources, they may arrive in pieces
+
+	// spectators only
+	uint32_t roomId = 0; // 0 watches every room
+	bool keyframes = false;
+	std::unordered_set<uint32_t> synced = {}; // rooms whose keyframe is queued, the frames after it can follow
+	std::deque<PackedPacket> queue = {};
+	size_t queuedBytes = 0;
+	size_t sentOffset = 0; // bytes of the first queued frame that are sent
+};
+
+std::map<uint32_t, Feed> _feeds = {};
+std::vector<Peer> _peers = {};
+int _listenSocket = -1;
+
+std::string _upstreamIp = "";
+std::string _upstreamPort = "";
+Clock::time_point _nextUpstreamConnect = {};
+
+PackedPacket _spHeartbeat = nullptr;
+Clock::time_point _nextHeartbeat = {};
+uint64_t _framesReceived = 0;
+uint64_t _skips = 0; // times a spectator skipped to the next keyframe
+
+bool hasSource() {
+	for (auto& peer : _peers)
+		if (peer.role == ePEER_SOURCE || peer.isUpstream)
+			return true;
+	return false;
+}
+
+bool watches(const Peer& peer, uint32_t roomId) {
+	return peer.role == ePEER_SPECTATOR && (peer.roomId == 0 || peer.roomId == roomId);
+}
+
+// drops everything queued except the frame that is partially sent, the spectator continues with the next keyframe of each room
+void skipAhead(Peer& peer) {
+	PackedPacket spPartial = peer.sentOffset > 0 ? peer.queue.front() : nullptr;
+	peer.queue.clear();
+	peer.queuedBytes = 0;
+	if (spPartial) {
+		peer.queue.push_back(spPartial);
+		peer.queuedBytes = spPartial->size();
+	}
+	peer.synced.clear();
+	_skips++;
+}
+
+void queue(Peer& peer, const PackedPacket& spPacked) {
+	peer.queue.push_back(spPacked);
+	peer.queuedBytes += spPacked->size();
+}
+
+// queues the frame for every spectator of its room
+void fanOut(const SpectatorFramePacket& frame, const PackedPacket& spPacked) {
+	for (auto& peer : _peers) {
+		if (!watches(peer, frame.roomId))
+			continue;
+		if (peer.queuedBytes + spPacked->size() > _maxQueuedBytes)
+			skipAhead(peer);
+		bool synced = peer.synced.count(frame.roomId) != 0;
+		if (frame.keyframe && (!synced || peer.keyframes)) {
+			queue(peer, spPacked);
+			peer.synced.insert(frame.roomId);
+		}
+		else if (!frame.keyframe && synced)
+			queue(peer, spPacked);
+		if (frame.closed)
+			peer.synced.erase(frame.roomId);
+	}
+}
+
+// the room can only be watched again from its next keyframe
+void dropFeed(uint32_t roomId) {
+	_feeds.erase(roomId);
+	for (auto& peer : _peers)
+		peer.synced.erase(roomId);
+}
+
+void handleFrame(SpectatorFramePacket& frame) {
+	_framesReceived++;
+	auto it = _feeds.find(frame.roomId);
+	if (!frame.keyframe && (it == _feeds.end() || frame.sequence != it->second.nextSequence)) { // started mid-room or frames were lost
+		if (it != _feeds.end()) {
+			printf("room %u lost frames, waiting for its next keyframe\n", frame.roomId);
+			dropFeed(frame.roomId);
+		}
+		return;
+	}
+	Feed& feed = _feeds[frame.roomId];
+	if (frame.keyframe)
+		feed.frames.clear();
+	PackedPacket spPacked = frame.packShared(); // once for all spectators
+	feed.frames.push_back(spPacked);
+	feed.nextSequence = frame.sequence + 1;
+	fanOut(frame, spPacked);
+	if (frame.closed)
+		_feeds.erase(frame.roomId);
+}
+
+void subscribe(Peer& peer, const SpectatePacket& packet) {
+	peer.role = ePEER_SPECTATOR;
+	peer.roomId = packet.roomId;
+	peer.keyframes = packet.keyframes;
+	for (auto& feedPair : _feeds) {
+		if (!watches(peer, feedPair.first))
+			continue;
+		for (auto& spPacked : feedPair.second.frames)
+			queue(peer, spPacked);
+		peer.synced.insert(feedPair.first);
+	}
+	if (packet.roomId == 0)
+		printf("%s watches every room\n", packet.username.c_str());
+	else
+		printf("%s watches room %u\n", packet.username.c_str(), packet.roomId);
+}
+
+// the stream stops until a source sends keyframes again
+void sourceLost() {
+	printf("lost the source, waiting for keyframes\n");
+	_feeds.clear();
+	for (auto& peer : _peers)
+		peer.synced.clear();
+}
+
+// returns false if the connection has to be closed
+bool handlePacket(Peer& peer, int type, std::shared_ptr<Packet>& spPacket) {
+	if (type == eSPECTATE && peer.role == ePEER_UNKNOWN) {
+		subscribe(peer, *reinterpret_cast<SpectatePacket*>(spPacket.get()));
+		return true;
+	}
+	if (type == eSPECTATOR_FRAME) {
+		if (peer.role == ePEER_UNKNOWN) {
+			if (hasSource()) {
+				printf("a second source connected, refusing it\n");
+				return false;
+			}
+			peer.role = ePEER_SOURCE;
+			printf("source connected\n");
+		}
+		if (peer.role == ePEER_SOURCE)
+			handleFrame(*reinterpret_cast<SpectatorFramePacket*>(spPacket.get()));
+	}
+	return true; // e.g. heartbeats of the upstream relay
+}
+
+// returns false if the connection has to be closed
+bool receive(Peer& peer) {
+	if (peer.role == ePEER_SPECTATOR) { // spectators only answer heartbeats, nothing to read
+		char buf[512];
+		int bytesRead = recv(peer.socket, buf, sizeof buf, 0);
+		return bytesRead > 0 || (bytesRead < 0 && sock::wouldBlock());
+	}
+
+	if (!peer.reader.receive(peer.socket))
+		return false;
+	int type;
+	bool malformed = false;
+	while (auto spPacket = peer.reader.next(type, malformed)) {
+		if (!handlePacket(peer, type, spPacket))
+			return false;
+		if (peer.role == ePEER_SPECTATOR) { // subscribed, the rest are heartbeats
+			peer.reader.clear();
+			break;
+		}
+	}
+	return !malformed;
+}
+
+// returns false if the connection broke
+bool flush(Peer& peer) {
+	while (!peer.queue.empty()) {
+		const PackedPacket& spPacked = peer.queue.front();
+		int bytesSent = send(peer.socket, spPacked->data() + peer.sentOffset, static_cast<int>(spPacked->size() - peer.sentOffset), 0);
+		if (bytesSent < 0)
+			return sock::wouldBlock();
+		peer.sentOffset += bytesSent;
+		if (peer.sentOffset < spPacked->size())
+			return true;
+		peer.queuedBytes -= spPacked->size();
+		peer.sentOffset = 0;
+		peer.queue.pop_front();
+	}
+	return true;
+}
+
+void acceptPeer() {
+	sockaddr_storage addr;
+	socklen_t addrlen = sizeof addr;
+	int socketFd = accept(_listenSocket, reinterpret_cast<sockaddr*>(&addr), &addrlen);
+	if (socketFd < 0) {
+		sock::printLastError("accept");
+		return;
+	}
+	sock::setBlocking(socketFd, false);
+	Peer peer;
+	peer.socket = socketFd;
+	peer.accepted = Clock::now();
+	_peers.push_back(peer);
+}
+
+void connectUpstream() {
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* info;
+	int status;
+	if ((status = getaddrinfo(_upstreamIp.c_str(), _upstreamPort.c_str(), &hints, &info)) != 0) {
+		fprintf(stderr, "getaddrinfo %s: %s\n", _upstreamIp.c_str(), gai_strerror(status));
+		return;
+	}
+	int socketFd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+	if (socketFd < 0) {
+		sock::printLastError("socket");
+		freeaddrinfo(info);
+		return;
+	}
+	sock::setBlocking(socketFd, false);
+	if (connect(socketFd, info->ai_addr, info->ai_addrlen) < 0 && !sock::isConnectPending()) {
+		sock::printLastError("connect");
+		sock::closeSocket(socketFd);
+		freeaddrinfo(info);
+		return;
+	}
+	freeaddrinfo(info);
+	Peer peer;
+	peer.socket = socketFd;
+	peer.isUpstream = true;
+	peer.connecting = true;
+	peer.accepted = Clock::now();
+	_peers.push_back(peer);
+}
+
+// returns false if the connection failed
+bool finishUpstreamConnect(Peer& peer) {
+	if (sock::socketError(peer.socket) != 0)
+		return false;
+	SpectatePacket spectatePacket; // every room with every keyframe, so this relay can serve spectators joining later
+	spectatePacket.username = "relay";
+	spectatePacket.roomId = 0;
+	spectatePacket.keyframes = true;
+	if (spectatePacket.sendTo(peer.socket) == 0)
+		return false;
+	peer.connecting = false;
+	peer.role = ePEER_SOURCE;
+	printf("watching the upstream relay %s:%s\n", _upstreamIp.c_str(), _upstreamPort.c_str());
+	return true;
+}
+
+int main(int argc, char** argv) {
+	if (argc != 2 && argc != 4) {
+		fprintf(stderr, "usage: VODRelay <port> [upstream ip] [upstream port]\n");
+		return 1;
+	}
+	if (argc == 4) {
+		_upstreamIp = argv[2];
+		_upstreamPort = argv[3];
+	}
+
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+		fprintf(stderr, "WSAStartup failed\n");
+		return 1;
+	}
+#elif __linux__
+	signal(SIGPIPE, SIG_IGN); // spectators vanish while frames are sent to them, the send fails instead
+#endif
+
+	addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	addrinfo* info;
+	int status;
+	if ((status = getaddrinfo(NULL, argv[1], &hints, &info)) != 0) {
+		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
+		return 1;
+	}
+	_listenSocket = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+	int yes = 1;
+	if (_listenSocket < 0 || setsockopt(_listenSocket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&yes), sizeof yes) < 0 ||
+		bind(_listenSocket, info->ai_addr, info->ai_addrlen) < 0 || listen(_listenSocket, 64) < 0) {
+		sock::printLastError("listen");
+		return 1;
+	}
+	freeaddrinfo(info);
+	printf("relay listening on port %s\n", argv[1]);
+
+	HeartbeatPacket heartbeatPacket;
+	heartbeatPacket.username = "relay";
+	_spHeartbeat = heartbeatPacket.packShared();
+
+	std::vector<pollfd> pollfds;
+	auto nextReport = Clock::now();
+	while (true) {
+		auto now = Clock::now();
+		if (!_upstreamIp.empty() && !hasSource() && now >= _nextUpstreamConnect) {
+			connectUpstream();
+			_nextUpstreamConnect = now + _reconnectInterval;
+		}
+
+		pollfds.clear(); // #0 listen, then one per peer
+		pollfds.push_back({ _listenSocket, POLLIN, 0 });
+		for (auto& peer : _peers) {
+			short events = peer.connecting ? POLLOUT : POLLIN;
+			if (!peer.queue.empty())
+				events |= POLLOUT;
+			pollfds.push_back({ peer.socket, events, 0 });
+		}
+		if (sock::pollState(pollfds.data(), pollfds.size(), _pollTimeout) < 0) {
+			sock::printLastError("poll");
+			break;
+		}
+
+		now = Clock::now();
+		if (now >= _nextHeartbeat) {
+			for (auto& peer : _peers)
+				if (peer.role == ePEER_SPECTATOR)
+					queue(peer, _spHeartbeat);
+			_nextHeartbeat = now + _heartbeatInterval;
+		}
+
+		for (size_t i = 0; i < _peers.size(); i++) { // accepted peers are appended and not polled yet
+			Peer& peer = _peers[i];
+			short revents = pollfds[i + 1].revents;
+			bool open = true;
+			if (peer.connecting) {
+				if (revents & (POLLOUT | POLLERR | POLLHUP))
+					open = finishUpstreamConnect(peer);
+				else if (now - peer.accepted > _handshakeTimeout)
+					open = false;
+			}
+			else {
+				if (revents & (POLLIN | POLLHUP | POLLERR))
+					open = receive(peer);
+				if (open && peer.role == ePEER_UNKNOWN && now - peer.accepted > _handshakeTimeout)
+					open = false;
+			}
+			if (!open) {
+				if (peer.role == ePEER_SOURCE)
+					sourceLost();
+				sock::closeSocket(peer.socket);
+				_peers.erase(_peers.begin() + i);
+				pollfds.erase(pollfds.begin() + i + 1);
+				i--;
+			}
+		}
+		for (size_t i = 0; i < _peers.size(); i++) { // frames received above are sent right away when the socket takes them
+			if (_peers[i].role != ePEER_SPECTATOR || flush(_peers[i]))
+				continue;
+			sock::closeSocket(_peers[i].socket);
+			_peers.erase(_peers.begin() + i);
+			i--;
+		}
+
+		if (pollfds[0].revents & POLLIN)
+			acceptPeer();
+
+		if (now >= nextReport) {
+			size_t spectators = 0;
+			for (auto& peer : _peers)
+				spectators += peer.role == ePEER_SPECTATOR ? 1 : 0;
+			printf("%zu rooms, %zu spectators, %llu frames, %llu skips\n", _feeds.size(), spectators, static_cast<unsigned long long>(_framesReceived), static_cast<unsigned long long>(_skips));
+			nextReport = now + std::chrono::seconds(60);
+		}
+	}
+
+	for (auto& peer : _peers)
+		sock::closeSocket(peer.socket);
+	sock::closeSocket(_listenSocket);
+#ifdef _WIN32
+	WSACleanup();
+#endif // _WIN32
+	return 0;
+}
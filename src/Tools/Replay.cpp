@@ -0,0 +1,297 @@
+// replays a capture recorded by the network layer (see Capture.h) into a running server or a connecting client
+// usage:
+//   VODReplay <capture file> server <ip> <port> [speed]   connects one socket pair per recorded client and sends its traffic to the server
+//   VODReplay <capture file> client <port> [speed]        waits for a client and sends it the traffic the server sent in the capture
+// speed scales the recorded timing, 2 replays twice as fast, 0 sends everything as fast as possible
+
+#include "SockUitls.h"
+#include "Capture.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <map>
+#include <vector>
+#include <string>
+
+const size_t _drainBufferSize = 2048;
+
+struct ReplayConnection {
+	int stream = -1;
+	int dgram = -1;
+	sockaddr_storage dgramAddr = {}; // where datagrams are sent to
+};
+
+struct ReplayStats {
+	size_t packets = 0;
+	size_t bytes = 0;
+};
+
+// returns true if the record was sent towards the server
+bool isTowardsServer(const capture::Record& record) {
+	return (record.side == capture::eSERVER && record.direction == capture::eRECV) ||
+		(record.side == capture::eCLIENT && record.direction == capture::eSEND);
+}
+
+// a hosting game records both sides, only one side is replayed to not send packets twice
+// returns true if the capture contains server side records
+bool hasServerSide(std::string path) {
+	capture::Reader reader;
+	if (!reader.open(path))
+		return false;
+	capture::Record record;
+	while (reader.next(record))
+		if (record.side == capture::eSERVER)
+			return true;
+	return false;
+}
+
+// reads and discards everything that arrives on the sockets so the peer never blocks on full buffers
+// returns false if a stream was closed by the peer
+bool drainSockets(std::vector<pollfd>& pollfds) {
+	if (pollfds.empty() || sock::pollState(pollfds.data(), pollfds.size(), 0) <= 0)
+		return true;
+	char buf[_drainBufferSize];
+	for (auto& pfd : pollfds) {
+		if (pfd.revents & POLLHUP)
+			return false;
+		if (pfd.revents & POLLIN)
+			if (recv(pfd.fd, buf, sizeof(buf), 0) == 0)
+				return false;
+	}
+	return true;
+}
+
+void waitForRecord(const capture::Record& record, uint64_t firstTime, std::chrono::steady_clock::time_point startTime, double speed, std::vector<pollfd>& pollfds) {
+	if (speed <= 0)
+		return;
+	auto target = startTime + std::chrono::nanoseconds(static_cast<uint64_t>((record.time - firstTime) / speed));
+	while (std::chrono::steady_clock::now() < target) {
+		drainSockets(pollfds);
+		auto remaining = target - std::chrono::steady_clock::now();
+		if (remaining > std::chrono::milliseconds(1))
+			std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(remaining, std::chrono::milliseconds(5)));
+	}
+}
+
+void sendRecord(const capture::Record& record, ReplayConnection& connection, ReplayStats& stats) {
+	if (record.channel == capture::eSTREAM) {
+		uint32_t offset = 0;
+		while (offset < record.size) {
+			int bytesSent = send(connection.stream, record.data + offset, record.size - offset, 0);
+			if (bytesSent == -1) {
+				sock::printLastError("replay send");
+				return;
+			}
+			offset += bytesSent;
+		}
+	}
+	else {
+		socklen_t addrlen = connection.dgramAddr.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+		if (sendto(connection.dgram, record.data, record.size, 0, reinterpret_cast<const sockaddr*>(&connection.dgramAddr), addrlen) == -1) {
+			sock::printLastError("replay sendto");
+			return;
+		}
+	}
+	stats.packets++;
+	stats.bytes += record.size;
+}
+
+// opens a tcp connection and a udp socket bound to the same address, like the client does
+bool connectReplayClient(const addrinfo* serverInfo, ReplayConnection& connection) {
+	// protocol 0, the lookup has no socket type so ai_protocol may be tcp, which a dgram socket rejects
+	connection.stream = socket(serverInfo->ai_family, SOCK_STREAM, 0);
+	connection.dgram = socket(serverInfo->ai_family, SOCK_DGRAM, 0);
+	if (connection.stream < 0 || connection.dgram < 0) {
+		sock::printLastError("replay socket");
+		return false;
+	}
+	if (connect(connection.stream, serverInfo->ai_addr, serverInfo->ai_addrlen) < 0) {
+		sock::printLastError("replay connect");
+		return false;
+	}
+	sockaddr_storage localAddr;
+	socklen_t socklen = sizeof(sockaddr_storage);
+	if (getsockname(connection.stream, reinterpret_cast<sockaddr*>(&localAddr), &socklen) < 0 ||
+		bind(connection.dgram, reinterpret_cast<sockaddr*>(&localAddr), socklen) < 0) {
+		sock::printLastError("replay bind(dgram)");
+		return false;
+	}
+	memcpy(&connection.dgramAddr, serverInfo->ai_addr, serverInfo->ai_addrlen);
+	return true;
+}
+
+int replayToServer(std::string path, std::string ip, std::string port, double speed) {
+	addrinfo hints = {};
+	addrinfo* serverInfo;
+	hints.ai_family = AF_UNSPEC;
+	int status;
+	if ((status = getaddrinfo(ip.c_str(), port.c_str(), &hints, &serverInfo)) != 0) {
+		fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(status));
+		return 1;
+	}
+
+	capture::Side side = hasServerSide(path) ? capture::eSERVER : capture::eCLIENT;
+	capture::Reader reader;
+	if (!reader.open(path)) {
+		fprintf(stderr, "cannot read capture %s\n", path.c_str());
+		return 1;
+	}
+
+	std::map<std::string, ReplayConnection> connections; // one connection per recorded client
+	std::vector<pollfd> pollfds;
+	ReplayStats stats;
+	bool hasFirst = false;
+	uint64_t firstTime = 0;
+	auto startTime = std::chrono::steady_clock::now();
+
+	capture::Record record;
+	while (reader.next(record)) {
+		if (record.side != side || !isTowardsServer(record))
+			continue;
+		if (!hasFirst) {
+			firstTime = record.time;
+			startTime = std::chrono::steady_clock::now();
+			hasFirst = true;
+		}
+
+		// the clients udp socket is bound to the address of its stream, so both channels map to the same peer
+		std::string key = side == capture::eSERVER ? sock::addrToPresentation(reinterpret_cast<sockaddr*>(&record.peer)) : "server";
+		if (!connections.count(key)) {
+			ReplayConnection& connection = connections[key];
+			if (!connectReplayClient(serverInfo, connection))
+				return 1;
+			pollfds.push_back({ connection.stream, POLLIN, 0 });
+			pollfds.push_back({ connection.dgram, POLLIN, 0 });
+			printf("replaying client %s\n", key.c_str());
+		}
+
+		waitForRecord(record, firstTime, startTime, speed, pollfds);
+		sendRecord(record, connections.at(key), stats);
+		if (!drainSockets(pollfds)) {
+			fprintf(stderr, "server closed a connection\n");
+			break;
+		}
+	}
+
+	float seconds = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::steady_clock::now() - startTime).count();
+	printf("replayed %zu packets (%zu bytes) from %zu clients in %fs\n", stats.packets, stats.bytes, connections.size(), seconds);
+
+	for (auto& pair : connections) {
+		sock::closeSocket(pair.second.stream);
+		sock::closeSocket(pair.second.dgram);
+	}
+	freeaddrinfo(serverInfo);
+	return 0;
+}
+
+int replayToClient(std::string path, std::string port, double speed) {
+	addrinfo hints = {};
+	addrinfo* serverInfo;
+	hints.ai_family = AF_INET;
+	hints.ai_flags = AI_PASSIVE;
+	int status;
+	if ((status = getaddrinfo(NULL, port.c_str(), &hints, &serverInfo)) != 0) {
+		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
+		return 1;
+	}
+
+	// protocol 0, see connectReplayClient
+	int listener = socket(serverInfo->ai_family, SOCK_STREAM, 0);
+	ReplayConnection connection;
+	connection.dgram = socket(serverInfo->ai_family, SOCK_DGRAM, 0);
+	const char yes = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+	setsockopt(connection.dgram, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+	if (bind(listener, serverInfo->ai_addr, serverInfo->ai_addrlen) < 0 ||
+		bind(connection.dgram, serverInfo->ai_addr, serverInfo->ai_addrlen) < 0 ||
+		listen(listener, 1) < 0) {
+		sock::printLastError("replay listen");
+		return 1;
+	}
+	freeaddrinfo(serverInfo);
+
+	printf("waiting for a client on port %s\n", port.c_str());
+	socklen_t addrlen = sizeof(sockaddr_storage);
+	if ((connection.stream = accept(listener, reinterpret_cast<sockaddr*>(&connection.dgramAddr), &addrlen)) < 0) {
+		sock::printLastError("replay accept");
+		return 1;
+	}
+	sock::closeSocket(listener); // the client binds its udp socket to the address of its stream, so dgramAddr is already valid
+
+	capture::Side side = hasServerSide(path) ? capture::eSERVER : capture::eCLIENT;
+	capture::Reader reader;
+	if (!reader.open(path)) {
+		fprintf(stderr, "cannot read capture %s\n", path.c_str());
+		return 1;
+	}
+
+	std::vector<pollfd> pollfds = { { connection.stream, POLLIN, 0 }, { connection.dgram, POLLIN, 0 } };
+	ReplayStats stats;
+	std::string replayedPeer = ""; // a server capture contains many clients, only the first one is replayed
+	bool hasFirst = false;
+	uint64_t firstTime = 0;
+	auto startTime = std::chrono::steady_clock::now();
+
+	capture::Record record;
+	while (reader.next(record)) {
+		if (record.side != side || isTowardsServer(record))
+			continue;
+		if (side == capture::eSERVER) {
+			std::string peer = sock::addrToPresentation(reinterpret_cast<sockaddr*>(&record.peer));
+			if (replayedPeer.empty())
+				replayedPeer = peer;
+			if (peer != replayedPeer)
+				continue;
+		}
+		if (!hasFirst) {
+			firstTime = record.time;
+			startTime = std::chrono::steady_clock::now();
+			hasFirst = true;
+		}
+
+		waitForRecord(record, firstTime, startTime, speed, pollfds);
+		sendRecord(record, connection, stats);
+		if (!drainSockets(pollfds)) {
+			fprintf(stderr, "client closed the connection\n");
+			break;
+		}
+	}
+
+	float seconds = std::chrono::duration_cast<std::chrono::duration<float>>(std::chrono::steady_clock::now() - startTime).count();
+	printf("replayed %zu packets (%zu bytes) in %fs\n", stats.packets, stats.bytes, seconds);
+
+	sock::closeSocket(connection.stream);
+	sock::closeSocket(connection.dgram);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 4) {
+		fprintf(stderr, "usage: VODReplay <capture file> server <ip> <port> [speed]\n       VODReplay <capture file> client <port> [speed]\n");
+		return 1;
+	}
+
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+		fprintf(stderr, "WSAStartup failed\n");
+		return 1;
+	}
+#endif // _WIN32
+
+	std::string path = argv[1];
+	std::string mode = argv[2];
+	int result = 1;
+	if (mode == "server" && argc >= 5)
+		result = replayToServer(path, argv[3], argv[4], argc >= 6 ? atof(argv[5]) : 1.0);
+	else if (mode == "client")
+		result = replayToClient(path, argv[3], argc >= 5 ? atof(argv[4]) : 1.0);
+	else
+		fprintf(stderr, "unknown mode %s\n", mode.c_str());
+
+#ifdef _WIN32
+	WSACleanup();
+#endif // _WIN32
+	return result;
+}
@@ -0,0 +1,602 @@
+// the front door of several server processes, clients connect to the router instead of a server
+// usage:
+//   VODRouter <port> <directory ip> <directory port> [region]
+// the router learns the rooms of every server from the matchmaking directory, see Tools/Directory.cpp
+// clients talk to it like to a server: they connect, list, create and join rooms
+// joining answers with a RedirectPacket, the client then connects to the server hosting the room, the router keeps no game traffic
+// the rooms of all servers get router ids, so the room ids clients see through the router are unique across servers
+// new rooms are created on the server with the fewest players, the router creates them itself and answers with the router id
+
+#include "SockUitls.h"
+#include "Objects/Packets.h"
+
+#include <chrono>
+#include <map>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <csignal>
+
+typedef std::chrono::steady_clock Clock;
+
+const int _pollTimeout = 100; // milliseconds
+const Clock::duration _refreshInterval = std::chrono::milliseconds(1000); // how often the rooms are queried from the directory
+const Clock::duration _clientTimeout = std::chrono::seconds(10); // clients only stay until they are redirected
+const Clock::duration _createTimeout = std::chrono::seconds(3);
+const Clock::duration _createdRoomKeep = std::chrono::seconds(10); // a created room stays listed until the directory knows it
+const size_t _maxQueuedBytes = 1024 * 1024; // a client with more unsent bytes doesn't read and is dropped
+
+// a server process as the directory reports it
+struct Backend {
+	std::string address = "";
+	std::string port = "";
+	uint32_t players = 0;
+	uint32_t rooms = 0;
+	uint32_t placed = 0; // clients and rooms sent to the server since the last refresh, the directory doesn't count them yet
+
+	uint32_t load() const {
+		return players + placed;
+	}
+};
+
+struct RoutedRoom {
+	uint32_t id = 0; // the router id
+	DirectoryRoom room = {};
+	Clock::time_point keepUntil = {}; // created by the router, kept without the directory until then
+};
+
+// the sockets of the clients and the creates don't block, one stalling peer must not hold up the others
+struct RouterClient {
+	uint32_t id = 0;
+	int socket = -1;
+	std::string username = "";
+	Clock::time_point connected = {};
+	StreamReader reader;
+	std::deque<PackedPacket> queue = {}; // answers the socket didn't take yet
+	size_t queuedBytes = 0;
+	size_t sentOffset = 0; // bytes of the first queued packet that are sent
+};
+
+// a room the router creates on a server for a client
+struct PendingCreate {
+	uint32_t clientId = 0;
+	int socket = -1;
+	std::string server = ""; // key of the backend
+	std::string name = "";
+	uint32_t maxPlayers = 0;
+	bool sent = false; // the create was sent, waiting for the answer
+	Clock::time_point deadline = {};
+	StreamReader reader;
+};
+
+std::string _routerPort = "";
+std::string _region = "";
+
+int _listenSocket = -1;
+int _directorySocket = -1;
+sockaddr_storage _directoryAddr = {};
+
+uint32_t _queryId = 0;
+uint32_t _queryOffset = 0;
+std::vector<DirectoryRoom> _queryRooms = {}; // the pages of the running refresh
+Clock::time_point _nextRefresh = {};
+
+std::map<std::string, Backend> _backends = {}; // by address:port
+std::unordered_map<std::string, RoutedRoom> _rooms = {}; // by address:port#room id of the server
+std::map<uint32_t, std::string> _roomKeys = {}; // router id to the key in _rooms
+uint32_t _nextRoomId = 1;
+
+std::vector<RouterClient> _clients = {};
+std::vector<PendingCreate> _creates = {};
+uint32_t _nextClientId = 1;
+uint32_t _nextCreateId = 1; // makes the usernames of the router connections unique
+uint64_t _redirects = 0;
+
+std::string serverKey(const std::string& address, const std::string& port) {
+	return address + ":" + port;
+}
+
+std::string roomKey(const DirectoryRoom& room) {
+	return serverKey(room.address, room.port) + "#" + std::to_string(room.info.id);
+}
+
+std::string ipOf(sockaddr* addr) {
+	if (addr->sa_family == AF_INET)
+		return sock::addrToPresentationIPv4(reinterpret_cast<sockaddr_in*>(addr)->sin_addr);
+	return sock::addrToPresentationIPv6(reinterpret_cast<sockaddr_in6*>(addr)->sin6_addr);
+}
+
+// binds a stream socket to the port on all interfaces and listens
+// returns -1 on failure
+int listenOn(std::string port) {
+	addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	addrinfo* info;
+	int status;
+	if ((status = getaddrinfo(NULL, port.c_str(), &hints, &info)) != 0) {
+		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(status));
+		return -1;
+	}
+	int socketFd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+	if (socketFd < 0) {
+		sock::printLastError("socket");
+		freeaddrinfo(info);
+		return -1;
+	}
+	int yes = 1;
+	if (setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&yes), sizeof yes) == -1)
+		sock::printLastError("setsockopt");
+	if (bind(socketFd, info->ai_addr, info->ai_addrlen) < 0 || listen(socketFd, 64) < 0) {
+		sock::printLastError("bind");
+		sock::closeSocket(socketFd);
+		socketFd = -1;
+	}
+	freeaddrinfo(info);
+	return socketFd;
+}
+
+// creates a socket of the given type for the address, addr gets the resolved address
+// returns -1 on failure
+int socketTo(std::string ip, std::string port, int type, sockaddr_storage& addr) {
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = type;
+	addrinfo* info;
+	int status;
+	if ((status = getaddrinfo(ip.c_str(), port.c_str(), &hints, &info)) != 0) {
+		fprintf(stderr, "getaddrinfo %s: %s\n", ip.c_str(), gai_strerror(status));
+		return -1;
+	}
+	int socketFd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+	if (socketFd < 0)
+		sock::printLastError("socket");
+	else
+		memcpy(&addr, info->ai_addr, info->ai_addrlen);
+	freeaddrinfo(info);
+	return socketFd;
+}
+
+// Directory
+
+void sendQuery() {
+	DirectoryQueryPacket query;
+	query.username = "router";
+	query.queryId = _queryId;
+	query.region = _region;
+	query.offset = _queryOffset;
+	query.sendToDgram(_directorySocket, reinterpret_cast<sockaddr*>(&_directoryAddr));
+}
+
+void startRefresh() {
+	_queryId++; // answers to an unfinished refresh are ignored from now on
+	_queryOffset = 0;
+	_queryRooms.clear();
+	sendQuery();
+}
+
+// replaces the rooms and backends with the complete answer of the directory
+// rooms keep their router id as long as the directory lists them
+void applyRooms(const std::vector<DirectoryRoom>& rooms) {
+	auto now = Clock::now();
+	std::unordered_map<std::string, RoutedRoom> routed;
+	std::map<std::string, Backend> backends;
+	for (const auto& room : rooms) {
+		std::string key = roomKey(room);
+		auto it = _rooms.find(key);
+		RoutedRoom& routedRoom = routed[key];
+		routedRoom.id = it != _rooms.end() ? it->second.id : _nextRoomId++;
+		routedRoom.room = room;
+	}
+	for (auto& roomPair : _rooms) // created rooms the directory doesn't know yet
+		if (roomPair.second.keepUntil > now && !routed.count(roomPair.first))
+			routed[roomPair.first] = roomPair.second;
+
+	_roomKeys.clear();
+	for (auto& roomPair : routed) {
+		const DirectoryRoom& room = roomPair.second.room;
+		_roomKeys[roomPair.second.id] = roomPair.first;
+		Backend& backend = backends[serverKey(room.address, room.port)];
+		backend.address = room.address;
+		backend.port = room.port;
+		backend.players += room.info.players;
+		backend.rooms++;
+	}
+	_rooms.swap(routed);
+	_backends.swap(backends);
+}
+
+void receiveDirectory() {
+	sockaddr_storage addr;
+	int addrlen = sizeof addr;
+	int type;
+	auto spPacket = Packet::receiveFromDgram(type, _directorySocket, reinterpret_cast<sockaddr*>(&addr), &addrlen);
+	if (!spPacket || type != eDIRECTORY_ROOMS)
+		return;
+	DirectoryRoomsPacket& answer = *reinterpret_cast<DirectoryRoomsPacket*>(spPacket.get());
+	if (answer.queryId != _queryId) // a late page of an earlier refresh
+		return;
+	_queryRooms.insert(_queryRooms.end(), answer.rooms.begin(), answer.rooms.end());
+	if (answer.more && !answer.rooms.empty()) {
+		_queryOffset += answer.rooms.size();
+		sendQuery();
+		return;
+	}
+	applyRooms(_queryRooms);
+	_queryRooms.clear();
+}
+
+// Placement
+
+// the server with the fewest players, fewer rooms break ties
+Backend* leastLoadedBackend() {
+	Backend* pBest = nullptr;
+	for (auto& backendPair : _backends) {
+		Backend& backend = backendPair.second;
+		if (!pBest || backend.load() < pBest->load() || (backend.load() == pBest->load() && backend.rooms < pBest->rooms))
+			pBest = &backend;
+	}
+	return pBest;
+}
+
+// a room with a free slot on the least loaded server that has one, rooms with more players are filled first
+RoutedRoom* placePlayer() {
+	RoutedRoom* pBest = nullptr;
+	uint32_t bestLoad = 0;
+	for (auto& roomPair : _rooms) {
+		RoutedRoom& routedRoom = roomPair.second;
+		const RoomInfo& info = routedRoom.room.info;
+		if (info.players >= info.maxPlayers)
+			continue;
+		uint32_t load = _backends[serverKey(routedRoom.room.address, routedRoom.room.port)].load();
+		if (!pBest || load < bestLoad || (load == bestLoad && info.players > pBest->room.info.players)) {
+			pBest = &routedRoom;
+			bestLoad = load;
+		}
+	}
+	return pBest;
+}
+
+RoutedRoom* findRoom(uint32_t id) {
+	auto it = _roomKeys.find(id);
+	if (it == _roomKeys.end())
+		return nullptr;
+	return &_rooms.at(it->second);
+}
+
+// Clients
+
+RouterClient* findClient(uint32_t id) {
+	for (auto& client : _clients)
+		if (client.id == id)
+			return &client;
+	return nullptr;
+}
+
+// answers are sent when the socket takes them, see flush
+void queue(RouterClient& client, Packet& packet) {
+	PackedPacket spPacked = packet.packShared();
+	client.queue.push_back(spPacked);
+	client.queuedBytes += spPacked->size();
+}
+
+// returns false if the connection broke or the client stopped reading
+bool flush(RouterClient& client) {
+	if (client.queuedBytes > _maxQueuedBytes)
+		return false;
+	while (!client.queue.empty()) {
+		const PackedPacket& spPacked = client.queue.front();
+		int bytesSent = send(client.socket, spPacked->data() + client.sentOffset, static_cast<int>(spPacked->size() - client.sentOffset), 0);
+		if (bytesSent < 0)
+			return sock::wouldBlock();
+		client.sentOffset += bytesSent;
+		if (client.sentOffset < spPacked->size())
+			return true;
+		client.queuedBytes -= spPacked->size();
+		client.sentOffset = 0;
+		client.queue.pop_front();
+	}
+	return true;
+}
+
+void acceptClient() {
+	sockaddr_storage addr;
+	socklen_t addrlen = sizeof addr;
+	int socketFd = accept(_listenSocket, reinterpret_cast<sockaddr*>(&addr), &addrlen);
+	if (socketFd < 0) {
+		sock::printLastError("accept");
+		return;
+	}
+	sock::setBlocking(socketFd, false);
+	RouterClient client;
+	client.id = _nextClientId++;
+	client.socket = socketFd;
+	client.connected = Clock::now();
+	_clients.push_back(client);
+}
+
+void answerJoin(RouterClient& client, uint32_t roomId) {
+	RoutedRoom* pRoom = roomId == 0 ? placePlayer() : findRoom(roomId);
+	if (!pRoom) {
+		printf("%s could not join room %u\n", client.username.c_str(), roomId);
+		RoomJoinPacket rejectPacket;
+		rejectPacket.username = client.username;
+		rejectPacket.roomId = 0;
+		queue(client, rejectPacket);
+		return;
+	}
+	RedirectPacket redirectPacket;
+	redirectPacket.username = client.username;
+	redirectPacket.address = pRoom->room.address;
+	redirectPacket.port = pRoom->room.port;
+	redirectPacket.roomId = pRoom->room.info.id;
+	queue(client, redirectPacket);
+	pRoom->room.info.players++; // until the next refresh has the real count
+	_backends[serverKey(pRoom->room.address, pRoom->room.port)].placed++;
+	_redirects++;
+	printf("%s redirected to room %s on %s:%s\n", client.username.c_str(), pRoom->room.info.name.c_str(), pRoom->room.address.c_str(), pRoom->room.port.c_str());
+}
+
+void answerCreate(uint32_t clientId, const std::string& name, uint32_t maxPlayers, uint32_t roomId) {
+	RouterClient* pClient = findClient(clientId);
+	if (!pClient) // gone while the room was created, the room closes when it stays empty
+		return;
+	RoomCreatePacket answerPacket;
+	answerPacket.username = pClient->username;
+	answerPacket.name = name;
+	answerPacket.maxPlayers = maxPlayers;
+	answerPacket.roomId = roomId;
+	queue(*pClient, answerPacket);
+}
+
+// connects to the least loaded server, the room is created when the connection is established
+void startCreate(RouterClient& client, RoomCreatePacket& packet) {
+	Backend* pBackend = leastLoadedBackend();
+	sockaddr_storage addr;
+	int socketFd = pBackend ? socketTo(pBackend->address, pBackend->port, SOCK_STREAM, addr) : -1;
+	if (socketFd < 0) {
+		answerCreate(client.id, packet.name, packet.maxPlayers, 0);
+		return;
+	}
+	socklen_t addrlen = addr.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
+	sock::setBlocking(socketFd, false);
+	if (connect(socketFd, reinterpret_cast<sockaddr*>(&addr), addrlen) < 0 && !sock::isConnectPending()) {
+		sock::printLastError("connect");
+		sock::closeSocket(socketFd);
+		answerCreate(client.id, packet.name, packet.maxPlayers, 0);
+		return;
+	}
+	PendingCreate create;
+	create.clientId = client.id;
+	create.socket = socketFd;
+	create.server = serverKey(pBackend->address, pBackend->port);
+	create.name = packet.name;
+	create.maxPlayers = packet.maxPlayers;
+	create.deadline = Clock::now() + _createTimeout;
+	_creates.push_back(create);
+	pBackend->placed++;
+	pBackend->rooms++;
+}
+
+// returns false when the create is done, successful or not
+bool continueCreate(PendingCreate& create, short revents) {
+	if (!create.sent) { // connecting
+		if (!(revents & (POLLOUT | POLLERR | POLLHUP)))
+			return true;
+		if (sock::socketError(create.socket) != 0) {
+			printf("could not reach %s to create room %s\n", create.server.c_str(), create.name.c_str());
+			answerCreate(create.clientId, create.name, create.maxPlayers, 0);
+			return false;
+		}
+		ConnectPacket connectPacket; // the connection is new, its empty send buffer takes these few bytes whole
+		connectPacket.username = "router:" + _routerPort + ":" + std::to_string(_nextCreateId++);
+		connectPacket.sendTo(create.socket);
+		RoomCreatePacket createPacket;
+		createPacket.username = connectPacket.username;
+		createPacket.name = create.name;
+		createPacket.maxPlayers = create.maxPlayers;
+		createPacket.sendTo(create.socket);
+		create.sent = true;
+		return true;
+	}
+	if (!(revents & (POLLIN | POLLHUP)))
+		return true;
+	if (!create.reader.receive(create.socket)) {
+		printf("%s closed the connection while creating room %s\n", create.server.c_str(), create.name.c_str());
+		answerCreate(create.clientId, create.name, create.maxPlayers, 0);
+		return false;
+	}
+	int type;
+	bool malformed = false;
+	std::shared_ptr<Packet> spPacket;
+	while ((spPacket = create.reader.next(type, malformed)) && type != eROOM_CREATE) {} // e.g. heartbeats
+	if (malformed) {
+		printf("%s sent a malformed packet while creating room %s\n", create.server.c_str(), create.name.c_str());
+		answerCreate(create.clientId, create.name, create.maxPlayers, 0);
+		return false;
+	}
+	if (!spPacket) // the answer didn't arrive yet
+		return true;
+	RoomCreatePacket& answer = *reinterpret_cast<RoomCreatePacket*>(spPacket.get());
+	uint32_t roomId = 0;
+	if (answer.roomId != 0 && _backends.count(create.server)) {
+		const Backend& backend = _backends[create.server];
+		RoutedRoom routedRoom;
+		routedRoom.id = _nextRoomId++;
+		routedRoom.room.address = backend.address;
+		routedRoom.room.port = backend.port;
+		routedRoom.room.region = _region;
+		routedRoom.room.info = { answer.roomId, answer.name, 0, answer.maxPlayers };
+		routedRoom.keepUntil = Clock::now() + _createdRoomKeep;
+		std::string key = roomKey(routedRoom.room);
+		_rooms[key] = routedRoom;
+		_roomKeys[routedRoom.id] = key;
+		roomId = routedRoom.id;
+		printf("room %s created on %s\n", answer.name.c_str(), create.server.c_str());
+	}
+	answerCreate(create.clientId, create.name, answer.maxPlayers, roomId);
+	DisconnectPacket disconnectPacket;
+	disconnectPacket.username = answer.username;
+	disconnectPacket.sendTo(create.socket);
+	return false;
+}
+
+// returns false if the client closed its connection
+bool handleClientPacket(RouterClient& client, int type, std::shared_ptr<Packet>& spPacket) {
+	switch (type)
+	{
+	case eCONNECT:
+		client.username = spPacket->username;
+		break;
+	case eROOM_LIST: {
+		RoomListPacket listPacket;
+		listPacket.username = client.username;
+		for (auto& roomPair : _rooms) {
+			RoomInfo info = roomPair.second.room.info;
+			info.id = roomPair.second.id;
+			listPacket.rooms.push_back(info);
+		}
+		queue(client, listPacket);
+		break;
+	}
+	case eROOM_JOIN:
+		if (client.username.empty()) {
+			printf("client has to connect before joining a room\n");
+			break;
+		}
+		answerJoin(client, reinterpret_cast<RoomJoinPacket*>(spPacket.get())->roomId);
+		break;
+	case eROOM_CREATE:
+		startCreate(client, *reinterpret_cast<RoomCreatePacket*>(spPacket.get()));
+		break;
+	case eDISCONNECT:
+		return false;
+	default: // game packets sent before the redirect arrived
+		break;
+	}
+	return true;
+}
+
+// returns false if the client closed its connection or sent a malformed packet
+bool recvClient(RouterClient& client) {
+	if (!client.reader.receive(client.socket))
+		return false;
+	int type;
+	bool malformed = false;
+	while (auto spPacket = client.reader.next(type, malformed))
+		if (!handleClientPacket(client, type, spPacket))
+			return false;
+	return !malformed;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 4) {
+		fprintf(stderr, "usage: VODRouter <port> <directory ip> <directory port> [region]\n");
+		return 1;
+	}
+	_routerPort = argv[1];
+	if (argc >= 5)
+		_region = argv[4];
+
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+		fprintf(stderr, "WSAStartup failed\n");
+		return 1;
+	}
+#else
+	signal(SIGPIPE, SIG_IGN); // clients vanish while answers are sent to them, the send fails instead
+#endif // _WIN32
+
+	_listenSocket = listenOn(_routerPort);
+	_directorySocket = socketTo(argv[2], argv[3], SOCK_DGRAM, _directoryAddr);
+	if (_listenSocket < 0 || _directorySocket < 0)
+		return 1;
+	printf("router listening on port %s, directory %s:%s\n", argv[1], argv[2], argv[3]);
+
+	std::vector<pollfd> pollfds;
+	auto nextReport = Clock::now();
+	while (true) {
+		pollfds.clear(); // #0 listen, #1 directory, then the clients, then the creates
+		pollfds.push_back({ _listenSocket, POLLIN, 0 });
+		pollfds.push_back({ _directorySocket, POLLIN, 0 });
+		for (auto& client : _clients)
+			pollfds.push_back({ client.socket, static_cast<short>(client.queue.empty() ? POLLIN : POLLIN | POLLOUT), 0 });
+		for (auto& create : _creates)
+			pollfds.push_back({ create.socket, static_cast<short>(create.sent ? POLLIN : POLLOUT), 0 });
+
+		if (sock::pollState(pollfds.data(), pollfds.size(), _pollTimeout) < 0) {
+			sock::printLastError("poll");
+			break;
+		}
+		auto now = Clock::now();
+		if (pollfds[1].revents & POLLIN)
+			receiveDirectory();
+		if (now >= _nextRefresh) {
+			startRefresh();
+			_nextRefresh = now + _refreshInterval;
+		}
+
+		size_t clientCount = _clients.size(); // handling may add creates, but not clients
+		for (size_t i = 0, p = 2; i < clientCount; i++, p++) {
+			short revents = pollfds[p].revents;
+			bool open = true;
+			if (revents & (POLLIN | POLLHUP))
+				open = recvClient(_clients[i]);
+			if (!open || now - _clients[i].connected > _clientTimeout) {
+				sock::closeSocket(_clients[i].socket);
+				_clients.erase(_clients.begin() + i);
+				pollfds.erase(pollfds.begin() + p);
+				clientCount--;
+				i--;
+				p--;
+			}
+		}
+
+		size_t createCount = pollfds.size() - 2 - _clients.size(); // creates started above aren't polled yet
+		for (size_t i = 0; i < createCount; i++) {
+			bool pending = continueCreate(_creates[i], pollfds[2 + _clients.size() + i].revents);
+			if (pending && now > _creates[i].deadline) {
+				printf("%s didn't create room %s in time\n", _creates[i].server.c_str(), _creates[i].name.c_str());
+				answerCreate(_creates[i].clientId, _creates[i].name, _creates[i].maxPlayers, 0);
+				pending = false;
+			}
+			if (!pending) {
+				sock::closeSocket(_creates[i].socket);
+				_creates.erase(_creates.begin() + i);
+				pollfds.erase(pollfds.begin() + 2 + _clients.size() + i);
+				createCount--;
+				i--;
+			}
+		}
+
+		for (size_t i = 0; i < _clients.size(); i++) { // answers queued above are sent right away when the socket takes them
+			if (flush(_clients[i]))
+				continue;
+			sock::closeSocket(_clients[i].socket);
+			_clients.erase(_clients.begin() + i);
+			i--;
+		}
+
+		if (pollfds[0].revents & POLLIN)
+			acceptClient();
+
+		if (now >= nextReport) {
+			printf("%zu servers, %zu rooms, %zu clients, %llu redirects\n", _backends.size(), _rooms.size(), _clients.size(), static_cast<unsigned long long>(_redirects));
+			nextReport = now + std::chrono::seconds(60);
+		}
+	}
+
+	for (auto& client : _clients)
+		sock::closeSocket(client.socket);
+	for (auto& create : _creates)
+		sock::closeSocket(create.socket);
+	sock::closeSocket(_listenSocket);
+	sock::closeSocket(_directorySocket);
+#ifdef _WIN32
+	WSACleanup();
+#endif // _WIN32
+	return 0;
+}